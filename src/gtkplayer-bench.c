@@ -0,0 +1,1465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gst/video/video.h>
+
+#include "player.h"
+#include "player-json.h"
+#include "player-mosaic.h"
+
+/* Headless playback benchmark: decodes local media as fast as possible and
+ * prints one JSON object per run. No display server is needed. */
+
+static gint repeats = 3;
+static gint frames = 300;
+static gint width = 0;          /* 1280x720, 3840x2160 with --budget */
+static gint height = 0;
+static gchar * input = NULL;
+static gchar * output = NULL;
+static gchar * rates = NULL;
+static gint rate_seconds = 5;
+static gint steps = 0;
+static gint step_cache = 64;
+static gint snapshots = 0;
+static gchar * snapshot_format = "png";
+static gint snapshot_width = 0;
+static gint cues = 0;
+static gchar * mosaics = NULL;
+static gint budget = 0;
+static gint rebuffer_tolerance = 0;
+static gint audio_seconds = 0;
+static gint live_latency = 0;
+static gchar * resume_sizes = NULL;
+static gint throttle = 0;
+static gchar * tiles_run = NULL;
+static const gchar * self_path = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "repeat", 'r', 0, G_OPTION_ARG_INT, &repeats, "Run N times", "N" },
+  { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames of generated media", "N" },
+  { "width", 'w', 0, G_OPTION_ARG_INT, &width, "Width of generated media", "W" },
+  { "height", 0, 0, G_OPTION_ARG_INT, &height, "Height of generated media", "H" },
+  { "input", 'i', 0, G_OPTION_ARG_FILENAME, &input, "Local file instead of generated media", "FILE" },
+  { "rates", 0, 0, G_OPTION_ARG_STRING, &rates, "Play in real time at each rate instead, e.g. 0.5,1,2,8,32,-1", "LIST" },
+  { "rate-seconds", 0, 0, G_OPTION_ARG_INT, &rate_seconds, "Wall clock time per rate", "N" },
+  { "steps", 0, 0, G_OPTION_ARG_INT, &steps, "Step N frames forward then backward from the middle instead", "N" },
+  { "step-cache", 0, 0, G_OPTION_ARG_INT, &step_cache, "Decoded frames kept for backward steps, 0 to always seek", "MB" },
+  { "snapshots", 0, 0, G_OPTION_ARG_INT, &snapshots, "Play in real time with and without N frame grabs per second instead", "N" },
+  { "snapshot-format", 0, 0, G_OPTION_ARG_STRING, &snapshot_format, "Frame grab format: png or jpg", "EXT" },
+  { "snapshot-width", 0, 0, G_OPTION_ARG_INT, &snapshot_width, "Scale frame grabs to W, 0 keeps the frame size", "W" },
+  { "cues", 0, 0, G_OPTION_ARG_INT, &cues, "Load and look up a generated subtitle file of N cues instead", "N" },
+  { "mosaic", 0, 0, G_OPTION_ARG_STRING, &mosaics, "Compare a mosaic with separate players for each tile count, e.g. 4,16,36", "LIST" },
+  { "budget", 0, 0, G_OPTION_ARG_INT, &budget, "Play generated 4K in real time with the element defaults then within MB instead", "MB" },
+  { "rebuffer-tolerance", 0, 0, G_OPTION_ARG_INT, &rebuffer_tolerance, "Budget runs fail beyond N rebuffers", "N" },
+  { "audio", 0, 0, G_OPTION_ARG_INT, &audio_seconds, "Compare audio only playback paths on a generated N seconds audio file instead", "N" },
+  { "live", 0, 0, G_OPTION_ARG_INT, &live_latency, "Play a loopback RTP/UDP sender live at a latency of MS, raw and through an SDP, instead", "MS" },
+  { "resume", 0, 0, G_OPTION_ARG_STRING, &resume_sizes, "Fill a resume store with each number of entries and time lookups instead, e.g. 1000,100000", "LIST" },
+  { "throttle", 0, 0, G_OPTION_ARG_INT, &throttle, "Play over HTTP served at N% of the media bitrate and check the buffering pauses instead", "N" },
+  { "tiles-run", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &tiles_run, "One --mosaic configuration, in a process of its own", "MODE:N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write results to FILE instead of stdout", "FILE" },
+  { NULL }
+};
+
+#define MS(t) (GST_CLOCK_TIME_IS_VALID (t) ? (t) / 1e6 : -1.0)
+
+/* One headless player and the loop watching its bus */
+typedef struct _BenchRun {
+    PlayerData data;
+    GMainLoop *loop;
+    GstBus *bus;
+    gchar *uri;                 /* As a JSON string */
+    guint timeout;
+    GstClockTime start;
+    GstClockTime end;
+    gboolean failed;
+} BenchRun;
+
+/* Keep stdout for the results */
+static void print_to_stderr (const gchar *string)
+{
+    fputs (string, stderr);
+}
+
+/* Encode test media once, with elements of gst-plugins-base only */
+static gchar *generate_media (void)
+{
+    GError *error = NULL;
+    GstElement *pipeline;
+    GstBus *bus;
+    GstMessage *msg;
+    gchar *name, *path, *desc;
+
+    name = g_strdup_printf ("gtkplayer-bench-%dx%d-%d.ogg", width, height, frames);
+    path = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+    if (g_file_test (path, G_FILE_TEST_EXISTS))
+        return path;
+
+    /* 1470 samples at 44.1 kHz last one 30 fps frame */
+    desc = g_strdup_printf ("videotestsrc num-buffers=%d ! "
+                            "video/x-raw,width=%d,height=%d,framerate=30/1 ! "
+                            "theoraenc ! queue ! oggmux name=mux ! filesink location=\"%s\" "
+                            "audiotestsrc num-buffers=%d samplesperbuffer=1470 ! "
+                            "audio/x-raw,rate=44100 ! audioconvert ! vorbisenc ! queue ! mux.",
+                            frames, width, height, path, frames);
+    pipeline = gst_parse_launch (desc, &error);
+    g_free (desc);
+    if (!pipeline) {
+        g_printerr ("Could not generate test media: %s\n", error->message);
+        g_clear_error (&error);
+        g_free (path);
+        return NULL;
+    }
+    g_clear_error (&error);
+
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+    bus = gst_element_get_bus (pipeline);
+    msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+                                      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+        g_printerr ("Could not generate test media\n");
+        g_unlink (path);
+        g_free (path);
+        path = NULL;
+    }
+    gst_message_unref (msg);
+    gst_object_unref (bus);
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    gst_object_unref (pipeline);
+
+    return path;
+}
+
+/* s as a JSON string, quotes included */
+static gchar *json_quote (const gchar *s)
+{
+    GString *json = g_string_new (NULL);
+
+    player_json_string (json, s);
+    return g_string_free (json, FALSE);
+}
+
+/* Resident memory now, unlike the peak of getrusage() which only grows
+ * across runs. Linux only, -1 elsewhere. */
+static glong rss_kb (void)
+{
+    gchar *statm = NULL;
+    glong pages = -1;
+
+    if (g_file_get_contents ("/proc/self/statm", &statm, NULL, NULL))
+        sscanf (statm, "%*ld %ld", &pages);
+    g_free (statm);
+    return pages < 0 ? -1 : pages * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static gdouble cpu_ms (void)
+{
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+static void bench_done_cb (GstBus *bus, GstMessage *msg, BenchRun *run)
+{
+    run->end = gst_util_get_timestamp ();
+    run->failed = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR;
+    g_main_loop_quit (run->loop);
+}
+
+static gboolean bench_timeout_cb (BenchRun *run)
+{
+    run->timeout = 0;
+    run->end = gst_util_get_timestamp ();
+    g_main_loop_quit (run->loop);
+    return G_SOURCE_REMOVE;
+}
+
+/* A headless player, to configure before bench_open() */
+static gboolean bench_new (BenchRun *run)
+{
+    memset (run, 0, sizeof (*run));
+    return player_new_full (&run->data, PLAYER_RENDER_HEADLESS) >= 0;
+}
+
+/* Set the uri and stop the loop at the end of the stream or on error */
+static void bench_open (BenchRun *run, const gchar *uri)
+{
+    run->uri = json_quote (uri);
+    player_set_uri (&run->data, uri);
+
+    run->loop = g_main_loop_new (NULL, FALSE);
+    run->bus = gst_element_get_bus (run->data.playbin);
+    g_signal_connect (run->bus, "message::eos", G_CALLBACK (bench_done_cb), run);
+    g_signal_connect (run->bus, "message::error", G_CALLBACK (bench_done_cb), run);
+}
+
+/* Paused on the first frame, returns the duration */
+static gint64 bench_preroll (BenchRun *run)
+{
+    gint64 duration = 0;
+
+    gst_element_set_state (run->data.playbin, GST_STATE_PAUSED);
+    gst_element_get_state (run->data.playbin, NULL, NULL, GST_CLOCK_TIME_NONE);
+    gst_element_query_duration (run->data.playbin, GST_FORMAT_TIME, &duration);
+    return duration;
+}
+
+/* Run the loop until it is stopped, or for seconds of wall clock time
+ * when > 0 */
+static void bench_loop (BenchRun *run, gint seconds)
+{
+    if (seconds > 0)
+        run->timeout = g_timeout_add_seconds (seconds, (GSourceFunc) bench_timeout_cb, run);
+    g_main_loop_run (run->loop);
+    if (run->timeout)
+        g_source_remove (run->timeout);
+    run->timeout = 0;
+}
+
+static void bench_play (BenchRun *run, gint seconds)
+{
+    run->start = gst_util_get_timestamp ();
+    player_start (&run->data);
+    bench_loop (run, seconds);
+}
+
+static void bench_free (BenchRun *run)
+{
+    if (run->bus) {
+        g_signal_handlers_disconnect_by_data (run->bus, run);
+        gst_object_unref (run->bus);
+    }
+    if (run->loop)
+        g_main_loop_unref (run->loop);
+    player_free (&run->data);
+    g_free (run->uri);
+}
+
+static gboolean bench_run (const gchar *uri, goffset bytes, FILE *out)
+{
+    BenchRun run;
+    PlayerRenderStats stats;
+    PlayerPrerollTimes times;
+    glong rss = rss_kb ();
+    gdouble seconds;
+
+    if (!bench_new (&run))
+        return FALSE;
+    g_object_set (run.data.video_sink, "sync", FALSE, NULL);
+    g_object_set (run.data.audio_sink, "sync", FALSE, NULL);
+    bench_open (&run, uri);
+    bench_play (&run, 0);
+
+    player_get_render_stats (&run.data, &stats);
+    player_get_preroll_times (&run.data, &times);
+    seconds = (run.end - run.start) / 1e9;
+
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"frames\":%" G_GUINT64_FORMAT
+             ",\"seconds\":%.3f,\"fps\":%.1f,\"bytes_per_second\":%.0f"
+             ",\"time_to_first_frame_ms\":%.2f,\"typefind_ms\":%.2f"
+             ",\"demux_ms\":%.2f,\"decoder_ms\":%.2f,\"first_buffer_ms\":%.2f"
+             ",\"rss_kb\":%ld}\n",
+             run.uri, run.failed ? "false" : "true", stats.frames, seconds,
+             stats.frames / seconds, bytes / seconds,
+             stats.frames ? (stats.first_frame - run.start) / 1e6 : -1.0,
+             MS (times.typefind), MS (times.demux), MS (times.decoder),
+             MS (times.first_buffer), rss_kb () - rss);
+    fflush (out);
+
+    bench_free (&run);
+    return !run.failed;
+}
+
+/* Synchronized playback at the given rate: what matters is the decoding
+ * work per frame actually shown, which trick modes keep bounded */
+static gboolean bench_rate (const gchar *uri, gdouble rate, FILE *out)
+{
+    BenchRun run;
+    PlayerRenderStats before, after;
+    gint64 duration;
+    gdouble cpu;
+
+    if (!bench_new (&run))
+        return FALSE;
+    bench_open (&run, uri);
+    duration = bench_preroll (&run);
+
+    /* Backward playback starts from the end */
+    player_set_rate (&run.data, rate);
+    if (rate < 0 && duration > 0)
+        player_command_seek (&run.data, duration);
+    player_command (&run.data, PLAYER_COMMAND_PLAY);
+
+    player_get_render_stats (&run.data, &before);
+    cpu = cpu_ms ();
+    run.start = gst_util_get_timestamp ();
+    bench_loop (&run, rate_seconds);
+    cpu = cpu_ms () - cpu;
+    player_get_render_stats (&run.data, &after);
+
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"rate\":%.2f,\"frames\":%" G_GUINT64_FORMAT
+             ",\"seconds\":%.3f,\"cpu_ms\":%.1f,\"cpu_ms_per_frame\":%.3f}\n",
+             run.uri, run.failed ? "false" : "true", player_get_rate (&run.data),
+             after.frames - before.frames, (run.end - run.start) / 1e9, cpu,
+             after.frames > before.frames ? cpu / (after.frames - before.frames) : -1.0);
+    fflush (out);
+
+    bench_free (&run);
+    return !run.failed;
+}
+
+/* Run the main loop until the step was answered */
+static gboolean wait_steps (PlayerData *data, guint64 done)
+{
+    PlayerRenderStats stats;
+    GstClockTime deadline = gst_util_get_timestamp () + 5 * GST_SECOND;
+
+    do {
+        while (g_main_context_iteration (NULL, FALSE));
+        player_get_render_stats (data, &stats);
+        if (stats.steps_forward + stats.steps_backward >= done)
+            return TRUE;
+        g_usleep (1000);
+    } while (gst_util_get_timestamp () < deadline);
+
+    return FALSE;
+}
+
+/* Paused frame steps from the middle of the media. Backward steps are only
+ * cheap while the frame cache lasts, then each one decodes a whole GOP. */
+static gboolean bench_steps (const gchar *uri, FILE *out)
+{
+    BenchRun run;
+    PlayerRenderStats stats;
+    gint64 duration;
+    gboolean ok = TRUE;
+    gint i;
+
+    if (!bench_new (&run))
+        return FALSE;
+    player_set_step_cache (&run.data, (gsize) step_cache * 1024 * 1024);
+    bench_open (&run, uri);
+    duration = bench_preroll (&run);
+    gst_element_seek_simple (run.data.playbin, GST_FORMAT_TIME,
+                             GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                             duration / 2);
+    gst_element_get_state (run.data.playbin, NULL, NULL, GST_CLOCK_TIME_NONE);
+    while (g_main_context_iteration (NULL, FALSE));
+
+    for (i = 1; ok && i <= steps; i++)
+        ok = player_step (&run.data, 1) == 0 && wait_steps (&run.data, i);
+    for (i = 1; ok && i <= steps; i++)
+        ok = player_step (&run.data, -1) == 0 && wait_steps (&run.data, steps + i);
+
+    player_get_render_stats (&run.data, &stats);
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"step_cache_mb\":%d"
+             ",\"steps_forward\":%" G_GUINT64_FORMAT ",\"forward_ms\":%.2f"
+             ",\"steps_backward\":%" G_GUINT64_FORMAT ",\"backward_ms\":%.2f"
+             ",\"steps_cached\":%" G_GUINT64_FORMAT "}\n",
+             run.uri, ok ? "true" : "false", step_cache,
+             stats.steps_forward, MS (stats.step_forward_latency),
+             stats.steps_backward, MS (stats.step_backward_latency),
+             stats.steps_cached);
+    fflush (out);
+
+    bench_free (&run);
+    return ok;
+}
+
+typedef struct _SnapshotBench {
+    PlayerData *data;
+    gchar *path;
+    guint grabs;
+    guint reported;
+    guint failed;
+    GstClockTime max_latency;
+} SnapshotBench;
+
+static void snapshot_done_cb (PlayerData *data, const gchar *path,
+                              gint result, gpointer user_data)
+{
+    SnapshotBench *bench = g_object_get_data (G_OBJECT (data->playbin), "bench");
+    GstClockTime *request = user_data;
+
+    bench->reported++;
+    if (result < 0)
+        bench->failed++;
+    bench->max_latency = MAX (bench->max_latency, gst_util_get_timestamp () - *request);
+    g_free (request);
+}
+
+static gboolean snapshot_cb (SnapshotBench *bench)
+{
+    GstClockTime *request = g_new (GstClockTime, 1);
+
+    *request = gst_util_get_timestamp ();
+    if (player_snapshot (bench->data, bench->path, snapshot_width, 0,
+                         snapshot_done_cb, request) < 0) {
+        g_free (request);
+        bench->failed++;
+    } else {
+        bench->grabs++;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* Synchronized playback with grabs_per_second frame grabs: the grabs must
+ * not show in the frame intervals, encoding is off the streaming thread */
+static gboolean bench_snapshots (const gchar *uri, gint grabs_per_second, FILE *out)
+{
+    BenchRun run;
+    PlayerRenderStats stats;
+    SnapshotBench bench = { NULL, NULL, 0, 0, 0, 0 };
+    guint grab_timeout = 0;
+    gchar *name;
+
+    if (!bench_new (&run))
+        return FALSE;
+    bench.data = &run.data;
+    bench_open (&run, uri);
+    g_object_set_data (G_OBJECT (run.data.playbin), "bench", &bench);
+    name = g_strdup_printf ("gtkplayer-bench-grab.%s", snapshot_format);
+    bench.path = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+
+    if (grabs_per_second > 0)
+        grab_timeout = g_timeout_add (1000 / grabs_per_second, (GSourceFunc) snapshot_cb, &bench);
+    bench_play (&run, rate_seconds);
+    if (grab_timeout)
+        g_source_remove (grab_timeout);
+
+    player_get_render_stats (&run.data, &stats);
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"grabs_per_second\":%d"
+             ",\"grabs\":%u,\"grabs_failed\":%u,\"grab_ms\":%.2f,\"max_grab_ms\":%.2f"
+             ",\"frames\":%" G_GUINT64_FORMAT ",\"frame_ms\":%.2f,\"max_frame_ms\":%.2f"
+             ",\"lateness_ms\":%.2f}\n",
+             run.uri, run.failed ? "false" : "true", grabs_per_second,
+             bench.grabs, bench.failed,
+             stats.snapshots ? stats.snapshot_latency / 1e6 : -1.0,
+             MS (bench.max_latency), stats.frames, MS (stats.mean_interval),
+             MS (stats.max_interval), stats.mean_lateness / 1e6);
+    fflush (out);
+
+    while (bench.reported < bench.grabs)
+        g_main_context_iteration (NULL, TRUE);
+    bench_free (&run);
+    g_unlink (bench.path);
+    g_free (bench.path);
+    return !run.failed && !bench.failed;
+}
+
+/* Cues overlap their neighbour every tenth line. With long, a first cue
+ * spans the whole file and every 500th one the next 500, like signs or a
+ * watermark: what a lookup must not walk back through. */
+static gchar *generate_subtitles (gboolean long_cues)
+{
+    GString *srt = g_string_new (NULL);
+    gchar *name, *path;
+    gint i;
+
+    name = g_strdup_printf ("gtkplayer-bench-%d%s.srt", cues, long_cues ? "-long" : "");
+    path = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+    if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+        g_string_free (srt, TRUE);
+        return path;
+    }
+
+    for (i = 0; i < cues; i++) {
+        guint64 start = i * 2000, end = start + (i % 10 ? 1900 : 2500);
+
+        if (long_cues && i == 0)
+            end = (guint64) cues * 2000;
+        else if (long_cues && i % 500 == 0)
+            end = start + 500 * 2000;
+
+        g_string_append_printf (srt, "%d\n%02u:%02u:%02u,%03u --> %02u:%02u:%02u,%03u\n"
+                                "Line %d of the <i>benchmark</i> & more\n\n", i + 1,
+                                (guint) (start / 3600000), (guint) (start / 60000 % 60),
+                                (guint) (start / 1000 % 60), (guint) (start % 1000),
+                                (guint) (end / 3600000), (guint) (end / 60000 % 60),
+                                (guint) (end / 1000 % 60), (guint) (end % 1000), i);
+    }
+    if (!g_file_set_contents (path, srt->str, srt->len, NULL)) {
+        g_free (path);
+        path = NULL;
+    }
+    g_string_free (srt, TRUE);
+    return path;
+}
+
+/* Parse once, then one lookup per frame at 30 fps over the whole file,
+ * and random jumps like seeks would do */
+static gboolean bench_cues_file (FILE *out, gboolean long_cues)
+{
+    PlayerData data;
+    GstClockTime start, load, frame_lookup, seek_lookup, position;
+    GstClockTime end = (GstClockTime) cues * 2 * GST_SECOND;
+    guint64 lookups = 0, hits = 0;
+    gchar *path, *file, *text;
+    gint loaded, i;
+    gboolean ok;
+
+    if (!(path = generate_subtitles (long_cues)))
+        return FALSE;
+    if (player_new_full (&data, PLAYER_RENDER_HEADLESS) < 0)
+        return FALSE;
+
+    start = gst_util_get_timestamp ();
+    loaded = player_set_subtitle_file (&data, path);
+    load = gst_util_get_timestamp () - start;
+
+    start = gst_util_get_timestamp ();
+    for (position = 0; position < end; position += GST_SECOND / 30) {
+        text = player_get_subtitle_at (&data, position);
+        hits += text != NULL;
+        lookups++;
+        g_free (text);
+    }
+    frame_lookup = (gst_util_get_timestamp () - start) / lookups;
+
+    start = gst_util_get_timestamp ();
+    for (i = 0; i < 100000; i++)
+        g_free (player_get_subtitle_at (&data, g_random_int_range (0, cues) * 2 * GST_SECOND));
+    seek_lookup = (gst_util_get_timestamp () - start) / 100000;
+
+    /* The whole file cue is under every frame */
+    ok = loaded == cues && (!long_cues || hits == lookups);
+    file = json_quote (path);
+    fprintf (out, "{\"file\":%s,\"ok\":%s,\"cues\":%d,\"long_cues\":%s,\"load_ms\":%.2f"
+             ",\"lookups\":%" G_GUINT64_FORMAT ",\"hits\":%" G_GUINT64_FORMAT
+             ",\"lookup_ns\":%" G_GUINT64_FORMAT ",\"seek_lookup_ns\":%" G_GUINT64_FORMAT "}\n",
+             file, ok ? "true" : "false", loaded, long_cues ? "true" : "false",
+             load / 1e6, lookups, hits, frame_lookup, seek_lookup);
+    fflush (out);
+
+    player_free (&data);
+    g_free (file);
+    g_free (path);
+    return ok;
+}
+
+static gboolean bench_cues (FILE *out)
+{
+    gboolean ok = bench_cues_file (out, FALSE);
+
+    return bench_cues_file (out, TRUE) && ok;
+}
+
+static gboolean quit_cb (GMainLoop *loop)
+{
+    g_main_loop_quit (loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void print_tiles (FILE *out, const gchar *mode, gint tiles,
+                         guint64 frames, gdouble cpu, glong rss_before)
+{
+    fprintf (out, "{\"mode\":\"%s\",\"tiles\":%d,\"seconds\":%d"
+             ",\"frames\":%" G_GUINT64_FORMAT ",\"cpu_ms\":%.1f,\"cpu_percent\":%.1f"
+             ",\"rss_kb\":%ld}\n",
+             mode, tiles, rate_seconds, frames, cpu,
+             cpu / (rate_seconds * 10.0), rss_kb () - rss_before);
+    fflush (out);
+}
+
+/* One pipeline, video only, composited at 720p on one clock */
+static gboolean bench_mosaic (const gchar *uri, gint tiles, FILE *out)
+{
+    gint columns = 1, i;
+    PlayerMosaic *mosaic;
+    GMainLoop *loop;
+    glong rss = rss_kb ();
+    gdouble cpu;
+
+    while (columns * columns < tiles)
+        columns++;
+    mosaic = player_mosaic_new (columns, (tiles + columns - 1) / columns,
+                                1280, 720, TRUE);
+    if (!mosaic)
+        return FALSE;
+    for (i = 0; i < tiles; i++)
+        player_mosaic_add (mosaic, uri);
+
+    loop = g_main_loop_new (NULL, FALSE);
+    g_timeout_add_seconds (rate_seconds, (GSourceFunc) quit_cb, loop);
+    cpu = cpu_ms ();
+    player_mosaic_play (mosaic);
+    g_main_loop_run (loop);
+    cpu = cpu_ms () - cpu;
+
+    print_tiles (out, "mosaic", tiles, player_mosaic_get_frames (mosaic), cpu, rss);
+    g_main_loop_unref (loop);
+    player_mosaic_free (mosaic);
+    return TRUE;
+}
+
+/* The same number of full players, each with its own pipeline and clock */
+static gboolean bench_players (const gchar *uri, gint tiles, FILE *out)
+{
+    PlayerData *players = g_new0 (PlayerData, tiles);
+    PlayerRenderStats stats;
+    guint64 frames = 0;
+    GMainLoop *loop;
+    glong rss = rss_kb ();
+    gdouble cpu;
+    gint i;
+
+    for (i = 0; i < tiles; i++) {
+        if (player_new_full (&players[i], PLAYER_RENDER_HEADLESS) < 0) {
+            tiles = i;
+            break;
+        }
+        player_set_uri (&players[i], uri);
+    }
+
+    loop = g_main_loop_new (NULL, FALSE);
+    g_timeout_add_seconds (rate_seconds, (GSourceFunc) quit_cb, loop);
+    cpu = cpu_ms ();
+    for (i = 0; i < tiles; i++)
+        player_start (&players[i]);
+    g_main_loop_run (loop);
+    cpu = cpu_ms () - cpu;
+
+    for (i = 0; i < tiles; i++) {
+        player_get_render_stats (&players[i], &stats);
+        frames += stats.frames;
+    }
+    print_tiles (out, "players", tiles, frames, cpu, rss);
+    g_main_loop_unref (loop);
+    for (i = 0; i < tiles; i++)
+        player_free (&players[i]);
+    g_free (players);
+    return tiles > 0;
+}
+
+/* Real time playback with a memory budget, 0 for the element defaults.
+ * Fails when what the queues and the decoded frames were measured to hold
+ * goes over the budget, or when it rebuffers more than tolerated. */
+static gboolean bench_budget (const gchar *uri, gsize bytes, FILE *out)
+{
+    BenchRun run;
+    PlayerMemoryStats ms;
+    PlayerRenderStats rs;
+    glong rss = rss_kb ();
+    gboolean ok;
+
+    if (!bench_new (&run))
+        return FALSE;
+    player_set_memory_budget (&run.data, bytes);
+    bench_open (&run, uri);
+    bench_play (&run, rate_seconds);
+
+    player_get_memory_stats (&run.data, &ms);
+    player_get_render_stats (&run.data, &rs);
+    ok = !run.failed && rs.frames > 0 && ms.rebuffers <= (guint) rebuffer_tolerance
+        && (!bytes || ms.measured_peak <= bytes);
+
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"budget_kb\":%" G_GSIZE_FORMAT
+             ",\"measured_peak_kb\":%" G_GSIZE_FORMAT ",\"queued_peak_kb\":%" G_GSIZE_FORMAT
+             ",\"frames_kb\":%" G_GSIZE_FORMAT ",\"pool_buffers\":%u,\"pool_kb\":%" G_GSIZE_FORMAT
+             ",\"rebuffers\":%u,\"frames\":%" G_GUINT64_FORMAT
+             ",\"frame_ms\":%.2f,\"rss_kb\":%ld}\n",
+             run.uri, ok ? "true" : "false", bytes / 1024, ms.measured_peak / 1024,
+             ms.queued_peak / 1024, ms.frame_bytes / 1024, ms.pool_buffers, ms.pool_bytes / 1024,
+             ms.rebuffers, rs.frames, rs.mean_interval / 1e6, rss_kb () - rss);
+    fflush (out);
+
+    bench_free (&run);
+    return ok;
+}
+
+/* An HTTP server for one file, sending it at a fixed rate to whoever asks.
+ * Ranges are refused, so the player can only wait for the data. */
+typedef struct _ThrottledServer {
+    GSocketService *service;
+    gchar *contents;
+    gsize length;
+    gsize rate;                 /* Bytes per second */
+    gint active;                /* Connections being served */
+    gint stopped;
+    guint16 port;
+} ThrottledServer;
+
+#define THROTTLE_TICKS 10       /* Writes per second */
+
+static gboolean serve_cb (GThreadedSocketService *service, GSocketConnection *connection,
+                          GObject *source, ThrottledServer *server)
+{
+    GOutputStream *out = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+    GDataInputStream *in =
+        g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+    gsize sent, chunk = MAX (server->rate / THROTTLE_TICKS, 1);
+    gchar *line, *header;
+
+    g_atomic_int_inc (&server->active);
+
+    /* The request is the same whatever it says, up to the empty line */
+    while ((line = g_data_input_stream_read_line (in, NULL, NULL, NULL))
+           && *g_strchomp (line))
+        g_free (line);
+    g_free (line);
+
+    header = g_strdup_printf ("HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                              "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                              "Accept-Ranges: none\r\n\r\n", server->length);
+    if (g_output_stream_write_all (out, header, strlen (header), NULL, NULL, NULL))
+        for (sent = 0; sent < server->length && !g_atomic_int_get (&server->stopped);
+             sent += chunk) {
+            if (!g_output_stream_write_all (out, server->contents + sent,
+                                            MIN (chunk, server->length - sent),
+                                            NULL, NULL, NULL))
+                break;
+            g_usleep (G_USEC_PER_SEC / THROTTLE_TICKS);
+        }
+
+    g_free (header);
+    g_object_unref (in);
+    g_atomic_int_add (&server->active, -1);
+    return TRUE;
+}
+
+static ThrottledServer *throttled_server_new (const gchar *path, gsize rate)
+{
+    ThrottledServer *server = g_new0 (ThrottledServer, 1);
+    GSocketAddress *address, *effective = NULL;
+    GError *error = NULL;
+
+    if (!g_file_get_contents (path, &server->contents, &server->length, &error)) {
+        g_printerr ("Could not read %s: %s\n", path, error->message);
+        g_clear_error (&error);
+        g_free (server);
+        return NULL;
+    }
+    server->rate = rate;
+
+    server->service = g_threaded_socket_service_new (4);
+    address = g_inet_socket_address_new_from_string ("127.0.0.1", 0);
+    if (!g_socket_listener_add_address (G_SOCKET_LISTENER (server->service), address,
+                                        G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP,
+                                        NULL, &effective, &error)) {
+        g_printerr ("Could not listen: %s\n", error->message);
+        g_clear_error (&error);
+    } else {
+        server->port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (effective));
+        g_object_unref (effective);
+    }
+    g_object_unref (address);
+
+    g_signal_connect (server->service, "run", G_CALLBACK (serve_cb), server);
+    g_socket_service_start (server->service);
+    return server;
+}
+
+static void throttled_server_free (ThrottledServer *server)
+{
+    g_atomic_int_set (&server->stopped, TRUE);
+    g_socket_service_stop (server->service);
+    g_socket_listener_close (G_SOCKET_LISTENER (server->service));
+    while (g_atomic_int_get (&server->active))
+        g_usleep (10000);
+    g_object_unref (server->service);
+    g_free (server->contents);
+    g_free (server);
+}
+
+/* Where the buffering policy paused and resumed, from the bus */
+typedef struct _BufferingBench {
+    BenchRun *run;
+    gboolean paused;
+    guint underruns;            /* Pauses once playback had started */
+    guint resumes;
+    gint max_pause_percent;
+    gint min_resume_percent;
+} BufferingBench;
+
+/* Runs after the player's own handler: its decision is already made */
+static void buffering_bench_cb (GstBus *bus, GstMessage *msg, BufferingBench *bench)
+{
+    gint percent;
+
+    if (bench->run->data.buffering_paused == bench->paused)
+        return;
+    bench->paused = bench->run->data.buffering_paused;
+    gst_message_parse_buffering (msg, &percent);
+
+    if (bench->paused && bench->resumes) {
+        bench->underruns++;
+        bench->max_pause_percent = MAX (bench->max_pause_percent, percent);
+    } else if (!bench->paused) {
+        bench->resumes++;
+        bench->min_resume_percent = MIN (bench->min_resume_percent, percent);
+    }
+}
+
+/* GstPlayFlags, queue2 in download mode buffers by time left instead */
+#define PLAY_FLAG_DOWNLOAD (1 << 7)
+
+/* Real time playback over HTTP from a server slower than the media: the
+ * player has to pause when the queue runs dry and resume once it refilled
+ * above its high level, not just above where it paused */
+static gboolean bench_throttled (const gchar *path, FILE *out)
+{
+    BenchRun run;
+    BufferingBench bench = { &run, FALSE, 0, 0, 0, 100 };
+    ThrottledServer *server;
+    GStatBuf st;
+    gint64 duration;
+    gboolean ok;
+    gchar *uri;
+    guint flags;
+
+    /* The bitrate comes from the local file */
+    uri = gst_filename_to_uri (path, NULL);
+    if (g_stat (path, &st) < 0 || !bench_new (&run)) {
+        g_free (uri);
+        return FALSE;
+    }
+    bench_open (&run, uri);
+    duration = bench_preroll (&run);
+    bench_free (&run);
+    g_free (uri);
+    if (duration <= 0)
+        return FALSE;
+
+    server = throttled_server_new (path, MAX (gst_util_uint64_scale (st.st_size, GST_SECOND, duration)
+                                              * throttle / 100, 1));
+    if (!server || !server->port || !bench_new (&run)) {
+        if (server)
+            throttled_server_free (server);
+        return FALSE;
+    }
+    g_object_get (run.data.playbin, "flags", &flags, NULL);
+    g_object_set (run.data.playbin, "flags", flags & ~PLAY_FLAG_DOWNLOAD, NULL);
+    uri = g_strdup_printf ("http://127.0.0.1:%u/media.ogg", server->port);
+    bench_open (&run, uri);
+    g_free (uri);
+    g_signal_connect (run.bus, "message::buffering", G_CALLBACK (buffering_bench_cb), &bench);
+
+    /* Twice the download time, then give up */
+    bench_play (&run, 2 * st.st_size / server->rate + 10);
+
+    g_signal_handlers_disconnect_by_data (run.bus, &bench);
+
+    /* The first resume ends the initial buffering, each underrun needs
+     * its own */
+    ok = !run.failed && bench.underruns > 0 && bench.resumes > bench.underruns
+        && bench.max_pause_percent < bench.min_resume_percent;
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"throttle_percent\":%d,\"rate_kbps\":%.1f"
+             ",\"seconds\":%.3f,\"underruns\":%u,\"resumes\":%u"
+             ",\"max_pause_percent\":%d,\"min_resume_percent\":%d}\n",
+             run.uri, ok ? "true" : "false", throttle, server->rate * 8 / 1e3,
+             (run.end - run.start) / 1e9, bench.underruns, bench.resumes,
+             bench.max_pause_percent, bench.min_resume_percent);
+    fflush (out);
+
+    bench_free (&run);
+    throttled_server_free (server);
+    return ok;
+}
+
+/* An audio only file of the given length, pink noise for a busy spectrum */
+static gchar *generate_audio (gint seconds)
+{
+    GError *error = NULL;
+    GstElement *pipeline;
+    GstMessage *msg;
+    GstBus *bus;
+    gchar *name, *path, *desc;
+
+    name = g_strdup_printf ("gtkplayer-bench-audio-%d.ogg", seconds);
+    path = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+    if (g_file_test (path, G_FILE_TEST_EXISTS))
+        return path;
+
+    desc = g_strdup_printf ("audiotestsrc num-buffers=%d samplesperbuffer=4410 wave=pink-noise ! "
+                            "audio/x-raw,rate=44100,channels=2 ! audioconvert ! vorbisenc ! "
+                            "oggmux ! filesink location=\"%s\"", seconds * 10, path);
+    pipeline = gst_parse_launch (desc, &error);
+    g_free (desc);
+    if (!pipeline) {
+        g_printerr ("Could not generate test audio: %s\n", error->message);
+        g_clear_error (&error);
+        g_free (path);
+        return NULL;
+    }
+    g_clear_error (&error);
+
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+    bus = gst_element_get_bus (pipeline);
+    msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+                                      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+        g_printerr ("Could not generate test audio\n");
+        g_unlink (path);
+        g_free (path);
+        path = NULL;
+    }
+    gst_message_unref (msg);
+    gst_object_unref (bus);
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    gst_object_unref (pipeline);
+
+    return path;
+}
+
+/* GstPlayFlags visualisation, what the current path does to show
+ * something for audio */
+#define PLAY_FLAG_VIS (1 << 3)
+
+/* Real time playback of an audio only uri: "default" as any uri, "vis"
+ * with playbin's visualisation, "audio-only" without a video branch and
+ * "spectrum" adding our low rate bands */
+static gboolean bench_audio (const gchar *uri, const gchar *mode, FILE *out)
+{
+    BenchRun run;
+    PlayerRenderStats stats;
+    gdouble cpu;
+    guint flags;
+
+    if (!bench_new (&run))
+        return FALSE;
+    if (!g_strcmp0 (mode, "vis")) {
+        g_object_get (run.data.playbin, "flags", &flags, NULL);
+        g_object_set (run.data.playbin, "flags", flags | PLAY_FLAG_VIS, NULL);
+    } else if (!g_strcmp0 (mode, "audio-only")) {
+        player_set_audio_only (&run.data, TRUE, 0);
+    } else if (!g_strcmp0 (mode, "spectrum")
+               && player_set_audio_only (&run.data, TRUE, 32) < 0) {
+        bench_free (&run);
+        return FALSE;
+    }
+    bench_open (&run, uri);
+
+    cpu = cpu_ms ();
+    bench_play (&run, rate_seconds);
+    cpu = cpu_ms () - cpu;
+
+    player_get_render_stats (&run.data, &stats);
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"mode\":\"%s\",\"seconds\":%.3f"
+             ",\"cpu_ms\":%.1f,\"cpu_percent\":%.2f,\"video_frames\":%" G_GUINT64_FORMAT
+             ",\"spectrum_updates\":%" G_GUINT64_FORMAT "}\n",
+             run.uri, run.failed ? "false" : "true", mode, (run.end - run.start) / 1e9,
+             cpu, cpu / ((run.end - run.start) / 1e8), stats.frames,
+             player_get_audio_updates (&run.data));
+    fflush (out);
+
+    bench_free (&run);
+    return !run.failed;
+}
+
+/* What the loopback sender streams, the receiver can't discover it */
+#define LIVE_PORT 5004
+#define LIVE_CAPS "application/x-rtp,media=video,clock-rate=90000,encoding-name=THEORA,payload=96"
+/* Glass to glass target of the monitoring feeds */
+#define LIVE_TARGET (200 * GST_MSECOND)
+
+/* The sender writes the frame number along the top edge, one light or dark
+ * block per bit, and the time it did. The sink reads it back as it shows
+ * the frame: both ends are in this process, on the same clock. */
+#define STAMP_BITS 16
+#define STAMP_BLOCK 32
+#define STAMP_FRAMES 256        /* Frames in flight we can still match */
+
+typedef struct _LiveStamps {
+    GMutex lock;
+    GstVideoInfo info;          /* What the sender stamps */
+    guint next;
+    GstClockTime sent[STAMP_FRAMES];
+    guint64 shown;
+    GstClockTime total;
+    GstClockTime max;
+} LiveStamps;
+
+static GstPadProbeReturn stamp_probe_cb (GstPad *pad, GstPadProbeInfo *info, LiveStamps *stamps)
+{
+    GstBuffer *buffer = gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+    GstVideoFrame frame;
+    guint8 *y;
+    gint stride, row, i;
+    guint n;
+
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    if (!gst_video_frame_map (&frame, &stamps->info, buffer, GST_MAP_WRITE))
+        return GST_PAD_PROBE_OK;
+
+    g_mutex_lock (&stamps->lock);
+    n = stamps->next++ & ((1 << STAMP_BITS) - 1);
+    stamps->sent[n % STAMP_FRAMES] = gst_util_get_timestamp ();
+    g_mutex_unlock (&stamps->lock);
+
+    y = GST_VIDEO_FRAME_PLANE_DATA (&frame, 0);
+    stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0);
+    for (row = 0; row < STAMP_BLOCK; row++)
+        for (i = 0; i < STAMP_BITS; i++)
+            memset (y + row * stride + i * STAMP_BLOCK, n >> i & 1 ? 235 : 16, STAMP_BLOCK);
+    gst_video_frame_unmap (&frame);
+
+    return GST_PAD_PROBE_OK;
+}
+
+/* fakesink handoff: after the clock wait, when the frame would be on screen */
+static void stamp_shown_cb (GstElement *sink, GstBuffer *buffer, GstPad *pad, LiveStamps *stamps)
+{
+    GstClockTime now = gst_util_get_timestamp (), age;
+    GstCaps *caps = gst_pad_get_current_caps (pad);
+    GstVideoFrame frame;
+    GstVideoInfo info;
+    const guint8 *y;
+    gint stride, i;
+    guint n = 0, sent;
+
+    if (!caps)
+        return;
+    if (!gst_video_info_from_caps (&info, caps) || !GST_VIDEO_INFO_IS_YUV (&info)
+        || GST_VIDEO_INFO_WIDTH (&info) < STAMP_BITS * STAMP_BLOCK
+        || !gst_video_frame_map (&frame, &info, buffer, GST_MAP_READ)) {
+        gst_caps_unref (caps);
+        return;
+    }
+    gst_caps_unref (caps);
+
+    /* The middle of each block, away from the coding artefacts */
+    y = GST_VIDEO_FRAME_PLANE_DATA (&frame, 0);
+    stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0);
+    for (i = 0; i < STAMP_BITS; i++)
+        if (y[STAMP_BLOCK / 2 * stride + i * STAMP_BLOCK + STAMP_BLOCK / 2] > 128)
+            n |= 1 << i;
+    gst_video_frame_unmap (&frame);
+
+    g_mutex_lock (&stamps->lock);
+    sent = stamps->next & ((1 << STAMP_BITS) - 1);
+    /* Frames older than the ring can't be matched anymore */
+    if (((sent - n) & ((1 << STAMP_BITS) - 1)) - 1 < STAMP_FRAMES - 1) {
+        age = now - stamps->sent[n % STAMP_FRAMES];
+        stamps->shown++;
+        stamps->total += age;
+        stamps->max = MAX (stamps->max, age);
+    }
+    g_mutex_unlock (&stamps->lock);
+}
+
+/* The same stream described by an SDP: sdpdemux receives it through rtpbin,
+ * with a jitterbuffer the live latency applies to */
+static gchar *live_sdp (void)
+{
+    gchar *path = g_build_filename (g_get_tmp_dir (), "gtkplayer-bench-live.sdp", NULL);
+    gchar *sdp = g_strdup_printf ("v=0\r\n"
+                                  "o=- 0 0 IN IP4 127.0.0.1\r\n"
+                                  "s=gtkplayer-bench\r\n"
+                                  "c=IN IP4 127.0.0.1\r\n"
+                                  "t=0 0\r\n"
+                                  "m=video %d RTP/AVP 96\r\n"
+                                  "a=rtpmap:96 THEORA/90000\r\n", LIVE_PORT);
+
+    if (!g_file_set_contents (path, sdp, -1, NULL)) {
+        g_free (path);
+        path = NULL;
+    }
+    g_free (sdp);
+    return path;
+}
+
+/* The latency of the first jitterbuffer in the pipeline, -1 without one */
+static gint jitterbuffer_latency (GstElement *pipeline)
+{
+    GstIterator *it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+    GValue item = G_VALUE_INIT;
+    GstElementFactory *factory;
+    guint latency;
+    gint found = -1;
+
+    while (found < 0 && gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+        factory = gst_element_get_factory (g_value_get_object (&item));
+        if (factory && !g_strcmp0 (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)),
+                                   "rtpjitterbuffer")) {
+            g_object_get (g_value_get_object (&item), "latency", &latency, NULL);
+            found = latency;
+        }
+        g_value_reset (&item);
+    }
+    g_value_unset (&item);
+    gst_iterator_free (it);
+    return found;
+}
+
+/* A live sender in this process streams to the player, from udp:// as is
+ * or from an SDP. What reaches the sink is timed from its stamps. */
+static gboolean bench_live (gboolean sdp, FILE *out)
+{
+    GError *error = NULL;
+    GstElement *sender, *stamp;
+    GstPad *pad;
+    BenchRun run;
+    LiveStamps stamps;
+    PlayerLiveStats ls;
+    PlayerRenderStats rs;
+    GstClockTime mean;
+    gboolean ok;
+    gchar *desc, *uri, *path = NULL;
+    gint jitter = -1;
+
+    if (sdp && !(path = live_sdp ()))
+        return FALSE;
+
+    desc = g_strdup_printf ("videotestsrc is-live=true pattern=ball ! "
+                            "video/x-raw,format=I420,width=%d,height=%d,framerate=30/1 ! "
+                            "identity name=stamp ! "
+                            "theoraenc ! rtptheorapay config-interval=1 pt=96 ! "
+                            "udpsink host=127.0.0.1 port=%d",
+                            MAX (width, STAMP_BITS * STAMP_BLOCK), height, LIVE_PORT);
+    sender = gst_parse_launch (desc, &error);
+    g_free (desc);
+    if (!sender) {
+        g_printerr ("Could not create the sender: %s\n", error->message);
+        g_clear_error (&error);
+        g_free (path);
+        return FALSE;
+    }
+    g_clear_error (&error);
+
+    memset (&stamps, 0, sizeof (stamps));
+    g_mutex_init (&stamps.lock);
+    gst_video_info_set_format (&stamps.info, GST_VIDEO_FORMAT_I420,
+                               MAX (width, STAMP_BITS * STAMP_BLOCK), height);
+    stamp = gst_bin_get_by_name (GST_BIN (sender), "stamp");
+    pad = gst_element_get_static_pad (stamp, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+                       (GstPadProbeCallback) stamp_probe_cb, &stamps, NULL);
+    gst_object_unref (pad);
+    gst_object_unref (stamp);
+    gst_element_set_state (sender, GST_STATE_PLAYING);
+
+    if (!bench_new (&run)) {
+        gst_element_set_state (sender, GST_STATE_NULL);
+        gst_object_unref (sender);
+        g_mutex_clear (&stamps.lock);
+        g_free (path);
+        return FALSE;
+    }
+    g_object_set (run.data.video_sink, "signal-handoffs", TRUE, NULL);
+    g_signal_connect (run.data.video_sink, "handoff", G_CALLBACK (stamp_shown_cb), &stamps);
+    if (sdp) {
+        player_set_live_mode (&run.data, live_latency, NULL);
+        uri = gst_filename_to_uri (path, NULL);
+    } else {
+        player_set_live_mode (&run.data, live_latency, LIVE_CAPS);
+        uri = g_strdup_printf ("udp://127.0.0.1:%d", LIVE_PORT);
+    }
+    bench_open (&run, uri);
+    g_free (uri);
+    bench_play (&run, rate_seconds);
+
+    player_get_live_stats (&run.data, &ls);
+    player_get_render_stats (&run.data, &rs);
+    if (sdp)
+        jitter = jitterbuffer_latency (run.data.playbin);
+    /* Nothing more comes once the sender is gone */
+    gst_element_set_state (sender, GST_STATE_NULL);
+    g_signal_handlers_disconnect_by_data (run.data.video_sink, &stamps);
+
+    mean = stamps.shown ? stamps.total / stamps.shown : GST_CLOCK_TIME_NONE;
+    ok = !run.failed && ls.live && stamps.shown > 0 && mean <= LIVE_TARGET
+        && (!sdp || jitter == live_latency);
+
+    fprintf (out, "{\"uri\":%s,\"ok\":%s,\"live\":%s,\"requested_ms\":%d"
+             ",\"jitterbuffer_ms\":%d,\"frames\":%" G_GUINT64_FORMAT
+             ",\"stamped\":%" G_GUINT64_FORMAT ",\"latency_ms\":%.2f"
+             ",\"age_ms\":%.2f,\"max_age_ms\":%.2f,\"estimate_ms\":%.2f"
+             ",\"glass_to_glass_ms\":%.2f,\"max_glass_to_glass_ms\":%.2f}\n",
+             run.uri, ok ? "true" : "false", ls.live ? "true" : "false", live_latency,
+             jitter, rs.frames, stamps.shown, ls.latency / 1e6, ls.mean_age / 1e6,
+             ls.max_age / 1e6, ls.end_to_end / 1e6, MS (mean), stamps.max / 1e6);
+    fflush (out);
+
+    bench_free (&run);
+    gst_object_unref (sender);
+    g_mutex_clear (&stamps.lock);
+    if (path)
+        g_unlink (path);
+    g_free (path);
+    return ok;
+}
+
+#define RESUME_LOOKUPS 10000
+
+/* Another process appends to the log the store has open, then the store
+ * writes a record: reading it back must find it, not what moved */
+static gboolean resume_shared (const gchar *path)
+{
+    PlayerResumeInfo info = { 0 };
+    PlayerResumeStats stats;
+    const gchar *uri = "file:///bench/shared.ogg";
+    guint64 batches;
+    FILE *log;
+    gboolean ok;
+    gint i;
+
+    if (!(log = fopen (path, "a")))
+        return FALSE;
+    fprintf (log, "%032d\t1\t2\t0\t-1\tanother process\n", 0);
+    fclose (log);
+
+    player_resume_get_stats (&stats);
+    batches = stats.batches;
+    info.position = 42 * GST_SECOND;
+    player_resume_store (uri, &info);
+    for (i = 0; i < 100 && stats.batches == batches; i++) {
+        g_usleep (G_USEC_PER_SEC / 10);
+        player_resume_get_stats (&stats);
+    }
+
+    ok = player_resume_lookup (uri, &info) && info.position == 42 * GST_SECOND;
+    player_resume_info_clear (&info);
+    return ok;
+}
+
+/* Store n entries from the main thread, reopen, then look up random ones.
+ * Lookups should cost the same whatever n. */
+static gboolean bench_resume (gint n, FILE *out)
+{
+    PlayerResumeInfo info = { 0 };
+    PlayerResumeStats stats;
+    GstClockTime start, put, flush, load, lookup;
+    gchar *name, *path, *uri;
+    guint64 batches;
+    guint found = 0;
+    gboolean shared, ok;
+    gint i, k;
+
+    name = g_strdup_printf ("gtkplayer-bench-resume-%d.log", n);
+    path = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+    g_unlink (path);
+    if (player_resume_configure (path) < 0) {
+        g_free (path);
+        return FALSE;
+    }
+
+    info.duration = 600 * GST_SECOND;
+    info.audio = 1;
+    info.text = -1;
+    info.summary = "video stream 0:\n  codec: Theora\n  resolution: 1280x720\n"
+        "\naudio stream 0:\n  codec: Vorbis\n  channels: 2\n";
+    start = gst_util_get_timestamp ();
+    for (i = 0; i < n; i++) {
+        uri = g_strdup_printf ("file:///bench/%d.ogg", i);
+        info.position = i * GST_MSECOND;
+        player_resume_store (uri, &info);
+        g_free (uri);
+    }
+    put = gst_util_get_timestamp () - start;
+
+    /* Closing waits for the writer */
+    start = gst_util_get_timestamp ();
+    player_resume_configure (NULL);
+    flush = gst_util_get_timestamp () - start;
+    player_resume_get_stats (&stats);
+    batches = stats.batches;
+
+    start = gst_util_get_timestamp ();
+    player_resume_configure (path);
+    load = gst_util_get_timestamp () - start;
+
+    start = gst_util_get_timestamp ();
+    for (i = 0; i < RESUME_LOOKUPS; i++) {
+        k = g_random_int_range (0, n);
+        uri = g_strdup_printf ("file:///bench/%d.ogg", k);
+        if (player_resume_lookup (uri, &info) && info.position == k * GST_MSECOND)
+            found++;
+        player_resume_info_clear (&info);
+        g_free (uri);
+    }
+    lookup = gst_util_get_timestamp () - start;
+
+    shared = resume_shared (path);
+    player_resume_get_stats (&stats);
+    player_resume_configure (NULL);
+    ok = found == RESUME_LOOKUPS && shared;
+
+    fprintf (out, "{\"entries\":%d,\"ok\":%s,\"put_us\":%.2f,\"flush_ms\":%.2f"
+             ",\"batches\":%" G_GUINT64_FORMAT ",\"load_ms\":%.2f,\"lookup_us\":%.2f"
+             ",\"log_bytes\":%" G_GUINT64_FORMAT ",\"shared\":%s}\n",
+             n, ok ? "true" : "false", put / 1e3 / n,
+             flush / 1e6, batches, load / 1e6, lookup / 1e3 / RESUME_LOOKUPS,
+             stats.log_bytes, shared ? "true" : "false");
+    fflush (out);
+
+    g_unlink (path);
+    g_free (path);
+    return ok;
+}
+
+/* Each --mosaic configuration in a fresh process, so that the memory one
+ * leaves behind is not counted for the next */
+static gboolean spawn_tiles (const gchar *path, const gchar *mode, gint tiles, FILE *out)
+{
+    gchar *run = g_strdup_printf ("%s:%d", mode, tiles);
+    gchar *seconds = g_strdup_printf ("%d", rate_seconds);
+    const gchar *args[] = { self_path, "--tiles-run", run, "--input", path,
+                            "--rate-seconds", seconds, NULL };
+    GError *error = NULL;
+    gchar *result = NULL;
+    gint status;
+    gboolean ok;
+
+    ok = g_spawn_sync (NULL, (gchar **) args, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
+                       &result, NULL, &status, &error)
+        && g_spawn_check_exit_status (status, &error);
+    if (error) {
+        g_printerr ("%s with %d tiles: %s\n", mode, tiles, error->message);
+        g_clear_error (&error);
+    }
+    if (result) {
+        fputs (result, out);
+        fflush (out);
+    }
+
+    g_free (result);
+    g_free (seconds);
+    g_free (run);
+    return ok;
+}
+
+/* --input, or media generated for the mode */
+static gchar *media_path (void)
+{
+    if (input)
+        return g_strdup (input);
+    if (audio_seconds > 0)
+        return generate_audio (audio_seconds);
+    return generate_media ();
+}
+
+/* The modes playing a file, returns the exit status */
+static gint bench_file (const gchar *path, FILE *out)
+{
+    static const gchar *modes[] = { "default", "vis", "audio-only", "spectrum" };
+    GStatBuf st;
+    gchar *uri, **list;
+    gint i, ret = 0;
+    guint m;
+
+    if (g_stat (path, &st) < 0) {
+        g_printerr ("No media to play\n");
+        return -1;
+    }
+    uri = gst_filename_to_uri (path, NULL);
+
+    if (throttle > 0) {
+        for (i = 0; i < repeats; i++)
+            if (!bench_throttled (path, out))
+                ret = 1;
+    } else if (audio_seconds > 0) {
+        for (i = 0; i < repeats; i++)
+            for (m = 0; m < G_N_ELEMENTS (modes); m++)
+                if (!bench_audio (uri, modes[m], out))
+                    ret = 1;
+    } else if (budget > 0) {
+        for (i = 0; i < repeats; i++)
+            if (!bench_budget (uri, 0, out)
+                || !bench_budget (uri, (gsize) budget * 1024 * 1024, out))
+                ret = 1;
+    } else if (tiles_run) {
+        list = g_strsplit (tiles_run, ":", 2);
+        if (!list[1]
+            || !(g_strcmp0 (list[0], "mosaic") == 0 ? bench_mosaic (uri, atoi (list[1]), out)
+                 : bench_players (uri, atoi (list[1]), out)))
+            ret = 1;
+        g_strfreev (list);
+    } else if (mosaics) {
+        list = g_strsplit (mosaics, ",", -1);
+        for (i = 0; list[i]; i++)
+            if (!spawn_tiles (path, "mosaic", atoi (list[i]), out)
+                || !spawn_tiles (path, "players", atoi (list[i]), out))
+                ret = 1;
+        g_strfreev (list);
+    } else if (snapshots > 0) {
+        for (i = 0; i < repeats; i++)
+            if (!bench_snapshots (uri, 0, out) || !bench_snapshots (uri, snapshots, out))
+                ret = 1;
+    } else if (steps > 0) {
+        for (i = 0; i < repeats; i++)
+            if (!bench_steps (uri, out))
+                ret = 1;
+    } else if (rates) {
+        list = g_strsplit (rates, ",", -1);
+        for (i = 0; list[i]; i++)
+            if (!bench_rate (uri, g_ascii_strtod (list[i], NULL), out))
+                ret = 1;
+        g_strfreev (list);
+    } else {
+        for (i = 0; i < repeats; i++)
+            if (!bench_run (uri, st.st_size, out))
+                ret = 1;
+    }
+
+    g_free (uri);
+    return ret;
+}
+
+int main (int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context;
+    FILE *out = stdout;
+    gchar *path = NULL, **list;
+    gint i, ret = 0;
+
+    context = g_option_context_new ("- headless playback benchmark");
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_add_group (context, gst_init_get_option_group ());
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+        g_print ("option parsing failed: %s\n", error->message);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    g_set_print_handler (print_to_stderr);
+    self_path = argv[0];
+    if (width <= 0)
+        width = budget > 0 ? 3840 : 1280;
+    if (height <= 0)
+        height = budget > 0 ? 2160 : 720;
+
+    if (output && !(out = fopen (output, "w"))) {
+        g_printerr ("Could not open %s\n", output);
+        return -1;
+    }
+
+    if (cues > 0) {
+        for (i = 0; i < repeats; i++)
+            if (!bench_cues (out))
+                ret = 1;
+    } else if (resume_sizes) {
+        list = g_strsplit (resume_sizes, ",", -1);
+        for (i = 0; list[i]; i++)
+            if (atoi (list[i]) <= 0 || !bench_resume (atoi (list[i]), out))
+                ret = 1;
+        g_strfreev (list);
+    } else if (live_latency > 0) {
+        for (i = 0; i < repeats; i++)
+            if (!bench_live (FALSE, out) || !bench_live (TRUE, out))
+                ret = 1;
+    } else if (!(path = media_path ())) {
+        g_printerr ("No media to play\n");
+        ret = -1;
+    } else {
+        ret = bench_file (path, out);
+    }
+
+    if (out != stdout)
+        fclose (out);
+    g_free (path);
+    return ret;
+}
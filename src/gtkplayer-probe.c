@@ -0,0 +1,189 @@
+#include <stdio.h>
+
+#include <glib/gstdio.h>
+
+#include "player-probe.h"
+
+/* Batch media discovery: prints one JSON object per file as soon as it is
+ * known, then a summary on stderr. Directories are walked recursively. */
+
+static gint workers = 0;
+static gint timeout = 10;
+static gchar * cache = NULL;
+static gchar * output = NULL;
+static gint generate = 0;
+
+static GOptionEntry entries[] =
+{
+  { "workers", 'j', 0, G_OPTION_ARG_INT, &workers, "Parallel discoverers, default one per core", "N" },
+  { "timeout", 0, 0, G_OPTION_ARG_INT, &timeout, "Give up on a file after N seconds", "N" },
+  { "cache", 'c', 0, G_OPTION_ARG_FILENAME, &cache, "Skip files unchanged since the last run with FILE", "FILE" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write results to FILE instead of stdout", "FILE" },
+  { "generate", 0, 0, G_OPTION_ARG_INT, &generate, "Probe a generated corpus of N files instead", "N" },
+  { NULL }
+};
+
+typedef struct _ProbeRun {
+    FILE *out;
+    guint files;
+    guint cached;
+    guint failed;
+} ProbeRun;
+
+static void probe_done_cb (const PlayerProbeResult *result, ProbeRun *run)
+{
+    gchar *json = player_probe_result_to_json (result);
+
+    fprintf (run->out, "%s\n", json);
+    g_free (json);
+
+    run->files++;
+    if (result->cached)
+        run->cached++;
+    if (result->result < 0)
+        run->failed++;
+}
+
+static void add_path (PlayerProber *prober, const gchar *path)
+{
+    GDir *dir;
+    const gchar *name;
+    gchar *uri;
+
+    if (gst_uri_is_valid (path)) {
+        player_prober_add (prober, path);
+        return;
+    }
+
+    if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+        uri = gst_filename_to_uri (path, NULL);
+        player_prober_add (prober, uri);
+        g_free (uri);
+        return;
+    }
+
+    if (!(dir = g_dir_open (path, 0, NULL)))
+        return;
+    while ((name = g_dir_read_name (dir))) {
+        gchar *child = g_build_filename (path, name, NULL);
+
+        add_path (prober, child);
+        g_free (child);
+    }
+    g_dir_close (dir);
+}
+
+/* Short distinct files, with elements of gst-plugins-base only */
+static gchar *generate_corpus (void)
+{
+    gchar *name, *dir;
+    gint i;
+
+    name = g_strdup_printf ("gtkplayer-probe-corpus-%d", generate);
+    dir = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+    g_mkdir_with_parents (dir, 0700);
+
+    for (i = 0; i < generate; i++) {
+        GError *error = NULL;
+        GstElement *pipeline;
+        GstMessage *msg;
+        GstBus *bus;
+        gchar *path, *desc;
+
+        name = g_strdup_printf ("%05d.ogg", i);
+        path = g_build_filename (dir, name, NULL);
+        g_free (name);
+        if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+            g_free (path);
+            continue;
+        }
+
+        desc = g_strdup_printf ("videotestsrc num-buffers=30 pattern=%d ! "
+                                "video/x-raw,width=320,height=240,framerate=30/1 ! "
+                                "theoraenc ! queue ! oggmux name=mux ! filesink location=\"%s\" "
+                                "audiotestsrc num-buffers=30 samplesperbuffer=1470 freq=%d ! "
+                                "audio/x-raw,rate=44100 ! audioconvert ! vorbisenc ! queue ! mux.",
+                                i % 20, path, 220 + i);
+        pipeline = gst_parse_launch (desc, &error);
+        g_free (desc);
+        g_free (path);
+        if (!pipeline) {
+            g_printerr ("Could not generate the corpus: %s\n", error->message);
+            g_clear_error (&error);
+            g_free (dir);
+            return NULL;
+        }
+        g_clear_error (&error);
+
+        gst_element_set_state (pipeline, GST_STATE_PLAYING);
+        bus = gst_element_get_bus (pipeline);
+        msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+                                          GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        gst_message_unref (msg);
+        gst_object_unref (bus);
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+        gst_object_unref (pipeline);
+    }
+
+    return dir;
+}
+
+int main (int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context;
+    PlayerProber *prober;
+    ProbeRun run = { stdout, 0, 0, 0 };
+    GstClockTime start;
+    gchar *corpus = NULL;
+    gdouble seconds;
+    gint i;
+
+    context = g_option_context_new ("[FILE|DIR|URI...] - media discovery");
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_add_group (context, gst_init_get_option_group ());
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+        g_print ("option parsing failed: %s\n", error->message);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    if (generate > 0 && !(corpus = generate_corpus ()))
+        return -1;
+    if (!corpus && argc < 2) {
+        g_printerr ("Nothing to probe\n");
+        return -1;
+    }
+
+    if (output && !(run.out = fopen (output, "w"))) {
+        g_printerr ("Could not open %s\n", output);
+        return -1;
+    }
+
+    prober = player_prober_new (workers, timeout * GST_SECOND, cache,
+                                (PlayerProbeDone) probe_done_cb, &run);
+
+    start = gst_util_get_timestamp ();
+    if (corpus)
+        add_path (prober, corpus);
+    for (i = 1; i < argc; i++)
+        add_path (prober, argv[i]);
+
+    /* Results are reported from the main loop */
+    while (player_prober_pending (prober))
+        g_main_context_iteration (NULL, TRUE);
+    seconds = (gst_util_get_timestamp () - start) / 1e9;
+
+    player_prober_free (prober);
+    if (run.out != stdout)
+        fclose (run.out);
+
+    g_printerr ("files=%u cached=%u failed=%u seconds=%.3f files/s=%.1f\n",
+                run.files, run.cached, run.failed, seconds,
+                seconds > 0 ? run.files / seconds : 0.0);
+
+    g_free (corpus);
+    return run.failed ? 1 : 0;
+}
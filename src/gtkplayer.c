@@ -1,4 +1,11 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
 #include "player.h"
+#include "player-mosaic.h"
+#include "player-pool.h"
 
 /* This function is called when the main window is closed */
 static void delete_event_cb(GtkWidget * widget, GdkEvent * event,
@@ -12,6 +19,32 @@ static gint repeats = 2;
 static gboolean fullscreen = FALSE;
 static gboolean verbose = FALSE;
 static gboolean dontstart = FALSE;
+static gint tiles = 1;
+static gint stats = 0;
+static gchar * render = NULL;
+static gboolean noscrub = FALSE;
+static gint previews = 0;
+static gchar * thumbdir = NULL;
+static gchar ** playlist = NULL;
+static gboolean preroll = FALSE;
+static gchar ** ranks = NULL;
+static gchar ** decoders = NULL;
+static gint tagstorm = 0;
+static gint telemetry = 0;
+static gint hammer = 0;
+static gint stepcache = 0;
+static gint budget = 0;
+static gboolean audioonly = FALSE;
+static gint spectrum = 0;
+static gint live = 0;
+static gchar * livecaps = NULL;
+static gchar * subtitles = NULL;
+static gint mosaic = 0;
+static gint churn = 0;
+static gchar * cachedir = NULL;
+static gchar * resumedb = NULL;
+static gboolean noresume = FALSE;
+static gint cachesize = 0;
 static gchar * uri = "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm";
 
 static GOptionEntry entries[] =
@@ -20,10 +53,278 @@ static GOptionEntry entries[] =
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Be verbose", NULL },
   { "fullscreen", 'f', 0, G_OPTION_ARG_NONE, &fullscreen, "Set fullscreen", NULL },
   { "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "Set uri", NULL },
+  { "queue", 'q', 0, G_OPTION_ARG_STRING_ARRAY, &playlist, "Play uri after the current item (repeatable)", "URI" },
+  { "preroll", 0, 0, G_OPTION_ARG_NONE, &preroll, "Preroll as soon as the uri is set", NULL },
+  { "decoder-rank", 0, 0, G_OPTION_ARG_STRING_ARRAY, &ranks, "Override a decoder rank, 0 excludes it (repeatable)", "FACTORY=RANK" },
+  { "decoders", 0, 0, G_OPTION_ARG_STRING_ARRAY, &decoders, "Only use these decoders (repeatable)", "FACTORY" },
+  { "tag-storm", 0, 0, G_OPTION_ARG_INT, &tagstorm, "Stress test: emit N tag updates per second", "N" },
   { "dontstart", 0, 0, G_OPTION_ARG_NONE, &dontstart, "Don't start video immediately", NULL },
+  { "tiles", 't', 0, G_OPTION_ARG_INT, &tiles, "Play N tiles from a player pool", "N" },
+  { "mosaic", 0, 0, G_OPTION_ARG_INT, &mosaic, "Composite N tiles in one pipeline, cycling through uri and queue", "N" },
+  { "churn", 0, 0, G_OPTION_ARG_INT, &churn, "Mosaic: replace a random tile every N seconds", "N" },
+  { "render", 0, 0, G_OPTION_ARG_STRING, &render, "Render path: overlay or gtk", "PATH" },
+  { "no-scrub", 0, 0, G_OPTION_ARG_NONE, &noscrub, "Seek on every slider move (legacy)", NULL },
+  { "previews", 'p', 0, G_OPTION_ARG_INT, &previews, "Slider thumbnails every N seconds", "N" },
+  { "thumb-dir", 0, 0, G_OPTION_ARG_FILENAME, &thumbdir, "On-disk thumbnail cache", "DIR" },
+  { "telemetry", 0, 0, G_OPTION_ARG_INT, &telemetry, "Show the telemetry panel and print it as JSON every N seconds", "N" },
+  { "cache-dir", 0, 0, G_OPTION_ARG_FILENAME, &cachedir, "Keep complete network downloads in DIR", "DIR" },
+  { "resume-db", 0, 0, G_OPTION_ARG_FILENAME, &resumedb, "Remember positions and streams in FILE", "FILE" },
+  { "no-resume", 0, 0, G_OPTION_ARG_NONE, &noresume, "Always start from the beginning", NULL },
+  { "cache-size", 0, 0, G_OPTION_ARG_INT, &cachesize, "Download cache size", "MB" },
+  { "subtitles", 0, 0, G_OPTION_ARG_FILENAME, &subtitles, "Show an SRT or ASS file over the video", "FILE" },
+  { "step-cache", 0, 0, G_OPTION_ARG_INT, &stepcache, "Keep decoded frames for backward steps (, and . keys)", "MB" },
+  { "audio-only", 0, 0, G_OPTION_ARG_NONE, &audioonly, "Don't decode nor render video", NULL },
+  { "spectrum", 0, 0, G_OPTION_ARG_INT, &spectrum, "Audio only: draw a spectrum of N bands", "N" },
+  { "live", 0, 0, G_OPTION_ARG_INT, &live, "Tune for live sources at a latency of MS", "MS" },
+  { "live-caps", 0, 0, G_OPTION_ARG_STRING, &livecaps, "Live: what a raw udp:// source receives", "CAPS" },
+  { "memory-budget", 0, 0, G_OPTION_ARG_INT, &budget, "Bound queues and decoder pools to MB per player", "MB" },
+  { "hammer", 0, 0, G_OPTION_ARG_INT, &hammer, "Stress test: N threads flooding the command queue", "N" },
+  { "stats", 's', 0, G_OPTION_ARG_INT, &stats, "Print CPU and main loop wakeups every N seconds", "N" },
   { NULL }
 };
 
+/* Main loop wakeups are counted by wrapping the poll function */
+static guint64 wakeups = 0;
+
+static gint counting_poll (GPollFD *ufds, guint nfds, gint timeout)
+{
+    wakeups++;
+    return g_poll (ufds, nfds, timeout);
+}
+
+/* Main loop latency: how late a 10 ms timer fires, worst case per period */
+#define LATENCY_PERIOD_MS 10
+static gint64 latency_expected = 0;
+static gint64 latency_max = 0;
+
+static gboolean latency_cb (gpointer unused)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (latency_expected)
+        latency_max = MAX (latency_max, now - latency_expected);
+    latency_expected = now + LATENCY_PERIOD_MS * 1000;
+    return G_SOURCE_CONTINUE;
+}
+
+/* Stress threads, stopped and joined before the players go away */
+static gint stress_stop = 0;
+static GPtrArray *stress_threads = NULL;
+
+static void stress_start (const gchar *name, GThreadFunc func, PlayerData *data)
+{
+    if (!stress_threads)
+        stress_threads = g_ptr_array_new ();
+    g_ptr_array_add (stress_threads, g_thread_new (name, func, data));
+}
+
+static void stress_join (void)
+{
+    guint i;
+
+    if (!stress_threads)
+        return;
+    g_atomic_int_set (&stress_stop, 1);
+    for (i = 0; i < stress_threads->len; i++)
+        g_thread_join (g_ptr_array_index (stress_threads, i));
+    g_ptr_array_free (stress_threads, TRUE);
+    stress_threads = NULL;
+}
+
+/* Emits tag changes from another thread, like a live stream would */
+static gpointer tag_storm_thread (PlayerData *data)
+{
+    const gchar *signals[] = { "video-tags-changed", "audio-tags-changed" };
+    guint64 i;
+
+    for (i = 0; !g_atomic_int_get (&stress_stop); i++) {
+        g_signal_emit_by_name (data->playbin, signals[i % 2], 0);
+        g_usleep (G_USEC_PER_SEC / tagstorm);
+    }
+    return NULL;
+}
+
+/* Command queue stress test: completions are counted in the main loop while
+ * --stats watches its latency */
+static guint64 commands_done = 0;
+static guint64 commands_merged = 0;
+
+static void command_done_cb (PlayerData *data, PlayerCommandType type,
+                             gint result, gpointer unused)
+{
+    if (result == -ECANCELED)
+        commands_merged++;
+    else
+        commands_done++;
+}
+
+static gpointer hammer_thread (PlayerData *data)
+{
+    GRand *rand = g_rand_new ();
+
+    while (!g_atomic_int_get (&stress_stop)) {
+        switch (g_rand_int_range (rand, 0, 10)) {
+        case 0:
+            player_command (data, PLAYER_COMMAND_PAUSE);
+            break;
+        case 1:
+            player_command (data, PLAYER_COMMAND_PLAY);
+            break;
+        case 2:
+            player_command_rate (data, g_rand_boolean (rand) ? 1.0 : 2.0);
+            break;
+        default:
+            player_command_seek (data, g_rand_int_range (rand, 0, 30) * GST_SECOND);
+            break;
+        }
+        g_usleep (g_rand_int_range (rand, 100, 2000));
+    }
+    g_rand_free (rand);
+    return NULL;
+}
+
+static gdouble cpu_seconds (void)
+{
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static gboolean print_telemetry (PlayerData *data)
+{
+    gchar *json = player_get_telemetry_json (data);
+
+    if (json)
+        g_print ("%s\n", json);
+    g_free (json);
+    return G_SOURCE_CONTINUE;
+}
+
+#define PRINT_MS(t) (GST_CLOCK_TIME_IS_VALID (t) ? (t) / 1e6 : -1.0)
+
+static gboolean print_stats (PlayerData *data)
+{
+    PlayerRenderStats rs;
+    PlayerThumbStats ts;
+    PlayerPrerollTimes pt;
+    PlayerMemoryStats ms;
+    PlayerLiveStats ls;
+    PlayerStream streams[8];
+    guint i, n;
+    static gint64 last_time = 0;
+    static gdouble last_cpu = 0;
+    static guint64 last_wakeups = 0;
+    gint64 now = g_get_monotonic_time ();
+    gdouble cpu = cpu_seconds ();
+
+    if (last_time) {
+        gdouble elapsed = (now - last_time) / 1e6;
+        player_get_render_stats (data, &rs);
+        g_print ("tiles=%d cpu=%.1f%% wakeups/s=%.1f frames=%" G_GUINT64_FORMAT
+                 " frame-ms=%.2f max-frame-ms=%.2f lateness-ms=%.2f copies=%u"
+                 " seeks=%" G_GUINT64_FORMAT " seek-ms=%.2f gap-ms=%.2f"
+                 " toggle-ms=%.2f\n",
+                 tiles, 100 * (cpu - last_cpu) / elapsed,
+                 (wakeups - last_wakeups) / elapsed, rs.frames,
+                 rs.mean_interval / 1e6, rs.max_interval / 1e6,
+                 rs.mean_lateness / 1e6, rs.copies_per_frame,
+                 rs.seeks, rs.mean_seek_latency / 1e6, rs.item_gap / 1e6,
+                 rs.toggle_latency / 1e6);
+        if (rs.steps_forward || rs.steps_backward)
+            g_print ("steps forward=%" G_GUINT64_FORMAT " forward-ms=%.2f backward=%"
+                     G_GUINT64_FORMAT " backward-ms=%.2f cached=%" G_GUINT64_FORMAT "\n",
+                     rs.steps_forward, rs.step_forward_latency / 1e6,
+                     rs.steps_backward, rs.step_backward_latency / 1e6,
+                     rs.steps_cached);
+        if (player_get_live_stats (data, &ls))
+            g_print ("live latency-ms=%.2f age-ms=%.2f max-age-ms=%.2f end-to-end-ms=%.2f\n",
+                     ls.latency / 1e6, ls.mean_age / 1e6, ls.max_age / 1e6,
+                     ls.end_to_end / 1e6);
+        if (player_get_memory_stats (data, &ms))
+            g_print ("memory budget-kb=%" G_GSIZE_FORMAT " queued-kb=%" G_GSIZE_FORMAT
+                     " peak-kb=%" G_GSIZE_FORMAT " measured-peak-kb=%" G_GSIZE_FORMAT
+                     " pool-buffers=%u rebuffers=%u\n",
+                     ms.budget / 1024, ms.queued / 1024, ms.peak / 1024,
+                     ms.measured_peak / 1024, ms.pool_buffers, ms.rebuffers);
+        g_print ("main-loop max-latency-ms=%.2f\n", latency_max / 1e3);
+        if (hammer > 0)
+            g_print ("commands done=%" G_GUINT64_FORMAT " merged=%" G_GUINT64_FORMAT "\n",
+                     commands_done, commands_merged);
+        latency_max = 0;
+        player_get_preroll_times (data, &pt);
+        g_print ("preroll typefind-ms=%.2f demux-ms=%.2f decoder-ms=%.2f"
+                 " first-buffer-ms=%.2f prerolled-ms=%.2f\n",
+                 PRINT_MS (pt.typefind), PRINT_MS (pt.demux), PRINT_MS (pt.decoder),
+                 PRINT_MS (pt.first_buffer), PRINT_MS (pt.prerolled));
+        n = MIN (player_get_streams (data, streams, G_N_ELEMENTS (streams)),
+                 G_N_ELEMENTS (streams));
+        for (i = 0; i < n; i++)
+            g_print ("stream type=%d index=%d codec=\"%s\" decoder=%s"
+                     " size=%dx%d fps=%d/%d rate=%d channels=%d\n",
+                     streams[i].type, streams[i].index, streams[i].codec,
+                     streams[i].decoder, streams[i].width, streams[i].height,
+                     streams[i].fps_n, streams[i].fps_d, streams[i].rate,
+                     streams[i].channels);
+        player_thumbs_get_stats (&ts);
+        if (ts.hits + ts.misses)
+            g_print ("thumbs hit-rate=%.1f%% entries=%u bytes=%" G_GSIZE_FORMAT
+                     " decoded=%" G_GUINT64_FORMAT " disk=%" G_GUINT64_FORMAT "\n",
+                     100.0 * ts.hits / (ts.hits + ts.misses), ts.entries,
+                     ts.bytes, ts.decoded, ts.disk_hits);
+    }
+    last_time = now;
+    last_cpu = cpu;
+    last_wakeups = wakeups;
+    return G_SOURCE_CONTINUE;
+}
+
+/* The uri and the queue, round robin */
+static const gchar *mosaic_uri (gint i)
+{
+    gint n = playlist ? g_strv_length (playlist) + 1 : 1;
+
+    return i % n ? playlist[i % n - 1] : uri;
+}
+
+static gboolean churn_cb (PlayerMosaic *m)
+{
+    static gint added = 0;
+    gint cell = g_random_int_range (0, mosaic);
+
+    player_mosaic_remove (m, cell);
+    player_mosaic_add (m, mosaic_uri (mosaic + added++));
+    return G_SOURCE_CONTINUE;
+}
+
+static int run_mosaic (GtkWidget *main_window)
+{
+    gint columns = (gint) ceil (sqrt (mosaic));
+    gint rows = (mosaic + columns - 1) / columns;
+    PlayerMosaic *m;
+    gint i;
+
+    m = player_mosaic_new (columns, rows, 1280, 720, FALSE);
+    if (!m || !player_mosaic_get_widget (m))
+        return -1;
+    for (i = 0; i < mosaic; i++)
+        player_mosaic_add (m, mosaic_uri (i));
+
+    g_signal_connect (main_window, "destroy", G_CALLBACK (gtk_main_quit), NULL);
+    gtk_container_add (GTK_CONTAINER (main_window), player_mosaic_get_widget (m));
+    gtk_window_set_default_size (GTK_WINDOW (main_window), 1280, 720);
+    gtk_widget_show_all (main_window);
+
+    player_mosaic_play (m);
+    if (churn > 0)
+        g_timeout_add_seconds (churn, (GSourceFunc) churn_cb, m);
+
+    gtk_main ();
+    player_mosaic_free (m);
+    return 0;
+}
+
 static int init (int argc, char *argv[])
 {
     GError *error = NULL;
@@ -43,7 +344,9 @@ static int init (int argc, char *argv[])
 int main(int argc, char *argv[])
 {
 	PlayerData data;
+	PlayerPool *pool = NULL;
 	GtkWidget *main_window, *box;
+	gint i;
 
     /* Initialize GTK */
 	gtk_init(&argc, &argv);
@@ -55,22 +358,122 @@ int main(int argc, char *argv[])
 
 	main_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 
-   	player_new(&data);
+    if (cachedir)
+        player_download_cache_configure(cachedir, (guint64) cachesize * 1024 * 1024);
+    if (!noresume) {
+        gchar *path = resumedb ? g_strdup (resumedb) :
+            g_build_filename (g_get_user_data_dir (), "gtkplayer", "resume.log", NULL);
+
+        player_resume_configure (path);
+        g_free (path);
+    }
+
+    if (mosaic > 1)
+        return run_mosaic (main_window);
+
+    if (tiles > 1) {
+        /* Many tiles share one pool, laid out in a square grid */
+        gint columns = (gint) ceil (sqrt (tiles));
+
+        pool = player_pool_new();
+        box = gtk_grid_new();
+        gtk_grid_set_row_homogeneous(GTK_GRID(box), TRUE);
+        gtk_grid_set_column_homogeneous(GTK_GRID(box), TRUE);
+        for (i = 0; i < tiles; i++) {
+            PlayerData *tile = player_pool_add(pool);
 
-    player_set_uri(&data, uri);
+            if (!tile)
+                return -1;
+            player_set_telemetry(tile, telemetry > 0);
+            player_set_uri(tile, uri);
+            gtk_grid_attach(GTK_GRID(box), tile->main_box,
+                            i % columns, i / columns, 1, 1);
+        }
+    } else {
+        PlayerRenderMode mode = PLAYER_RENDER_AUTO;
+
+        if (g_strcmp0 (render, "overlay") == 0)
+            mode = PLAYER_RENDER_OVERLAY;
+        else if (g_strcmp0 (render, "gtk") == 0)
+            mode = PLAYER_RENDER_GTK_SINK;
+        player_new_full(&data, mode);
+        player_set_scrub_mode(&data, !noscrub);
+        player_set_preroll(&data, preroll);
+        player_set_decoder_allow_list(&data, (const gchar * const *) decoders);
+        for (i = 0; ranks && ranks[i]; i++) {
+            gchar **kv = g_strsplit (ranks[i], "=", 2);
+
+            if (kv[0] && kv[1])
+                player_set_decoder_rank(&data, kv[0], atoi (kv[1]));
+            g_strfreev (kv);
+        }
+        player_set_telemetry(&data, telemetry > 0);
+        player_set_step_cache(&data, (gsize) stepcache * 1024 * 1024);
+        if (budget > 0)
+            player_set_memory_budget(&data, (gsize) budget * 1024 * 1024);
+        if (live > 0)
+            player_set_live_mode(&data, live, livecaps);
+        if (audioonly)
+            player_set_audio_only(&data, TRUE, MAX (spectrum, 0));
+        player_thumbs_configure(0, thumbdir);
+        player_set_preview_interval(&data, previews * GST_SECOND);
+        player_set_uri(&data, uri);
+        if (subtitles)
+            player_set_subtitle_file(&data, subtitles);
+        for (i = 0; playlist && playlist[i]; i++)
+            player_queue_uri(&data, playlist[i]);
+        box = data.main_box;
+    }
 
 	g_signal_connect(G_OBJECT(main_window), "delete-event",
-			 G_CALLBACK(delete_event_cb), &data);
-	gtk_container_add(GTK_CONTAINER(main_window), data.main_box);
+			 G_CALLBACK(delete_event_cb), pool ? player_pool_get(pool, 0) : &data);
+	gtk_container_add(GTK_CONTAINER(main_window), box);
 	gtk_window_set_default_size(GTK_WINDOW(main_window), 640, 480);
 	gtk_widget_show_all(main_window);
+    /* The key bindings follow the video focus, start there */
+    if (!pool && data.video_window)
+        gtk_widget_grab_focus (data.video_window);
+
+    if (!dontstart) {
+        if (pool) {
+            for (i = 0; i < tiles; i++)
+                player_start(player_pool_get(pool, i));
+        } else {
+            player_start(&data);
+        }
+    }
+
+    if (tagstorm > 0)
+        stress_start ("tag-storm", (GThreadFunc) tag_storm_thread,
+                      pool ? player_pool_get(pool, 0) : &data);
+
+    for (i = 0; i < hammer; i++) {
+        PlayerData *target = pool ? player_pool_get(pool, 0) : &data;
 
-    if (!dontstart)
-        player_start(&data);
+        player_set_command_callback (target, command_done_cb, NULL);
+        stress_start ("hammer", (GThreadFunc) hammer_thread, target);
+    }
+
+    if (telemetry > 0)
+        g_timeout_add_seconds(telemetry, (GSourceFunc) print_telemetry,
+                              pool ? player_pool_get(pool, 0) : &data);
+
+    if (stats > 0) {
+        g_main_context_set_poll_func(NULL, counting_poll);
+        g_timeout_add(LATENCY_PERIOD_MS, latency_cb, NULL);
+        g_timeout_add_seconds(stats, (GSourceFunc) print_stats,
+                              pool ? player_pool_get(pool, 0) : &data);
+    }
 
 	/* Start the GTK main loop. We will not regain control until gtk_main_quit is called. */
 	gtk_main();
 
-	player_free(&data);
+    stress_join ();
+    if (pool)
+        player_pool_free(pool);
+    else
+        player_free(&data);
+    /* Writes what the players queued last */
+    player_resume_configure(NULL);
 	return 0;
 }
@@ -0,0 +1,206 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Spectrum updates per second, bars don't need the video frame rate */
+#define SPECTRUM_RATE 15
+/* Magnitudes below this are drawn as empty bars, in dB */
+#define SPECTRUM_FLOOR -80
+
+/* Audio only playback. playbin gets no video branch at all, neither a sink
+ * nor a visualisation plugin rendering frames nobody needs, and no native
+ * window is handed to a sink. Instead of a visualisation, the spectrum
+ * element computes a few bands at a low rate and the drawing area paints
+ * them with cairo on each update. */
+
+struct _PlayerAudio {
+	GstElement *filter;	/* audio-filter before the spectrum, or NULL */
+	gfloat *bands;		/* Last magnitudes, in dB */
+	guint n_bands;
+	guint64 updates;
+};
+
+/* The spectrum goes after scaletempo, on what is actually heard */
+static gint add_spectrum(PlayerData * data, struct _PlayerAudio *audio)
+{
+	GstElement *bin, *filter = NULL, *spectrum;
+	GstPad *pad;
+
+	spectrum = gst_element_factory_make("spectrum", NULL);
+	if (!spectrum) {
+		g_printerr("Could not create spectrum.\n");
+		return -1;
+	}
+	g_object_set(spectrum, "bands", audio->n_bands, "threshold", SPECTRUM_FLOOR,
+		     "interval", (guint64) (GST_SECOND / SPECTRUM_RATE),
+		     "post-messages", TRUE, "message-phase", FALSE, NULL);
+
+	bin = gst_bin_new("audio-filter");
+	g_object_get(data->playbin, "audio-filter", &filter, NULL);
+	if (filter) {
+		gst_bin_add_many(GST_BIN(bin), filter, spectrum, NULL);
+		gst_element_link(filter, spectrum);
+		pad = gst_element_get_static_pad(filter, "sink");
+		/* Keep our reference, for remove_spectrum() */
+		audio->filter = filter;
+	} else {
+		gst_bin_add(GST_BIN(bin), spectrum);
+		pad = gst_element_get_static_pad(spectrum, "sink");
+	}
+	gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+	gst_object_unref(pad);
+	pad = gst_element_get_static_pad(spectrum, "src");
+	gst_element_add_pad(bin, gst_ghost_pad_new("src", pad));
+	gst_object_unref(pad);
+
+	g_object_set(data->playbin, "audio-filter", bin, NULL);
+	return 0;
+}
+
+/* Back to the audio-filter we found */
+static void remove_spectrum(PlayerData * data)
+{
+	struct _PlayerAudio *audio = data->audio;
+	GstElement *bin = NULL;
+
+	g_object_get(data->playbin, "audio-filter", &bin, NULL);
+	if (bin && audio->filter)
+		gst_bin_remove(GST_BIN(bin), audio->filter);
+	g_object_set(data->playbin, "audio-filter", audio->filter, NULL);
+	if (bin)
+		gst_object_unref(bin);
+	player_audio_free(data);
+}
+
+/* Takes effect on the next player_set_uri(). bands > 0 draws a spectrum of
+ * that many bands, 0 leaves the video area black. */
+gint player_set_audio_only(PlayerData * data, gboolean enable, guint bands)
+{
+	struct _PlayerAudio *audio;
+	guint flags, i;
+
+	FUNC_ENTER;
+
+	if (!data)
+		return -EINVAL;
+	if (data->state > GST_STATE_READY)
+		return -EBUSY;
+
+	/* Neither the video nor the visualisation branch of playsink */
+	g_object_get(data->playbin, "flags", &flags, NULL);
+	g_object_set(data->playbin, "flags", enable ?
+		     flags & ~(PLAY_FLAG_VIDEO | PLAY_FLAG_VIS) :
+		     flags | PLAY_FLAG_VIDEO, NULL);
+	data->audio_only = enable;
+
+	if (!enable) {
+		if (data->audio)
+			remove_spectrum(data);
+		/* The sink gets the window realize_cb() kept from it */
+		player_attach_window(data);
+		return 0;
+	}
+	if (!bands || data->audio)
+		return 0;
+
+	audio = g_new0(struct _PlayerAudio, 1);
+	audio->bands = g_new(gfloat, bands);
+	audio->n_bands = bands;
+	for (i = 0; i < bands; i++)
+		audio->bands[i] = SPECTRUM_FLOOR;
+	if (add_spectrum(data, audio) < 0) {
+		g_free(audio->bands);
+		g_free(audio);
+		return -1;
+	}
+	data->audio = audio;
+
+	return 0;
+}
+
+gboolean player_get_audio_only(PlayerData * data)
+{
+	return data && data->audio_only;
+}
+
+/* Bus, main thread: keep the last bands and repaint */
+void player_audio_element_message(PlayerData * data, GstMessage * msg)
+{
+	struct _PlayerAudio *audio = data->audio;
+	const GstStructure *s = gst_message_get_structure(msg);
+	const GValue *magnitudes;
+	GtkWidget *widget;
+	guint i, n;
+
+	if (!audio || !gst_structure_has_name(s, "spectrum"))
+		return;
+
+	magnitudes = gst_structure_get_value(s, "magnitude");
+	if (!magnitudes)
+		return;
+	n = MIN(gst_value_list_get_size(magnitudes), audio->n_bands);
+	for (i = 0; i < n; i++)
+		audio->bands[i] =
+		    g_value_get_float(gst_value_list_get_value(magnitudes, i));
+	audio->updates++;
+
+	widget = data->isfullscreen && data->fullscreen_area ?
+	    data->fullscreen_area : data->video_window;
+	if (widget)
+		gtk_widget_queue_draw(widget);
+}
+
+/* Paints the video area in audio only mode: returns FALSE otherwise */
+gboolean player_audio_draw(PlayerData * data, GtkWidget * widget,
+			   cairo_t * cr)
+{
+	struct _PlayerAudio *audio = data->audio;
+	GtkAllocation allocation;
+	gdouble w, h, level;
+	guint i;
+
+	if (!data->audio_only)
+		return FALSE;
+
+	gtk_widget_get_allocation(widget, &allocation);
+	cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_paint(cr);
+	if (!audio || data->state < GST_STATE_PAUSED)
+		return TRUE;
+
+	/* One bar per band, low frequencies on the left */
+	w = (gdouble) allocation.width / audio->n_bands;
+	cairo_set_source_rgb(cr, 0.2, 0.6, 1.0);
+	for (i = 0; i < audio->n_bands; i++) {
+		level = CLAMP(1.0 - audio->bands[i] / SPECTRUM_FLOOR, 0.0, 1.0);
+		h = level * allocation.height;
+		cairo_rectangle(cr, i * w + 1, allocation.height - h,
+				MAX(w - 2, 1), h);
+	}
+	cairo_fill(cr);
+
+	return TRUE;
+}
+
+/* Spectrum updates received so far */
+guint64 player_get_audio_updates(PlayerData * data)
+{
+	return data && data->audio ? data->audio->updates : 0;
+}
+
+void player_audio_free(PlayerData * data)
+{
+	struct _PlayerAudio *audio = data->audio;
+
+	if (!audio)
+		return;
+
+	if (audio->filter)
+		gst_object_unref(audio->filter);
+	g_free(audio->bands);
+	g_free(audio);
+	data->audio = NULL;
+}
@@ -0,0 +1,323 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib/gstdio.h>
+
+#include "player.h"
+#include "player-private.h"
+
+#define CACHE_DEFAULT_SIZE (G_GUINT64_CONSTANT(512) * 1024 * 1024)
+#define CACHE_PARTIAL_PREFIX "partial-"
+/* Below this, a queue that was full ran dry */
+#define BUFFER_LOW_PERCENT 10
+/* Resume a download once it should end this much before playback does */
+#define DOWNLOAD_MARGIN 1.2
+
+
+/* Network buffering. Playbin downloads progressive streams to a file, so
+ * seeks in what was already fetched never hit the network, and we pause
+ * while it can't keep up. Finished downloads are kept in a size capped
+ * directory, oldest used first out, and replayed from there. */
+
+/******************************************************************************/
+/*                               Download cache                               */
+/******************************************************************************/
+
+static GMutex cache_lock;
+static gchar *cache_dir;
+static guint64 cache_max = CACHE_DEFAULT_SIZE;
+
+typedef struct _CacheFile {
+	gchar *path;
+	guint64 size;
+	gint64 mtime;		/* Last use */
+} CacheFile;
+
+static gint compare_mtime(const CacheFile * a, const CacheFile * b)
+{
+	return a->mtime < b->mtime ? -1 : a->mtime > b->mtime;
+}
+
+/* Drop the least recently used files until the directory fits. Downloads in
+ * progress are not counted: they only become cache files once complete. */
+static void cache_evict_locked(void)
+{
+	GDir *dir;
+	const gchar *name;
+	GSList *files = NULL, *l;
+	guint64 total = 0;
+
+	if (!cache_dir || !(dir = g_dir_open(cache_dir, 0, NULL)))
+		return;
+
+	while ((name = g_dir_read_name(dir))) {
+		GStatBuf st;
+		CacheFile *file;
+		gchar *path;
+
+		if (g_str_has_prefix(name, CACHE_PARTIAL_PREFIX))
+			continue;
+		path = g_build_filename(cache_dir, name, NULL);
+		if (g_stat(path, &st) < 0) {
+			g_free(path);
+			continue;
+		}
+		file = g_new(CacheFile, 1);
+		file->path = path;
+		file->size = st.st_size;
+		file->mtime = st.st_mtime;
+		files = g_slist_prepend(files, file);
+		total += file->size;
+	}
+	g_dir_close(dir);
+
+	files = g_slist_sort(files, (GCompareFunc) compare_mtime);
+	for (l = files; l; l = l->next) {
+		CacheFile *file = l->data;
+
+		if (total > cache_max) {
+			DBG("evict %s", file->path);
+			g_unlink(file->path);
+			total -= file->size;
+		}
+		g_free(file->path);
+		g_free(file);
+	}
+	g_slist_free(files);
+}
+
+/* Left behind by interrupted downloads */
+static void cache_sweep_partials_locked(void)
+{
+	GDir *dir;
+	const gchar *name;
+
+	if (!cache_dir || !(dir = g_dir_open(cache_dir, 0, NULL)))
+		return;
+
+	while ((name = g_dir_read_name(dir)))
+		if (g_str_has_prefix(name, CACHE_PARTIAL_PREFIX)) {
+			gchar *path = g_build_filename(cache_dir, name, NULL);
+			g_unlink(path);
+			g_free(path);
+		}
+	g_dir_close(dir);
+}
+
+static gchar *cache_path_locked(const gchar * uri)
+{
+	gchar *hash, *path;
+
+	if (!cache_dir)
+		return NULL;
+
+	hash = g_compute_checksum_for_string(G_CHECKSUM_MD5, uri, -1);
+	path = g_build_filename(cache_dir, hash, NULL);
+	g_free(hash);
+
+	return path;
+}
+
+static gboolean is_network_uri(const gchar * uri)
+{
+	return g_str_has_prefix(uri, "http://")
+	    || g_str_has_prefix(uri, "https://");
+}
+
+/* Call once at startup, before any download: partial files of a previous run
+ * are removed. A NULL dir disables the cache, max_bytes of 0 keeps the
+ * default. */
+void player_download_cache_configure(const gchar * dir, guint64 max_bytes)
+{
+	FUNC_ENTER;
+
+	g_mutex_lock(&cache_lock);
+	if (max_bytes)
+		cache_max = max_bytes;
+	g_free(cache_dir);
+	cache_dir = g_strdup(dir);
+	if (cache_dir) {
+		g_mkdir_with_parents(cache_dir, 0700);
+		cache_sweep_partials_locked();
+		cache_evict_locked();
+	}
+	g_mutex_unlock(&cache_lock);
+}
+
+/* Where to actually play uri from: a file URI for a complete download,
+ * otherwise a copy of uri. Free with g_free(). */
+gchar *player_buffering_resolve_uri(const gchar * uri)
+{
+	gchar *path, *local = NULL;
+
+	if (!is_network_uri(uri))
+		return g_strdup(uri);
+
+	g_mutex_lock(&cache_lock);
+	path = cache_path_locked(uri);
+	g_mutex_unlock(&cache_lock);
+
+	if (path && g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+		DBG("%s served from %s", uri, path);
+		/* Keep it at the young end of the eviction order */
+		g_utime(path, NULL);
+		local = gst_filename_to_uri(path, NULL);
+	}
+	g_free(path);
+
+	return local ? local : g_strdup(uri);
+}
+
+/* From deep-element-added: the download queue of uridecodebin writes into
+ * the cache directory and keeps its file, tagged with the uri it fetches */
+void player_buffering_element_added(PlayerData * data, GstBin * parent,
+				    GstElement * element)
+{
+	gchar *template = NULL, *uri = NULL;
+
+	if (g_strcmp0(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE
+						  (gst_element_get_factory
+						   (element))), "queue2"))
+		return;
+	if (!g_object_class_find_property(G_OBJECT_GET_CLASS(parent), "uri"))
+		return;
+
+	g_mutex_lock(&cache_lock);
+	if (cache_dir)
+		template =
+		    g_build_filename(cache_dir, CACHE_PARTIAL_PREFIX "XXXXXX",
+				     NULL);
+	g_mutex_unlock(&cache_lock);
+	if (!template)
+		return;
+
+	g_object_get(parent, "uri", &uri, NULL);
+	if (uri && is_network_uri(uri)) {
+		g_object_set(element, "temp-template", template,
+			     "temp-remove", FALSE, NULL);
+		g_object_set_data_full(G_OBJECT(element), "player-uri", uri,
+				       g_free);
+		uri = NULL;
+	}
+	g_free(uri);
+	g_free(template);
+}
+
+/* Main thread, on element messages: a download finished, keep it */
+void player_buffering_element_message(PlayerData * data, GstMessage * msg)
+{
+	const gchar *location, *uri;
+	gchar *path;
+
+	if (!gst_message_has_name(msg, "GstCacheDownloadComplete"))
+		return;
+
+	location =
+	    gst_structure_get_string(gst_message_get_structure(msg),
+				     "location");
+	uri = g_object_get_data(G_OBJECT(GST_MESSAGE_SRC(msg)), "player-uri");
+	if (!location || !uri)
+		return;
+
+	g_mutex_lock(&cache_lock);
+	path = cache_path_locked(uri);
+	/* queue2 keeps reading through its open descriptor */
+	if (path && g_rename(location, path) == 0) {
+		DBG("%s cached as %s", uri, path);
+		cache_evict_locked();
+	}
+	g_mutex_unlock(&cache_lock);
+	g_free(path);
+}
+
+/******************************************************************************/
+/*                              Buffering policy                              */
+/******************************************************************************/
+
+/* Stream mode only says how full the queue is: when the link is barely
+ * faster than playback, wait for more before resuming, it drains fast */
+static gint adapt_high_percent(gint64 avg_in, gint64 avg_out)
+{
+	if (avg_in <= 0 || avg_out <= 0)
+		return 100;
+	if (avg_in >= 2 * avg_out)
+		return 30;
+	if (avg_in >= avg_out + avg_out / 2)
+		return 60;
+	return 100;
+}
+
+/* Download mode tells how long the rest of the download takes: playback can
+ * go on once it won't catch up with the download before the end */
+static gboolean download_ahead(PlayerData * data, gint64 left_ms)
+{
+	gint64 position;
+
+	if (left_ms < 0 || !GST_CLOCK_TIME_IS_VALID(data->duration)
+	    || !gst_element_query_position(data->playbin, GST_FORMAT_TIME,
+					   &position))
+		return FALSE;
+
+	return left_ms * DOWNLOAD_MARGIN <
+	    (data->duration - position) / GST_MSECOND;
+}
+
+void player_buffering_message(PlayerData * data, GstMessage * msg)
+{
+	GstBufferingMode mode;
+	gint avg_in, avg_out;
+	gint64 left;
+	gint percent;
+	gboolean ready;
+
+	/* A live source can't wait: pausing would only lose data */
+	if (player_is_live(data))
+		return;
+
+	gst_message_parse_buffering(msg, &percent);
+	gst_message_parse_buffering_stats(msg, &mode, &avg_in, &avg_out, &left);
+
+	if (avg_in > 0)
+		data->bandwidth = data->bandwidth ?
+		    (data->bandwidth * 3 + avg_in) / 4 : avg_in;
+
+	if (mode == GST_BUFFERING_DOWNLOAD) {
+		ready = percent >= 100 || download_ahead(data, left);
+	} else {
+		data->buffer_high = adapt_high_percent(data->bandwidth, avg_out);
+		/* Hysteresis: once playing, only stop when the queue runs dry */
+		ready = data->buffering ? percent >= data->buffer_high :
+		    percent >= BUFFER_LOW_PERCENT;
+	}
+	data->buffering = !ready;
+
+	if (!ready && data->state == GST_STATE_PLAYING) {
+		DBG("buffering at %d%%, pausing", percent);
+		data->buffering_paused = TRUE;
+		data->rebuffers++;
+		gst_element_set_state(data->playbin, GST_STATE_PAUSED);
+	} else if (ready && data->buffering_paused) {
+		DBG("buffered %d%%, resuming", percent);
+		data->buffering_paused = FALSE;
+		gst_element_set_state(data->playbin, GST_STATE_PLAYING);
+	}
+}
+
+/* The user asked to play: returns FALSE if playback has to wait for the
+ * buffer, it then starts by itself when the buffer is ready */
+gboolean player_buffering_play(PlayerData * data)
+{
+	data->buffering_paused = data->buffering;
+	return !data->buffering;
+}
+
+/* The user paused or stopped: don't resume behind their back */
+void player_buffering_reset(PlayerData * data, gboolean new_item)
+{
+	data->buffering_paused = FALSE;
+	if (new_item) {
+		data->buffering = FALSE;
+		data->buffer_high = 100;
+	}
+}
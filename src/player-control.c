@@ -0,0 +1,512 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Asynchronous control. Commands are pushed on a lock-free stack from any
+ * thread and a control thread, started with the first command, takes the
+ * whole stack at once. Within a batch, commands that a later one makes
+ * pointless are dropped before anything touches the pipeline: a burst of
+ * seeks is one seek. Slow state changes only block the control thread.
+ * What a command changes in PlayerData is done from the main loop, as are
+ * completions: commands only run while it does. */
+
+typedef struct _PlayerCommand {
+	struct _PlayerCommand *next;
+	PlayerCommandType type;
+	GstClockTime position;	/* SEEK */
+	gdouble rate;		/* RATE */
+	gchar *uri;		/* SET_URI */
+	GstState state;		/* PLAY, STOP: decided on the main thread */
+	gint result;		/* 0, -1 on failure, -ECANCELED when merged */
+} PlayerCommand;
+
+typedef gint(*MainFunc) (PlayerData * data, PlayerCommand * cmd);
+
+/* Work the control thread hands over to the main thread and waits for:
+ * PlayerData belongs to the main thread, the control thread only drives the
+ * pipeline */
+typedef struct _MainCall {
+	PlayerData *data;
+	PlayerCommand *cmd;
+	MainFunc func;
+	gint result;
+	gboolean done;
+} MainCall;
+
+struct _PlayerControl {
+	PlayerCommand *head;	/* Submitted, newest first */
+	GThread *thread;
+	gint quit;
+	/* Only taken to put the control thread to sleep and wake it up */
+	GMutex wake_lock;
+	GCond wake_cond;
+	gint sleeping;
+	/* Last rate applied, owned by the control thread */
+	gdouble rate;
+	/* Completions waiting for the main loop */
+	GAsyncQueue *done;
+	GMutex done_lock;
+	guint done_id;		/* Idle draining them, 0 when none */
+	/* Main thread calls */
+	GMutex main_lock;
+	GCond main_cond;
+	MainCall call;
+	guint call_id;		/* Under main_lock */
+};
+
+static GMutex control_init_lock;
+
+static void command_free(PlayerCommand * cmd)
+{
+	g_free(cmd->uri);
+	g_free(cmd);
+}
+
+/******************************************************************************/
+/*                                Completions                                 */
+/******************************************************************************/
+
+static gboolean done_idle_cb(PlayerData * data)
+{
+	struct _PlayerControl *c = data->control;
+	PlayerCommand *cmd;
+
+	g_mutex_lock(&c->done_lock);
+	c->done_id = 0;
+	g_mutex_unlock(&c->done_lock);
+
+	while ((cmd = g_async_queue_try_pop(c->done))) {
+		if (cmd->result == -1 && cmd->type == PLAYER_COMMAND_PLAY) {
+			g_printerr
+			    ("Unable to set the pipeline to the playing state.\n");
+			player_sync_controls(data, FALSE);
+		}
+		/* Keep the play button in line with what was done */
+		if (cmd->result == 0)
+			switch (cmd->type) {
+			case PLAYER_COMMAND_PLAY:
+				player_sync_controls(data, TRUE);
+				break;
+			case PLAYER_COMMAND_PAUSE:
+			case PLAYER_COMMAND_STOP:
+			case PLAYER_COMMAND_SET_URI:
+				player_sync_controls(data, FALSE);
+				break;
+			default:
+				break;
+			}
+		if (data->command_done)
+			data->command_done(data, cmd->type, cmd->result,
+					   data->command_data);
+		command_free(cmd);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static void complete(PlayerData * data, PlayerCommand * cmd, gint result)
+{
+	struct _PlayerControl *c = data->control;
+
+	cmd->result = result;
+	g_async_queue_push(c->done, cmd);
+	g_mutex_lock(&c->done_lock);
+	if (!c->done_id)
+		c->done_id = g_idle_add((GSourceFunc) done_idle_cb, data);
+	g_mutex_unlock(&c->done_lock);
+}
+
+/******************************************************************************/
+/*                                 Execution                                  */
+/******************************************************************************/
+
+static gboolean main_call_cb(MainCall * call)
+{
+	struct _PlayerControl *c = call->data->control;
+	gint result;
+
+	result = call->func(call->data, call->cmd);
+
+	g_mutex_lock(&c->main_lock);
+	c->call_id = 0;
+	call->result = result;
+	call->done = TRUE;
+	g_cond_signal(&c->main_cond);
+	g_mutex_unlock(&c->main_lock);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Run func on the main thread and wait for it, -ECANCELED when the player
+ * goes away first */
+static gint main_call(PlayerData * data, PlayerCommand * cmd, MainFunc func)
+{
+	struct _PlayerControl *c = data->control;
+	gint result = -ECANCELED;
+
+	g_mutex_lock(&c->main_lock);
+	c->call.data = data;
+	c->call.cmd = cmd;
+	c->call.func = func;
+	c->call.done = FALSE;
+	c->call_id = g_idle_add((GSourceFunc) main_call_cb, &c->call);
+	while (!c->call.done && !g_atomic_int_get(&c->quit))
+		g_cond_wait(&c->main_cond, &c->main_lock);
+	if (c->call.done)
+		result = c->call.result;
+	g_mutex_unlock(&c->main_lock);
+
+	return result;
+}
+
+/* Main thread */
+static gint prepare_play(PlayerData * data, PlayerCommand * cmd)
+{
+	/* Waits in PAUSED when the buffer is not ready yet */
+	cmd->state = player_buffering_play(data) ? GST_STATE_PLAYING :
+	    GST_STATE_PAUSED;
+	return 0;
+}
+
+/* Main thread */
+static gint prepare_pause(PlayerData * data, PlayerCommand * cmd)
+{
+	player_buffering_reset(data, FALSE);
+	return 0;
+}
+
+/* Main thread */
+static gint prepare_stop(PlayerData * data, PlayerCommand * cmd)
+{
+	cmd->state = player_stop_prepare(data);
+	return 0;
+}
+
+/* Main thread */
+static gint prepare_set_uri(PlayerData * data, PlayerCommand * cmd)
+{
+	player_resume_save(data, FALSE);
+	return 0;
+}
+
+/* Main thread */
+static gint finish_set_uri(PlayerData * data, PlayerCommand * cmd)
+{
+	return player_set_uri(data, cmd->uri);
+}
+
+/* Leaving the old item is the slow part and happens here. What is left of
+ * player_set_uri() touches state owned by the main thread: it runs there,
+ * and the next commands wait for it. */
+static gint run_set_uri(PlayerData * data, PlayerCommand * cmd)
+{
+	gint result = main_call(data, cmd, prepare_set_uri);
+
+	if (result < 0)
+		return result;
+	gst_element_set_state(data->playbin, GST_STATE_READY);
+	return main_call(data, cmd, finish_set_uri);
+}
+
+static gint run_command(PlayerData * data, PlayerCommand * cmd)
+{
+	struct _PlayerControl *c = data->control;
+	gint64 position;
+	gint result;
+
+	switch (cmd->type) {
+	case PLAYER_COMMAND_PLAY:
+		if ((result = main_call(data, cmd, prepare_play)) < 0)
+			return result;
+		return player_live_set_state(data, cmd->state) ==
+		    GST_STATE_CHANGE_FAILURE ? -1 : 0;
+	case PLAYER_COMMAND_PAUSE:
+		if ((result = main_call(data, cmd, prepare_pause)) < 0)
+			return result;
+		return player_live_set_state(data, GST_STATE_PAUSED) ==
+		    GST_STATE_CHANGE_FAILURE ? -1 : 0;
+	case PLAYER_COMMAND_STOP:
+		if ((result = main_call(data, cmd, prepare_stop)) < 0)
+			return result;
+		player_stop_pipeline(data, cmd->state);
+		return 0;
+	case PLAYER_COMMAND_SEEK:
+		return player_seek_at_rate(data, cmd->position, c->rate,
+					   GST_SEEK_FLAG_FLUSH |
+					   GST_SEEK_FLAG_ACCURATE) ? 0 : -1;
+	case PLAYER_COMMAND_RATE:
+		/* A rate only applies through a seek, from where we are.
+		 * player_set_rate() already stored it in PlayerData. */
+		c->rate = cmd->rate;
+		if (!gst_element_query_position(data->playbin, GST_FORMAT_TIME,
+						&position))
+			return 0;	/* Applied with the next seek */
+		return player_seek_at_rate(data, position, cmd->rate,
+					   GST_SEEK_FLAG_FLUSH |
+					   GST_SEEK_FLAG_ACCURATE) ? 0 : -1;
+	case PLAYER_COMMAND_SET_URI:
+		return run_set_uri(data, cmd);
+	}
+
+	return -EINVAL;
+}
+
+/* Walk back from the newest command and drop what it overrides: everything
+ * before a new uri, state changes before a later one, seeks before a later
+ * seek or stop, rates before a later rate. A stop is never dropped by a later
+ * play: it still rewinds. */
+static void merge_batch(GPtrArray * batch)
+{
+	gboolean seen_uri = FALSE, seen_state = FALSE, seen_seek = FALSE;
+	gboolean seen_rate = FALSE;
+	guint i;
+
+	for (i = batch->len; i-- > 0;) {
+		PlayerCommand *cmd = g_ptr_array_index(batch, i);
+		gboolean drop = seen_uri;
+
+		switch (cmd->type) {
+		case PLAYER_COMMAND_SET_URI:
+			seen_uri = TRUE;
+			break;
+		case PLAYER_COMMAND_PLAY:
+		case PLAYER_COMMAND_PAUSE:
+			drop |= seen_state;
+			seen_state = TRUE;
+			break;
+		case PLAYER_COMMAND_STOP:
+			seen_state = TRUE;
+			seen_seek = TRUE;
+			break;
+		case PLAYER_COMMAND_SEEK:
+			drop |= seen_seek;
+			seen_seek = TRUE;
+			break;
+		case PLAYER_COMMAND_RATE:
+			drop |= seen_rate;
+			seen_rate = TRUE;
+			break;
+		}
+		if (drop)
+			cmd->result = -ECANCELED;
+	}
+}
+
+/* Take everything submitted so far, oldest first */
+static PlayerCommand *steal_commands(struct _PlayerControl *c)
+{
+	PlayerCommand *head, *next, *fifo = NULL;
+
+	do {
+		head = g_atomic_pointer_get(&c->head);
+	} while (!g_atomic_pointer_compare_and_exchange(&c->head, head, NULL));
+
+	for (; head; head = next) {
+		next = head->next;
+		head->next = fifo;
+		fifo = head;
+	}
+
+	return fifo;
+}
+
+static gpointer control_thread(PlayerData * data)
+{
+	struct _PlayerControl *c = data->control;
+	GPtrArray *batch = g_ptr_array_new();
+	PlayerCommand *cmd;
+	guint i;
+
+	while (!g_atomic_int_get(&c->quit)) {
+		/* Announce the sleep before looking at the stack: a submit
+		 * either sees it and signals under the lock, or pushed before
+		 * and we see its command */
+		g_mutex_lock(&c->wake_lock);
+		g_atomic_int_set(&c->sleeping, 1);
+		while (!g_atomic_pointer_get(&c->head)
+		       && !g_atomic_int_get(&c->quit))
+			g_cond_wait(&c->wake_cond, &c->wake_lock);
+		g_atomic_int_set(&c->sleeping, 0);
+		g_mutex_unlock(&c->wake_lock);
+
+		g_ptr_array_set_size(batch, 0);
+		for (cmd = steal_commands(c); cmd; cmd = cmd->next)
+			g_ptr_array_add(batch, cmd);
+		merge_batch(batch);
+		DBG("%u commands", batch->len);
+
+		for (i = 0; i < batch->len; i++) {
+			cmd = g_ptr_array_index(batch, i);
+			if (cmd->result == -ECANCELED
+			    || g_atomic_int_get(&c->quit))
+				complete(data, cmd, -ECANCELED);
+			else
+				complete(data, cmd, run_command(data, cmd));
+		}
+	}
+	g_ptr_array_free(batch, TRUE);
+
+	return NULL;
+}
+
+/******************************************************************************/
+/*                                 Submission                                 */
+/******************************************************************************/
+
+static struct _PlayerControl *control_get(PlayerData * data)
+{
+	struct _PlayerControl *c = g_atomic_pointer_get(&data->control);
+
+	if (c)
+		return c;
+
+	g_mutex_lock(&control_init_lock);
+	if (!data->control) {
+		c = g_new0(struct _PlayerControl, 1);
+		g_mutex_init(&c->wake_lock);
+		g_cond_init(&c->wake_cond);
+		g_mutex_init(&c->done_lock);
+		g_mutex_init(&c->main_lock);
+		g_cond_init(&c->main_cond);
+		c->rate = data->rate;
+		c->done = g_async_queue_new();
+		g_atomic_pointer_set(&data->control, c);
+		c->thread =
+		    g_thread_new("player-control",
+				 (GThreadFunc) control_thread, data);
+	}
+	g_mutex_unlock(&control_init_lock);
+
+	return data->control;
+}
+
+/* Never waits for the pipeline: at most for the control thread to go from
+ * sleeping to awake */
+static gint submit(PlayerData * data, PlayerCommand * cmd)
+{
+	struct _PlayerControl *c = control_get(data);
+	PlayerCommand *head;
+
+	do {
+		head = g_atomic_pointer_get(&c->head);
+		cmd->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange(&c->head, head, cmd));
+
+	if (g_atomic_int_get(&c->sleeping)) {
+		g_mutex_lock(&c->wake_lock);
+		g_cond_signal(&c->wake_cond);
+		g_mutex_unlock(&c->wake_lock);
+	}
+
+	return 0;
+}
+
+static PlayerCommand *command_new(PlayerCommandType type)
+{
+	PlayerCommand *cmd = g_new0(PlayerCommand, 1);
+
+	cmd->type = type;
+	return cmd;
+}
+
+/* Called from the main loop for each command, in submission order, with 0,
+ * -1 on failure or -ECANCELED when a later command made it pointless */
+void player_set_command_callback(PlayerData * data, PlayerCommandDone done,
+				 gpointer user_data)
+{
+	if (!data)
+		return;
+
+	data->command_done = done;
+	data->command_data = user_data;
+}
+
+/* PLAY, PAUSE or STOP, from any thread */
+gint player_command(PlayerData * data, PlayerCommandType type)
+{
+	if (!data || (type != PLAYER_COMMAND_PLAY && type != PLAYER_COMMAND_PAUSE
+		      && type != PLAYER_COMMAND_STOP))
+		return -EINVAL;
+
+	return submit(data, command_new(type));
+}
+
+gint player_command_seek(PlayerData * data, GstClockTime position)
+{
+	PlayerCommand *cmd;
+
+	if (!data || !GST_CLOCK_TIME_IS_VALID(position))
+		return -EINVAL;
+
+	cmd = command_new(PLAYER_COMMAND_SEEK);
+	cmd->position = position;
+	return submit(data, cmd);
+}
+
+gint player_command_rate(PlayerData * data, gdouble rate)
+{
+	PlayerCommand *cmd;
+
+	if (!data || rate == 0.0)
+		return -EINVAL;
+
+	cmd = command_new(PLAYER_COMMAND_RATE);
+	cmd->rate = rate;
+	return submit(data, cmd);
+}
+
+gint player_command_set_uri(PlayerData * data, const gchar * uri)
+{
+	PlayerCommand *cmd;
+
+	if (!data || !uri)
+		return -EINVAL;
+
+	cmd = command_new(PLAYER_COMMAND_SET_URI);
+	cmd->uri = g_strdup(uri);
+	return submit(data, cmd);
+}
+
+/* Main thread, before the pipeline goes away. Commands not run yet are
+ * dropped without completion. */
+void player_control_free(PlayerData * data)
+{
+	struct _PlayerControl *c = data->control;
+	PlayerCommand *cmd, *next;
+
+	if (!c)
+		return;
+
+	g_atomic_int_set(&c->quit, 1);
+	g_mutex_lock(&c->wake_lock);
+	g_cond_signal(&c->wake_cond);
+	g_mutex_unlock(&c->wake_lock);
+	g_mutex_lock(&c->main_lock);
+	g_cond_signal(&c->main_cond);
+	g_mutex_unlock(&c->main_lock);
+	g_thread_join(c->thread);
+
+	/* The thread is gone, nothing queues idles anymore */
+	if (c->call_id)
+		g_source_remove(c->call_id);
+	if (c->done_id)
+		g_source_remove(c->done_id);
+	for (cmd = steal_commands(c); cmd; cmd = next) {
+		next = cmd->next;
+		command_free(cmd);
+	}
+	while ((cmd = g_async_queue_try_pop(c->done)))
+		command_free(cmd);
+	g_async_queue_unref(c->done);
+	g_mutex_clear(&c->wake_lock);
+	g_cond_clear(&c->wake_cond);
+	g_mutex_clear(&c->done_lock);
+	g_mutex_clear(&c->main_lock);
+	g_cond_clear(&c->main_cond);
+	g_free(c);
+	data->control = NULL;
+}
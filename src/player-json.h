@@ -0,0 +1,8 @@
+#pragma once
+
+#include <glib.h>
+
+/* JSON output shared by the telemetry, the prober and the tools */
+
+/* Appends s as a JSON string, quotes included, or null */
+void player_json_string(GString * json, const gchar * s);
@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* A frame this late at the video sink is dropped rather than shown */
+#define LIVE_MAX_LATENESS (20 * GST_MSECOND)
+
+/* Live streams. A pipeline whose source is live doesn't preroll: going to
+ * PAUSED returns NO_PREROLL, which is how we tell. Position and duration
+ * are meaningless then, the slider is disabled and seeks are refused.
+ * With a latency set, network sources and jitterbuffers are asked for
+ * that much and no more, and video sinks drop late frames instead of
+ * showing them behind time. */
+
+static void set_if_exists(GObject * object, const gchar * name, gint64 value)
+{
+	GParamSpec *pspec =
+	    g_object_class_find_property(G_OBJECT_GET_CLASS(object), name);
+
+	if (!pspec)
+		return;
+	if (pspec->value_type == G_TYPE_BOOLEAN)
+		g_object_set(object, name, value != 0, NULL);
+	else if (pspec->value_type == G_TYPE_UINT)
+		g_object_set(object, name, (guint) value, NULL);
+	else if (pspec->value_type == G_TYPE_INT)
+		g_object_set(object, name, (gint) value, NULL);
+	else if (pspec->value_type == G_TYPE_INT64)
+		g_object_set(object, name, value, NULL);
+	else if (pspec->value_type == G_TYPE_UINT64)
+		g_object_set(object, name, (guint64) value, NULL);
+}
+
+/* From source-setup: rtspsrc, srtsrc and friends have a "latency" in ms,
+ * raw UDP needs to be told what it receives */
+void player_live_source_setup(PlayerData * data, GstElement * source)
+{
+	GstCaps *caps;
+
+	if (!data->live_latency)
+		return;
+
+	DBG("%s latency %u ms", GST_OBJECT_NAME(source), data->live_latency);
+	set_if_exists(G_OBJECT(source), "latency", data->live_latency);
+	set_if_exists(G_OBJECT(source), "drop-on-latency", TRUE);
+	if (data->live_caps
+	    && g_object_class_find_property(G_OBJECT_GET_CLASS(source),
+					    "caps")) {
+		caps = gst_caps_from_string(data->live_caps);
+		if (caps) {
+			g_object_set(source, "caps", caps, NULL);
+			gst_caps_unref(caps);
+		}
+	}
+}
+
+/* From deep-element-added, for what source-setup doesn't reach */
+void player_live_element_added(PlayerData * data, GstElement * element,
+			       const gchar * klass)
+{
+	GstElementFactory *factory = gst_element_get_factory(element);
+	const gchar *name;
+
+	if (!data->live_latency || !factory)
+		return;
+
+	name = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory));
+	/* sdpdemux hands its latency to the rtpbin it makes */
+	if (!g_strcmp0(name, "rtpjitterbuffer")
+	    || !g_strcmp0(name, "sdpdemux")) {
+		set_if_exists(G_OBJECT(element), "latency", data->live_latency);
+		set_if_exists(G_OBJECT(element), "drop-on-latency", TRUE);
+	} else if (element == data->video_sink
+		   || (klass && strstr(klass, "Sink")
+		       && strstr(klass, "Video"))) {
+		/* Sink bins such as glsinkbin don't have them, their sink
+		 * comes through here too */
+		set_if_exists(G_OBJECT(element), "max-lateness",
+			      LIVE_MAX_LATENESS);
+		set_if_exists(G_OBJECT(element), "qos", TRUE);
+	}
+}
+
+/* gst_element_set_state() for PAUSED and PLAYING, from any thread:
+ * NO_PREROLL is the answer of a live pipeline */
+GstStateChangeReturn player_live_set_state(PlayerData * data, GstState state)
+{
+	GstStateChangeReturn ret = gst_element_set_state(data->playbin, state);
+
+	if (ret == GST_STATE_CHANGE_NO_PREROLL)
+		g_atomic_int_set(&data->live, TRUE);
+	return ret;
+}
+
+/* Bus, main thread: the slider follows what set_state found out. The
+ * message may come first, ask the pipeline again then. */
+void player_live_state_changed(PlayerData * data, GstState new_state)
+{
+	if (new_state < GST_STATE_PAUSED)
+		return;
+
+	if (!g_atomic_int_get(&data->live)
+	    && gst_element_get_state(data->playbin, NULL, NULL, 0) ==
+	    GST_STATE_CHANGE_NO_PREROLL)
+		g_atomic_int_set(&data->live, TRUE);
+	if (data->slider && gtk_widget_get_sensitive(data->slider) ==
+	    g_atomic_int_get(&data->live)) {
+		DBG("live source: %d", data->live);
+		gtk_widget_set_sensitive(data->slider, !data->live);
+	}
+}
+
+/* A new item is not known to be live until it reaches PAUSED */
+void player_live_reset(PlayerData * data)
+{
+	g_atomic_int_set(&data->live, FALSE);
+	if (data->slider)
+		gtk_widget_set_sensitive(data->slider, TRUE);
+}
+
+/* latency_ms > 0 tunes the next items for live playback at that latency,
+ * 0 restores the file defaults. caps describe what raw network sources
+ * such as udp:// receive, NULL when they can tell themselves. */
+void player_set_live_mode(PlayerData * data, guint latency_ms,
+			  const gchar * caps)
+{
+	guint flags;
+
+	FUNC_ENTER;
+
+	if (!data)
+		return;
+
+	data->live_latency = latency_ms;
+	g_free(data->live_caps);
+	data->live_caps = g_strdup(caps);
+
+	/* Progressive download and buffering make no sense live */
+	g_object_get(data->playbin, "flags", &flags, NULL);
+	g_object_set(data->playbin, "flags", latency_ms ?
+		     flags & ~(PLAY_FLAG_DOWNLOAD | PLAY_FLAG_BUFFERING) :
+		     flags | PLAY_FLAG_DOWNLOAD | PLAY_FLAG_BUFFERING, NULL);
+}
+
+gboolean player_is_live(PlayerData * data)
+{
+	return data && g_atomic_int_get(&data->live);
+}
+
+/* What a frame costs from the source to the screen. Sources timestamp what
+ * they capture or receive with the pipeline clock, the sink shows it
+ * latency later, or as soon as it arrives when it comes later than that. */
+gboolean player_get_live_stats(PlayerData * data, PlayerLiveStats * stats)
+{
+	PlayerRenderStats rs;
+	GstQuery *query;
+	gboolean live = FALSE;
+	GstClockTime min = 0, max = 0;
+
+	if (!data || !stats)
+		return FALSE;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->live = player_is_live(data);
+	if (!stats->live)
+		return FALSE;
+
+	query = gst_query_new_latency();
+	if (gst_element_query(data->playbin, query))
+		gst_query_parse_latency(query, &live, &min, &max);
+	gst_query_unref(query);
+
+	player_get_render_stats(data, &rs);
+	stats->latency = min;
+	stats->mean_age = rs.mean_lateness;
+	stats->max_age = rs.max_lateness;
+	stats->end_to_end = MAX((GstClockTimeDiff) min, rs.mean_lateness);
+
+	return TRUE;
+}
+
+void player_live_free(PlayerData * data)
+{
+	g_clear_pointer(&data->live_caps, g_free);
+}
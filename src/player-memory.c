@@ -0,0 +1,386 @@
+#include <string.h>
+#include <stdio.h>
+
+#include <gst/video/video.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Memory budget. Half goes to decoded video frames, by capping the buffer
+ * pool of the video decoders, a quarter to the demuxed data in decodebin's
+ * multiqueue and a quarter to the network queue2 of uridecodebin. The
+ * queues are accounted exactly with pad probes. Decoded frames are counted
+ * as they leave the decoders and until they are released: a meta of ours
+ * is freed when the buffer goes back to its pool, whose reset drops the
+ * metas, or when it is finalized. The measured peak is the most the queues
+ * and the live frames held at the same time. */
+
+#define POOL_SHARE 2		/* budget / 2 for decoded frames */
+#define QUEUE_SHARE 4		/* budget / 4 for each queue */
+
+struct _PlayerMemory {
+	gint ref;		/* The player's, and one per live frame */
+	GMutex lock;
+	gsize budget;
+	gint64 queued;		/* Bytes in the queues right now */
+	gint64 queued_peak;
+	gsize pool_bytes;	/* Video frames the decoder pool may hold */
+	guint pool_buffers;
+	gint64 frames;		/* Bytes of decoded frames alive right now */
+	gint64 frames_peak;
+	gint64 total_peak;	/* Of queued + frames */
+};
+
+/* On the decoded frames we count, gives the bytes back when released */
+typedef struct _FrameMeta {
+	GstMeta meta;
+	struct _PlayerMemory *memory;
+	gsize size;
+} FrameMeta;
+
+static void memory_unref(struct _PlayerMemory *m)
+{
+	if (!g_atomic_int_dec_and_test(&m->ref))
+		return;
+
+	g_mutex_clear(&m->lock);
+	g_free(m);
+}
+
+static void total_update_locked(struct _PlayerMemory *m)
+{
+	m->total_peak = MAX(m->total_peak, m->queued + m->frames);
+}
+
+/* Bytes one queue element holds, for flushes */
+typedef struct _QueueLevel {
+	struct _PlayerMemory *memory;
+	gint64 bytes;
+} QueueLevel;
+
+static void queue_add_locked(QueueLevel * level, gint64 bytes)
+{
+	struct _PlayerMemory *m = level->memory;
+
+	level->bytes += bytes;
+	m->queued += bytes;
+	m->queued_peak = MAX(m->queued_peak, m->queued);
+	total_update_locked(m);
+}
+
+static void queue_level_free(QueueLevel * level)
+{
+	g_mutex_lock(&level->memory->lock);
+	level->memory->queued -= level->bytes;
+	g_mutex_unlock(&level->memory->lock);
+	g_free(level);
+}
+
+static GstPadProbeReturn
+queue_probe_cb(GstPad * pad, GstPadProbeInfo * info, QueueLevel * level)
+{
+	gboolean in = GST_PAD_IS_SINK(pad);
+
+	g_mutex_lock(&level->memory->lock);
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		gint64 size = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER
+						  (info));
+
+		queue_add_locked(level, in ? size : -size);
+	} else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) ==
+		   GST_EVENT_FLUSH_STOP) {
+		/* Everything queued was dropped */
+		queue_add_locked(level, -level->bytes);
+	}
+	g_mutex_unlock(&level->memory->lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static void watch_queue_pad(GstElement * element, GstPad * pad,
+			    QueueLevel * level)
+{
+	gst_pad_add_probe(pad, GST_PAD_IS_SINK(pad) ?
+			  GST_PAD_PROBE_TYPE_BUFFER |
+			  GST_PAD_PROBE_TYPE_EVENT_FLUSH :
+			  GST_PAD_PROBE_TYPE_BUFFER,
+			  (GstPadProbeCallback) queue_probe_cb, level, NULL);
+}
+
+static void watch_queue(struct _PlayerMemory *m, GstElement * element)
+{
+	QueueLevel *level = g_new0(QueueLevel, 1);
+	GstIterator *it;
+	GValue item = G_VALUE_INIT;
+
+	level->memory = m;
+	g_object_set_data_full(G_OBJECT(element), "player-queue-level", level,
+			       (GDestroyNotify) queue_level_free);
+
+	/* multiqueue pads come and go with the streams */
+	it = gst_element_iterate_pads(element);
+	while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+		watch_queue_pad(element, g_value_get_object(&item), level);
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(it);
+	g_signal_connect(element, "pad-added", G_CALLBACK(watch_queue_pad),
+			 level);
+}
+
+/* The answer of downstream to the video decoder: keep its pool within the
+ * frame share of the budget, but never below what the decoder needs */
+static GstPadProbeReturn
+allocation_probe_cb(GstPad * pad, GstPadProbeInfo * info, PlayerData * data)
+{
+	struct _PlayerMemory *m = data->memory;
+	GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+	GstBufferPool *pool;
+	GstVideoInfo vinfo;
+	GstCaps *caps;
+	gboolean need_pool;
+	guint size, min, max, cap, i, n;
+
+	if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION
+	    || !(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_PULL)
+	    || !m->budget)
+		return GST_PAD_PROBE_OK;
+
+	gst_query_parse_allocation(query, &caps, &need_pool);
+	if (!caps || !gst_video_info_from_caps(&vinfo, caps) || !vinfo.size)
+		return GST_PAD_PROBE_OK;
+
+	cap = MAX(m->budget / POOL_SHARE / vinfo.size, 1);
+	n = gst_query_get_n_allocation_pools(query);
+	if (!n) {
+		/* The decoder makes its own pool, with our maximum */
+		gst_query_add_allocation_pool(query, NULL, vinfo.size, 0, cap);
+		min = 0;
+		max = cap;
+	}
+	for (i = 0; i < n; i++) {
+		gst_query_parse_nth_allocation_pool(query, i, &pool, &size,
+						    &min, &max);
+		if (!max || max > MAX(min, cap))
+			max = MAX(min, cap);
+		gst_query_set_nth_allocation_pool(query, i, pool, size, min,
+						  max);
+		if (pool)
+			gst_object_unref(pool);
+	}
+
+	g_mutex_lock(&m->lock);
+	m->pool_buffers = max;
+	m->pool_bytes = (gsize) max * vinfo.size;
+	g_mutex_unlock(&m->lock);
+	DBG("video pool capped at %u buffers of %" G_GSIZE_FORMAT " bytes",
+	    max, vinfo.size);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean frame_meta_init(GstMeta * meta, gpointer params,
+				GstBuffer * buffer)
+{
+	((FrameMeta *) meta)->memory = NULL;
+	return TRUE;
+}
+
+/* Any thread: back to the pool, or gone */
+static void frame_meta_free(GstMeta * meta, GstBuffer * buffer)
+{
+	FrameMeta *fm = (FrameMeta *) meta;
+	struct _PlayerMemory *m = fm->memory;
+
+	if (!m)
+		return;
+
+	g_mutex_lock(&m->lock);
+	m->frames -= fm->size;
+	g_mutex_unlock(&m->lock);
+	memory_unref(m);
+}
+
+/* No transform: copies are not counted twice */
+static GType frame_meta_api_get_type(void)
+{
+	static GType type;
+	static const gchar *tags[] = { NULL };
+
+	if (g_once_init_enter(&type)) {
+		GType t = gst_meta_api_type_register("PlayerFrameMetaAPI", tags);
+
+		g_once_init_leave(&type, t);
+	}
+	return type;
+}
+
+static const GstMetaInfo *frame_meta_get_info(void)
+{
+	static const GstMetaInfo *info;
+
+	if (g_once_init_enter((GstMetaInfo **) & info)) {
+		const GstMetaInfo *i =
+		    gst_meta_register(frame_meta_api_get_type(),
+				      "PlayerFrameMeta", sizeof(FrameMeta),
+				      frame_meta_init, frame_meta_free, NULL);
+
+		g_once_init_leave((GstMetaInfo **) & info, (GstMetaInfo *) i);
+	}
+	return info;
+}
+
+static GstPadProbeReturn
+frame_probe_cb(GstPad * pad, GstPadProbeInfo * info, PlayerData * data)
+{
+	struct _PlayerMemory *m = data->memory;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	FrameMeta *fm;
+
+	if (gst_buffer_get_meta(buffer, frame_meta_api_get_type()))
+		return GST_PAD_PROBE_OK;
+
+	/* Usually ours alone. Otherwise the copy shares the frame memory and
+	 * lives as long as it does downstream. */
+	if (!gst_buffer_is_writable(buffer)) {
+		buffer = gst_buffer_make_writable(buffer);
+		GST_PAD_PROBE_INFO_DATA(info) = buffer;
+	}
+
+	fm = (FrameMeta *) gst_buffer_add_meta(buffer, frame_meta_get_info(),
+					       NULL);
+	if (!fm)
+		return GST_PAD_PROBE_OK;
+	fm->size = gst_buffer_get_size(buffer);
+	fm->memory = m;
+	g_atomic_int_inc(&m->ref);
+
+	g_mutex_lock(&m->lock);
+	m->frames += fm->size;
+	m->frames_peak = MAX(m->frames_peak, m->frames);
+	total_update_locked(m);
+	g_mutex_unlock(&m->lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+/* From deep-element-added, once the other hooks had their say */
+void player_memory_element_added(PlayerData * data, GstElement * element,
+				 const gchar * klass)
+{
+	struct _PlayerMemory *m = data->memory;
+	GstElementFactory *factory = gst_element_get_factory(element);
+	const gchar *name;
+	gchar *temp = NULL;
+	GstPad *pad;
+
+	if (!m || !factory)
+		return;
+
+	name = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory));
+
+	/* decodebin applies its own limits to its multiqueue, set them there.
+	 * Without a budget, the defaults stay but we still account. */
+	if (!g_strcmp0(name, "decodebin") && m->budget) {
+		g_object_set(element, "max-size-bytes",
+			     (guint) (m->budget / QUEUE_SHARE),
+			     "max-size-buffers", 0, NULL);
+	} else if (!g_strcmp0(name, "uridecodebin") && m->budget) {
+		g_object_set(element, "buffer-size",
+			     (gint) MIN(m->budget / QUEUE_SHARE, G_MAXINT),
+			     NULL);
+	} else if (!g_strcmp0(name, "queue2")) {
+		/* A download goes to a file, not to memory */
+		g_object_get(element, "temp-template", &temp, NULL);
+		if (!temp)
+			watch_queue(m, element);
+		g_free(temp);
+	} else if (!g_strcmp0(name, "multiqueue")) {
+		watch_queue(m, element);
+	} else if (klass && strstr(klass, "Decoder") && strstr(klass, "Video")) {
+		pad = gst_element_get_static_pad(element, "src");
+		if (pad) {
+			gst_pad_add_probe(pad,
+					  GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM,
+					  (GstPadProbeCallback)
+					  allocation_probe_cb, data, NULL);
+			gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+					  (GstPadProbeCallback)
+					  frame_probe_cb, data, NULL);
+			gst_object_unref(pad);
+		}
+	}
+}
+
+/* Applies to elements created from now on: set it before player_set_uri().
+ * 0 keeps the element defaults but still reports the peak. */
+void player_set_memory_budget(PlayerData * data, gsize bytes)
+{
+	struct _PlayerMemory *m;
+
+	FUNC_ENTER;
+
+	if (!data)
+		return;
+
+	if (!(m = data->memory)) {
+		m = g_new0(struct _PlayerMemory, 1);
+		m->ref = 1;
+		g_mutex_init(&m->lock);
+		data->memory = m;
+	}
+	m->budget = bytes;
+}
+
+gboolean player_get_memory_stats(PlayerData * data, PlayerMemoryStats * stats)
+{
+	struct _PlayerMemory *m;
+
+	if (!data || !stats || !(m = data->memory))
+		return FALSE;
+
+	g_mutex_lock(&m->lock);
+	stats->budget = m->budget;
+	stats->queued = MAX(m->queued, 0);
+	stats->queued_peak = m->queued_peak;
+	stats->pool_buffers = m->pool_buffers;
+	stats->pool_bytes = m->pool_bytes;
+	stats->peak = m->queued_peak + m->pool_bytes;
+	stats->frame_bytes = m->frames_peak;
+	stats->measured_peak = m->total_peak;
+	g_mutex_unlock(&m->lock);
+	stats->rebuffers = data->rebuffers;
+
+	return TRUE;
+}
+
+/* A new item starts from empty queues */
+void player_memory_reset(PlayerData * data)
+{
+	struct _PlayerMemory *m = data->memory;
+
+	if (!m)
+		return;
+
+	g_mutex_lock(&m->lock);
+	/* Frames of the last item still alive are released later */
+	m->queued_peak = MAX(m->queued, 0);
+	m->frames_peak = MAX(m->frames, 0);
+	m->total_peak = MAX(m->queued + m->frames, 0);
+	g_mutex_unlock(&m->lock);
+	data->rebuffers = 0;
+}
+
+/* Called once the pipeline is gone: the queue levels point to us. Frames
+ * still held elsewhere, by a sample for instance, keep a reference. */
+void player_memory_free(PlayerData * data)
+{
+	struct _PlayerMemory *m = data->memory;
+
+	if (!m)
+		return;
+
+	memory_unref(m);
+	data->memory = NULL;
+}
@@ -0,0 +1,409 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "player-mosaic.h"
+#include "player-private.h"
+
+/* Frames kept between a tile and the compositor, they are small */
+#define TILE_QUEUE_BUFFERS 3
+
+typedef struct _Tile {
+	struct _PlayerMosaic *mosaic;
+	gint cell;
+	GstElement *bin;	/* uridecodebin ! videoscale ! videoconvert ! queue */
+	GstElement *scale;	/* Where decoded pads get linked */
+	GstPad *mixer_pad;	/* Request pad of the compositor */
+	gboolean removing;
+	gulong idle_probe;
+	guint idle_id;		/* tile_remove_idle(), under idle_lock */
+} Tile;
+
+struct _PlayerMosaic {
+	GstElement *pipeline;
+	GstElement *compositor;
+	GstElement *sink;
+	GtkWidget *widget;	/* NULL in headless mode */
+	guint columns, rows;
+	gint cell_width, cell_height;
+	Tile **cells;		/* columns * rows, NULL when free */
+	guint tiles;
+	GList *removing;	/* Tiles waiting to be idle */
+	GMutex idle_lock;
+	guint bus_watch;
+	gint frames;		/* Composited frames that reached the sink */
+};
+
+/******************************************************************************/
+/*                                   Tiles                                    */
+/******************************************************************************/
+
+static void decode_pad_added_cb(GstElement * decode, GstPad * pad, Tile * tile)
+{
+	GstPad *sink = gst_element_get_static_pad(tile->scale, "sink");
+
+	/* uridecodebin only exposes video, one stream per tile */
+	if (!gst_pad_is_linked(sink)
+	    && gst_pad_link(pad, sink) != GST_PAD_LINK_OK)
+		DBG("tile %d: could not link %s", tile->cell,
+		    GST_PAD_NAME(pad));
+	gst_object_unref(sink);
+}
+
+/* Stop at audio and text streams: no parser nor decoder is plugged for
+ * them, and their pads are dropped since they are not video/x-raw */
+static gboolean
+decode_autoplug_continue_cb(GstElement * decode, GstPad * pad, GstCaps * caps,
+			    Tile * tile)
+{
+	const gchar *name;
+
+	if (gst_caps_is_empty(caps) || gst_caps_is_any(caps))
+		return TRUE;
+
+	name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+	return !g_str_has_prefix(name, "audio/")
+	    && !g_str_has_prefix(name, "text/")
+	    && !g_str_has_prefix(name, "subpicture/");
+}
+
+static Tile *tile_new(PlayerMosaic * mosaic, gint cell, const gchar * uri)
+{
+	GstElement *decode, *filter, *convert, *queue;
+	GstCaps *caps;
+	GstPad *pad;
+	Tile *tile;
+
+	tile = g_new0(Tile, 1);
+	tile->mosaic = mosaic;
+	tile->cell = cell;
+	tile->bin = gst_bin_new(NULL);
+
+	decode = gst_element_factory_make("uridecodebin", NULL);
+	tile->scale = gst_element_factory_make("videoscale", NULL);
+	filter = gst_element_factory_make("capsfilter", NULL);
+	convert = gst_element_factory_make("videoconvert", NULL);
+	queue = gst_element_factory_make("queue", NULL);
+	if (!decode || !tile->scale || !filter || !convert || !queue) {
+		g_printerr("Could not create the tile elements.\n");
+		gst_object_unref(tile->bin);
+		g_free(tile);
+		return NULL;
+	}
+
+	/* Only video is exposed, and only video is decoded: see
+	 * decode_autoplug_continue_cb() */
+	caps = gst_caps_from_string("video/x-raw");
+	g_object_set(decode, "uri", uri, "caps", caps,
+		     "expose-all-streams", FALSE, NULL);
+	gst_caps_unref(caps);
+
+	/* Scale down in the decoder format, convert the small frame */
+	caps = gst_caps_new_simple("video/x-raw",
+				   "width", G_TYPE_INT, mosaic->cell_width,
+				   "height", G_TYPE_INT, mosaic->cell_height,
+				   "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+				   NULL);
+	g_object_set(filter, "caps", caps, NULL);
+	gst_caps_unref(caps);
+	g_object_set(tile->scale, "add-borders", TRUE, NULL);
+	g_object_set(queue, "max-size-buffers", TILE_QUEUE_BUFFERS,
+		     "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+
+	gst_bin_add_many(GST_BIN(tile->bin), decode, tile->scale, filter,
+			 convert, queue, NULL);
+	gst_element_link_many(tile->scale, filter, convert, queue, NULL);
+	g_signal_connect(decode, "autoplug-continue",
+			 G_CALLBACK(decode_autoplug_continue_cb), tile);
+	g_signal_connect(decode, "pad-added", G_CALLBACK(decode_pad_added_cb),
+			 tile);
+
+	pad = gst_element_get_static_pad(queue, "src");
+	gst_element_add_pad(tile->bin, gst_ghost_pad_new("src", pad));
+	gst_object_unref(pad);
+
+	return tile;
+}
+
+/* Main thread, once the tile is not pushing anymore */
+static gboolean tile_remove_idle(Tile * tile)
+{
+	PlayerMosaic *mosaic = tile->mosaic;
+	GstPad *src = gst_element_get_static_pad(tile->bin, "src");
+
+	gst_pad_unlink(src, tile->mixer_pad);
+	gst_object_unref(src);
+	gst_element_release_request_pad(mosaic->compositor, tile->mixer_pad);
+	gst_object_unref(tile->mixer_pad);
+
+	/* Wakes up the streaming threads blocked in the idle probe */
+	gst_element_set_state(tile->bin, GST_STATE_NULL);
+	gst_bin_remove(GST_BIN(mosaic->pipeline), tile->bin);
+
+	g_mutex_lock(&mosaic->idle_lock);
+	tile->idle_id = 0;
+	g_mutex_unlock(&mosaic->idle_lock);
+
+	DBG("tile %d removed", tile->cell);
+	mosaic->removing = g_list_remove(mosaic->removing, tile);
+	g_free(tile);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Called at once if the tile is idle, otherwise from its streaming thread
+ * between two buffers. The pad stays blocked until the tile is gone. */
+static GstPadProbeReturn
+tile_idle_cb(GstPad * pad, GstPadProbeInfo * info, Tile * tile)
+{
+	g_mutex_lock(&tile->mosaic->idle_lock);
+	if (!tile->idle_id)
+		tile->idle_id = g_idle_add((GSourceFunc) tile_remove_idle, tile);
+	g_mutex_unlock(&tile->mosaic->idle_lock);
+	return GST_PAD_PROBE_OK;
+}
+
+/******************************************************************************/
+/*                                    API                                     */
+/******************************************************************************/
+
+static GstPadProbeReturn
+frame_probe_cb(GstPad * pad, GstPadProbeInfo * info, PlayerMosaic * mosaic)
+{
+	g_atomic_int_inc(&mosaic->frames);
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean bus_cb(GstBus * bus, GstMessage * msg, PlayerMosaic * mosaic)
+{
+	GError *err;
+	gchar *debug_info;
+	guint i;
+
+	if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_ERROR)
+		return G_SOURCE_CONTINUE;
+
+	gst_message_parse_error(msg, &err, &debug_info);
+	/* A broken tile goes, the others go on */
+	for (i = 0; i < mosaic->columns * mosaic->rows; i++)
+		if (mosaic->cells[i]
+		    && gst_object_has_as_ancestor(GST_MESSAGE_SRC(msg),
+						  GST_OBJECT(mosaic->cells[i]->
+							     bin))) {
+			g_printerr("Tile %u: %s\n", i, err->message);
+			player_mosaic_remove(mosaic, i);
+			break;
+		}
+	if (i == mosaic->columns * mosaic->rows)
+		g_printerr("Error received from element %s: %s\n",
+			   GST_OBJECT_NAME(msg->src), err->message);
+	g_clear_error(&err);
+	g_free(debug_info);
+
+	return G_SOURCE_CONTINUE;
+}
+
+PlayerMosaic *player_mosaic_new(guint columns, guint rows, gint width,
+				gint height, gboolean headless)
+{
+	PlayerMosaic *mosaic;
+	GstElement *filter, *convert;
+	GstCaps *caps;
+	GstBus *bus;
+	GstPad *pad;
+
+	FUNC_ENTER;
+
+	if (!columns || !rows || width < (gint) columns
+	    || height < (gint) rows)
+		return NULL;
+
+	player_init_once();
+
+	mosaic = g_new0(PlayerMosaic, 1);
+	g_mutex_init(&mosaic->idle_lock);
+	mosaic->columns = columns;
+	mosaic->rows = rows;
+	/* Even sizes keep the chroma planes aligned */
+	mosaic->cell_width = width / columns & ~1;
+	mosaic->cell_height = height / rows & ~1;
+	mosaic->cells = g_new0(Tile *, columns * rows);
+
+	mosaic->pipeline = gst_pipeline_new("mosaic");
+	mosaic->compositor = gst_element_factory_make("compositor", NULL);
+	filter = gst_element_factory_make("capsfilter", NULL);
+	convert = gst_element_factory_make("videoconvert", NULL);
+	mosaic->sink = gst_element_factory_make(headless ? "fakesink" :
+						"gtksink", NULL);
+	if (!mosaic->compositor || !filter || !convert || !mosaic->sink) {
+		g_printerr("Not all elements could be created.\n");
+		gst_object_unref(mosaic->pipeline);
+		g_free(mosaic->cells);
+		g_mutex_clear(&mosaic->idle_lock);
+		g_free(mosaic);
+		return NULL;
+	}
+
+	gst_util_set_object_arg(G_OBJECT(mosaic->compositor), "background",
+				"black");
+	caps = gst_caps_new_simple("video/x-raw",
+				   "width", G_TYPE_INT, width,
+				   "height", G_TYPE_INT, height,
+				   "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+	g_object_set(filter, "caps", caps, NULL);
+	gst_caps_unref(caps);
+	if (!headless)
+		g_object_get(mosaic->sink, "widget", &mosaic->widget, NULL);
+
+	gst_bin_add_many(GST_BIN(mosaic->pipeline), mosaic->compositor, filter,
+			 convert, mosaic->sink, NULL);
+	gst_element_link_many(mosaic->compositor, filter, convert,
+			      mosaic->sink, NULL);
+
+	pad = gst_element_get_static_pad(mosaic->sink, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  (GstPadProbeCallback) frame_probe_cb, mosaic, NULL);
+	gst_object_unref(pad);
+
+	bus = gst_element_get_bus(mosaic->pipeline);
+	mosaic->bus_watch = gst_bus_add_watch(bus, (GstBusFunc) bus_cb, mosaic);
+	gst_object_unref(bus);
+
+	return mosaic;
+}
+
+/* The sink widget, to pack where the video goes */
+GtkWidget *player_mosaic_get_widget(PlayerMosaic * mosaic)
+{
+	return mosaic ? mosaic->widget : NULL;
+}
+
+gint player_mosaic_add(PlayerMosaic * mosaic, const gchar * uri)
+{
+	GstClock *clock;
+	GstPad *src;
+	Tile *tile;
+	guint cell;
+
+	FUNC_ENTER;
+
+	if (!mosaic || !uri)
+		return -1;
+
+	for (cell = 0; cell < mosaic->columns * mosaic->rows; cell++)
+		if (!mosaic->cells[cell])
+			break;
+	if (cell == mosaic->columns * mosaic->rows)
+		return -1;
+
+	tile = tile_new(mosaic, cell, uri);
+	if (!tile)
+		return -1;
+
+	tile->mixer_pad =
+	    gst_element_get_request_pad(mosaic->compositor, "sink_%u");
+	g_object_set(tile->mixer_pad,
+		     "xpos", (gint) (cell % mosaic->columns) * mosaic->cell_width,
+		     "ypos", (gint) (cell / mosaic->columns) * mosaic->cell_height,
+		     NULL);
+
+	gst_bin_add(GST_BIN(mosaic->pipeline), tile->bin);
+	src = gst_element_get_static_pad(tile->bin, "src");
+	/* Joining a running wall: the tile starts now, not at time 0 */
+	clock = gst_element_get_clock(mosaic->pipeline);
+	if (clock) {
+		gst_pad_set_offset(src, gst_clock_get_time(clock) -
+				   gst_element_get_base_time(mosaic->pipeline));
+		gst_object_unref(clock);
+	}
+	gst_pad_link(src, tile->mixer_pad);
+	gst_object_unref(src);
+	gst_element_sync_state_with_parent(tile->bin);
+
+	mosaic->cells[cell] = tile;
+	mosaic->tiles++;
+	DBG("tile %u: %s", cell, uri);
+
+	return cell;
+}
+
+void player_mosaic_remove(PlayerMosaic * mosaic, gint cell)
+{
+	Tile *tile;
+	GstPad *src;
+
+	FUNC_ENTER;
+
+	if (!mosaic || cell < 0 || cell >= (gint) (mosaic->columns * mosaic->rows)
+	    || !(tile = mosaic->cells[cell]) || tile->removing)
+		return;
+
+	/* The cell is free right away, the tile goes once it is idle */
+	tile->removing = TRUE;
+	mosaic->cells[cell] = NULL;
+	mosaic->tiles--;
+	mosaic->removing = g_list_prepend(mosaic->removing, tile);
+
+	src = gst_element_get_static_pad(tile->bin, "src");
+	tile->idle_probe =
+	    gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_IDLE,
+			      (GstPadProbeCallback) tile_idle_cb, tile, NULL);
+	gst_object_unref(src);
+}
+
+guint player_mosaic_get_tiles(PlayerMosaic * mosaic)
+{
+	return mosaic ? mosaic->tiles : 0;
+}
+
+guint64 player_mosaic_get_frames(PlayerMosaic * mosaic)
+{
+	return mosaic ? (guint) g_atomic_int_get(&mosaic->frames) : 0;
+}
+
+gint player_mosaic_play(PlayerMosaic * mosaic)
+{
+	if (!mosaic)
+		return -1;
+
+	return gst_element_set_state(mosaic->pipeline, GST_STATE_PLAYING) ==
+	    GST_STATE_CHANGE_FAILURE ? -1 : 0;
+}
+
+void player_mosaic_free(PlayerMosaic * mosaic)
+{
+	GList *l;
+	guint i;
+
+	FUNC_ENTER;
+
+	if (!mosaic)
+		return;
+
+	gst_element_set_state(mosaic->pipeline, GST_STATE_NULL);
+	/* Tiles still being removed go with the pipeline */
+	for (l = mosaic->removing; l; l = l->next) {
+		Tile *tile = l->data;
+		GstPad *src = gst_element_get_static_pad(tile->bin, "src");
+
+		gst_pad_remove_probe(src, tile->idle_probe);
+		gst_object_unref(src);
+		if (tile->idle_id)
+			g_source_remove(tile->idle_id);
+		gst_object_unref(tile->mixer_pad);
+		g_free(tile);
+	}
+	g_list_free(mosaic->removing);
+	for (i = 0; i < mosaic->columns * mosaic->rows; i++)
+		if (mosaic->cells[i])
+			gst_object_unref(mosaic->cells[i]->mixer_pad);
+	g_source_remove(mosaic->bus_watch);
+	gst_object_unref(mosaic->pipeline);
+	if (mosaic->widget)
+		g_object_unref(mosaic->widget);
+	for (i = 0; i < mosaic->columns * mosaic->rows; i++)
+		g_free(mosaic->cells[i]);
+	g_free(mosaic->cells);
+	g_mutex_clear(&mosaic->idle_lock);
+	g_free(mosaic);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+/* Video wall: many uris decoded into one pipeline and composited into one
+ * surface, on one clock. Each tile is scaled down to its cell before the
+ * compositor, audio is not decoded. Tiles come and go while the others
+ * keep playing. */
+typedef struct _PlayerMosaic PlayerMosaic;
+
+/* A grid of columns x rows cells composited at width x height. Headless
+ * mosaics render to a fakesink and have no widget. */
+PlayerMosaic *player_mosaic_new(guint columns, guint rows, gint width,
+				gint height, gboolean headless);
+GtkWidget *player_mosaic_get_widget(PlayerMosaic * mosaic);
+/* Returns the tile id, its cell, or -1 when the grid is full */
+gint player_mosaic_add(PlayerMosaic * mosaic, const gchar * uri);
+void player_mosaic_remove(PlayerMosaic * mosaic, gint tile);
+guint player_mosaic_get_tiles(PlayerMosaic * mosaic);
+guint64 player_mosaic_get_frames(PlayerMosaic * mosaic);
+gint player_mosaic_play(PlayerMosaic * mosaic);
+void player_mosaic_free(PlayerMosaic * mosaic);
@@ -0,0 +1,208 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "player-pool.h"
+#include "player-private.h"
+
+struct _PlayerPool {
+	GPtrArray *players;	/* PlayerData * owned by the pool */
+	GAsyncQueue *messages;	/* PoolMessage * posted by the sync handlers */
+	GMutex dispatch_lock;
+	guint dispatch_id;	/* Queued dispatch idle, under dispatch_lock */
+	PlayerPoolStats stats;
+};
+
+typedef struct _PoolMessage {
+	PlayerData *data;
+	GstMessage *msg;
+} PoolMessage;
+
+static void pool_message_free(PoolMessage * pm)
+{
+	gst_message_unref(pm->msg);
+	g_free(pm);
+}
+
+static gboolean pool_has_player(PlayerPool * pool, PlayerData * data)
+{
+	guint i;
+
+	for (i = 0; i < pool->players->len; i++)
+		if (g_ptr_array_index(pool->players, i) == data)
+			return TRUE;
+
+	return FALSE;
+}
+
+/* Called in the main thread: drain every message queued since the last
+ * wakeup, whatever player posted it */
+static gboolean pool_dispatch(PlayerPool * pool)
+{
+	PoolMessage *pm;
+
+	/* Reset first so that a message pushed while we drain queues a new
+	 * dispatch instead of being lost */
+	g_mutex_lock(&pool->dispatch_lock);
+	pool->dispatch_id = 0;
+	g_mutex_unlock(&pool->dispatch_lock);
+	pool->stats.dispatches++;
+
+	while ((pm = g_async_queue_try_pop(pool->messages))) {
+		/* The player may have been removed since the message was posted */
+		if (pool_has_player(pool, pm->data)) {
+			player_handle_message(pm->data, pm->msg);
+			pool->stats.messages++;
+		}
+		pool_message_free(pm);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Called from whatever thread posted the message. We never dispatch here:
+ * the message is queued and the main loop is woken up at most once per
+ * burst, whatever the number of players */
+static GstBusSyncReply
+pool_sync_handler(GstBus * bus, GstMessage * msg, gpointer user_data)
+{
+	PlayerData *data = user_data;
+	PlayerPool *pool = data->pool;
+	PoolMessage *pm;
+
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_ERROR:
+	case GST_MESSAGE_EOS:
+	case GST_MESSAGE_STATE_CHANGED:
+	case GST_MESSAGE_ASYNC_DONE:
+	case GST_MESSAGE_STEP_DONE:
+	case GST_MESSAGE_DURATION_CHANGED:
+	case GST_MESSAGE_STREAM_START:
+	case GST_MESSAGE_STREAM_COLLECTION:
+	case GST_MESSAGE_LATENCY:
+	case GST_MESSAGE_BUFFERING:
+	case GST_MESSAGE_ELEMENT:
+		break;
+	case GST_MESSAGE_QOS:
+		/* Frequent, only wake up for them when someone counts them */
+		if (!data->telemetry)
+			return GST_BUS_DROP;
+		break;
+	default:
+		/* Nobody listens to the other messages, don't wake anyone up */
+		return GST_BUS_DROP;
+	}
+
+	pm = g_new(PoolMessage, 1);
+	pm->data = data;
+	pm->msg = gst_message_ref(msg);
+	g_async_queue_push(pool->messages, pm);
+
+	g_mutex_lock(&pool->dispatch_lock);
+	if (!pool->dispatch_id)
+		pool->dispatch_id = g_idle_add((GSourceFunc) pool_dispatch,
+					       pool);
+	g_mutex_unlock(&pool->dispatch_lock);
+
+	return GST_BUS_DROP;
+}
+
+PlayerPool *player_pool_new(void)
+{
+	PlayerPool *pool;
+
+	FUNC_ENTER;
+
+	player_init_once();
+
+	pool = g_new0(PlayerPool, 1);
+	g_mutex_init(&pool->dispatch_lock);
+	pool->players = g_ptr_array_new();
+	pool->messages =
+	    g_async_queue_new_full((GDestroyNotify) pool_message_free);
+
+	return pool;
+}
+
+PlayerData *player_pool_add(PlayerPool * pool)
+{
+	PlayerData *data;
+	GstBus *bus;
+
+	FUNC_ENTER;
+
+	if (!pool)
+		return NULL;
+
+	data = g_new(PlayerData, 1);
+	if (player_setup(data, PLAYER_RENDER_AUTO) < 0) {
+		g_free(data);
+		return NULL;
+	}
+	data->pool = pool;
+
+	bus = gst_element_get_bus(data->playbin);
+	gst_bus_set_sync_handler(bus, pool_sync_handler, data, NULL);
+	gst_object_unref(bus);
+
+	g_ptr_array_add(pool->players, data);
+
+	return data;
+}
+
+void player_pool_remove(PlayerPool * pool, PlayerData * data)
+{
+	GstBus *bus;
+
+	FUNC_ENTER;
+
+	if (!pool || !data || !g_ptr_array_remove(pool->players, data))
+		return;
+
+	bus = gst_element_get_bus(data->playbin);
+	gst_bus_set_sync_handler(bus, NULL, NULL, NULL);
+	gst_object_unref(bus);
+
+	player_free(data);
+	g_free(data);
+}
+
+guint player_pool_size(PlayerPool * pool)
+{
+	return pool ? pool->players->len : 0;
+}
+
+PlayerData *player_pool_get(PlayerPool * pool, guint index)
+{
+	if (!pool || index >= pool->players->len)
+		return NULL;
+
+	return g_ptr_array_index(pool->players, index);
+}
+
+void player_pool_get_stats(PlayerPool * pool, PlayerPoolStats * stats)
+{
+	if (pool && stats)
+		*stats = pool->stats;
+}
+
+void player_pool_free(PlayerPool * pool)
+{
+	FUNC_ENTER;
+
+	if (!pool)
+		return;
+
+	while (pool->players->len)
+		player_pool_remove(pool,
+				   g_ptr_array_index(pool->players,
+						     pool->players->len - 1));
+
+	/* Drop a dispatch that may still be queued */
+	if (pool->dispatch_id)
+		g_source_remove(pool->dispatch_id);
+	g_mutex_clear(&pool->dispatch_lock);
+	g_async_queue_unref(pool->messages);
+	g_ptr_array_free(pool->players, TRUE);
+	g_free(pool);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "player.h"
+
+/* A pool holds many players (video tiles) in one process. GStreamer is
+ * initialized once and every bus is drained by a single dispatcher. Position
+ * updates follow the frame clock, which tiles of one window share. */
+typedef struct _PlayerPool PlayerPool;
+
+typedef struct _PlayerPoolStats {
+	guint64 messages;	/* Bus messages routed through the dispatcher */
+	guint64 dispatches;	/* Main loop wakeups caused by the dispatcher */
+} PlayerPoolStats;
+
+PlayerPool *player_pool_new(void);
+PlayerData *player_pool_add(PlayerPool * pool);
+void player_pool_remove(PlayerPool * pool, PlayerData * data);
+guint player_pool_size(PlayerPool * pool);
+PlayerData *player_pool_get(PlayerPool * pool, guint index);
+void player_pool_get_stats(PlayerPool * pool, PlayerPoolStats * stats);
+void player_pool_free(PlayerPool * pool);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "player.h"
+
+/* Internal helpers shared between player.c and the other player modules.
+ * They are not part of the public API. */
+
+/* Tracing on stdout, all of it behind verbose */
+extern int verbose;
+#define LOG(fmt, ...) if (verbose){printf("[%s:%d] %s - " fmt "\n", __FILE__, __LINE__, __func__, ##__VA_ARGS__);}
+#define DBG(fmt, ...) LOG(fmt, ##__VA_ARGS__)
+#define FUNC_ENTER if (verbose){printf("%s\n", __func__);}
+
+/* Mirrors GstPlayFlags, which is not in a public header */
+#define PLAY_FLAG_VIDEO (1 << 0)
+#define PLAY_FLAG_TEXT (1 << 2)
+#define PLAY_FLAG_VIS (1 << 3)
+#define PLAY_FLAG_DOWNLOAD (1 << 7)
+#define PLAY_FLAG_BUFFERING (1 << 8)
+
+void player_init_once(void);
+gint player_setup(PlayerData * data, PlayerRenderMode mode);
+void player_handle_message(PlayerData * data, GstMessage * msg);
+void player_do_stop(PlayerData * data);
+GstState player_stop_prepare(PlayerData * data);
+void player_stop_pipeline(PlayerData * data, GstState state);
+void player_sync_controls(PlayerData * data, gboolean playing);
+void player_attach_window(PlayerData * data);
+gboolean player_seek_at_rate(PlayerData * data, gint64 position, gdouble rate,
+			     GstSeekFlags flags);
+
+/* player-streams.c */
+void player_streams_init(PlayerData * data);
+void player_streams_update(PlayerData * data, PlayerStreamType type,
+			   gint index);
+void player_streams_set_collection(PlayerData * data,
+				   GstStreamCollection * collection);
+void player_streams_set_decoder(PlayerData * data, GstElement * decoder,
+				GstCaps * caps);
+void player_streams_clear(PlayerData * data);
+void player_streams_queue_next(PlayerData * data);
+void player_streams_switch(PlayerData * data);
+void player_streams_restore_text(PlayerData * data, const gchar * text);
+gchar *player_streams_dup_text(PlayerData * data);
+void player_streams_free(PlayerData * data);
+
+/* player-telemetry.c */
+void player_telemetry_element_added(PlayerData * data, GstElement * element,
+				    const gchar * klass);
+void player_telemetry_message(PlayerData * data, GstMessage * msg);
+void player_telemetry_reset(PlayerData * data);
+void player_telemetry_free(PlayerData * data);
+
+/* player-step.c */
+void player_step_record(PlayerData * data, GstPad * pad, GstBuffer * buffer);
+void player_step_reset(PlayerData * data);
+void player_step_async_done(PlayerData * data);
+void player_step_done(PlayerData * data);
+gboolean player_step_draw(PlayerData * data, GtkWidget * widget, cairo_t * cr);
+void player_step_free(PlayerData * data);
+
+/* player-snapshot.c */
+GdkPixbuf *player_sample_to_pixbuf(GstSample * sample, gint width,
+				   gint height);
+void player_snapshot_free(PlayerData * data);
+
+/* player-subtitles.c */
+void player_subtitles_init(PlayerData * data);
+void player_subtitles_free(PlayerData * data);
+
+/* player-audio.c */
+void player_audio_element_message(PlayerData * data, GstMessage * msg);
+gboolean player_audio_draw(PlayerData * data, GtkWidget * widget,
+			   cairo_t * cr);
+void player_audio_free(PlayerData * data);
+
+/* player-live.c */
+void player_live_source_setup(PlayerData * data, GstElement * source);
+void player_live_element_added(PlayerData * data, GstElement * element,
+			       const gchar * klass);
+GstStateChangeReturn player_live_set_state(PlayerData * data, GstState state);
+void player_live_state_changed(PlayerData * data, GstState new_state);
+void player_live_reset(PlayerData * data);
+void player_live_free(PlayerData * data);
+
+/* player-resume.c */
+void player_resume_load(PlayerData * data, gboolean seek);
+void player_resume_apply(PlayerData * data);
+void player_resume_save(PlayerData * data, gboolean finished);
+void player_resume_tick(PlayerData * data);
+
+/* player-memory.c */
+void player_memory_element_added(PlayerData * data, GstElement * element,
+				 const gchar * klass);
+void player_memory_reset(PlayerData * data);
+void player_memory_free(PlayerData * data);
+
+/* player-buffering.c */
+gchar *player_buffering_resolve_uri(const gchar * uri);
+void player_buffering_element_added(PlayerData * data, GstBin * parent,
+				    GstElement * element);
+void player_buffering_element_message(PlayerData * data, GstMessage * msg);
+void player_buffering_message(PlayerData * data, GstMessage * msg);
+gboolean player_buffering_play(PlayerData * data);
+void player_buffering_reset(PlayerData * data, gboolean new_item);
+
+/* player-control.c */
+void player_control_free(PlayerData * data);
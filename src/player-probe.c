@@ -0,0 +1,463 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib/gstdio.h>
+#include <gst/pbutils/pbutils.h>
+
+#include "player-json.h"
+#include "player-probe.h"
+#include "player-private.h"
+
+#define PROBE_DEFAULT_TIMEOUT (10 * GST_SECOND)
+
+struct _PlayerProber {
+	GThreadPool *pool;	/* gchar * uris to discover */
+	GstClockTime timeout;
+	PlayerProbeDone done;
+	gpointer user_data;
+	GAsyncQueue *results;	/* PlayerProbeResult * for the main loop */
+	GMutex results_lock;
+	guint results_id;	/* Dispatch idle, 0 when none is queued */
+	gint pending;		/* Added but not reported yet */
+	/* cache, one group per file named after the hash of its path */
+	GMutex cache_lock;
+	GKeyFile *cache;
+	gchar *cache_file;
+	gboolean cache_dirty;
+};
+
+/* One discoverer per worker, kept for the life of the thread */
+static GPrivate discoverer_key = G_PRIVATE_INIT(g_object_unref);
+
+static void result_free(PlayerProbeResult * r)
+{
+	g_free(r->uri);
+	g_free(r->error);
+	g_free(r->container);
+	g_free(r->video_codec);
+	g_free(r->audio_codec);
+	g_free(r);
+}
+
+/******************************************************************************/
+/*                                   Cache                                    */
+/******************************************************************************/
+
+static gchar *cache_group(const gchar * path)
+{
+	return g_compute_checksum_for_string(G_CHECKSUM_MD5, path, -1);
+}
+
+static gchar *cache_string(GKeyFile * kf, const gchar * group,
+			   const gchar * key)
+{
+	return g_key_file_has_key(kf, group, key, NULL) ?
+	    g_key_file_get_string(kf, group, key, NULL) : NULL;
+}
+
+static void cache_set_string(GKeyFile * kf, const gchar * group,
+			     const gchar * key, const gchar * value)
+{
+	if (value)
+		g_key_file_set_string(kf, group, key, value);
+}
+
+/* Worker thread: TRUE and r filled if the file did not change since */
+static gboolean cache_lookup(PlayerProber * prober, const gchar * path,
+			     GStatBuf * st, PlayerProbeResult * r)
+{
+	GKeyFile *kf = prober->cache;
+	gchar *group = cache_group(path);
+	gboolean hit;
+
+	g_mutex_lock(&prober->cache_lock);
+	hit = g_key_file_has_group(kf, group)
+	    && g_key_file_get_uint64(kf, group, "size", NULL) ==
+	    (guint64) st->st_size
+	    && g_key_file_get_int64(kf, group, "mtime", NULL) ==
+	    (gint64) st->st_mtime;
+	if (hit) {
+		r->error = cache_string(kf, group, "error");
+		r->result = r->error ? -1 : 0;
+		r->duration =
+		    g_key_file_get_uint64(kf, group, "duration", NULL);
+		r->seekable =
+		    g_key_file_get_boolean(kf, group, "seekable", NULL);
+		r->container = cache_string(kf, group, "container");
+		r->video_codec = cache_string(kf, group, "video-codec");
+		r->width = g_key_file_get_integer(kf, group, "width", NULL);
+		r->height = g_key_file_get_integer(kf, group, "height", NULL);
+		r->fps_n = g_key_file_get_integer(kf, group, "fps-n", NULL);
+		r->fps_d = g_key_file_get_integer(kf, group, "fps-d", NULL);
+		r->video_bitrate =
+		    g_key_file_get_integer(kf, group, "video-bitrate", NULL);
+		r->audio_codec = cache_string(kf, group, "audio-codec");
+		r->rate = g_key_file_get_integer(kf, group, "rate", NULL);
+		r->channels =
+		    g_key_file_get_integer(kf, group, "channels", NULL);
+		r->audio_bitrate =
+		    g_key_file_get_integer(kf, group, "audio-bitrate", NULL);
+		r->video_streams =
+		    g_key_file_get_integer(kf, group, "video-streams", NULL);
+		r->audio_streams =
+		    g_key_file_get_integer(kf, group, "audio-streams", NULL);
+		r->subtitle_streams =
+		    g_key_file_get_integer(kf, group, "subtitle-streams",
+					   NULL);
+		r->cached = TRUE;
+	}
+	g_mutex_unlock(&prober->cache_lock);
+	g_free(group);
+
+	return hit;
+}
+
+static void cache_store(PlayerProber * prober, const gchar * path,
+			GStatBuf * st, const PlayerProbeResult * r)
+{
+	GKeyFile *kf = prober->cache;
+	gchar *group = cache_group(path);
+
+	g_mutex_lock(&prober->cache_lock);
+	g_key_file_remove_group(kf, group, NULL);
+	g_key_file_set_string(kf, group, "path", path);
+	g_key_file_set_uint64(kf, group, "size", st->st_size);
+	g_key_file_set_int64(kf, group, "mtime", st->st_mtime);
+	cache_set_string(kf, group, "error", r->error);
+	g_key_file_set_uint64(kf, group, "duration", r->duration);
+	g_key_file_set_boolean(kf, group, "seekable", r->seekable);
+	cache_set_string(kf, group, "container", r->container);
+	cache_set_string(kf, group, "video-codec", r->video_codec);
+	g_key_file_set_integer(kf, group, "width", r->width);
+	g_key_file_set_integer(kf, group, "height", r->height);
+	g_key_file_set_integer(kf, group, "fps-n", r->fps_n);
+	g_key_file_set_integer(kf, group, "fps-d", r->fps_d);
+	g_key_file_set_integer(kf, group, "video-bitrate", r->video_bitrate);
+	cache_set_string(kf, group, "audio-codec", r->audio_codec);
+	g_key_file_set_integer(kf, group, "rate", r->rate);
+	g_key_file_set_integer(kf, group, "channels", r->channels);
+	g_key_file_set_integer(kf, group, "audio-bitrate", r->audio_bitrate);
+	g_key_file_set_integer(kf, group, "video-streams", r->video_streams);
+	g_key_file_set_integer(kf, group, "audio-streams", r->audio_streams);
+	g_key_file_set_integer(kf, group, "subtitle-streams",
+			       r->subtitle_streams);
+	prober->cache_dirty = TRUE;
+	g_mutex_unlock(&prober->cache_lock);
+	g_free(group);
+}
+
+/******************************************************************************/
+/*                                  Workers                                   */
+/******************************************************************************/
+
+static gchar *caps_name(GstDiscovererStreamInfo * info)
+{
+	GstCaps *caps = gst_discoverer_stream_info_get_caps(info);
+	gchar *name = NULL;
+
+	if (caps) {
+		if (!gst_caps_is_empty(caps))
+			name =
+			    g_strdup(gst_structure_get_name
+				     (gst_caps_get_structure(caps, 0)));
+		gst_caps_unref(caps);
+	}
+
+	return name;
+}
+
+static const gchar *discoverer_error(GstDiscovererResult result)
+{
+	switch (result) {
+	case GST_DISCOVERER_URI_INVALID:
+		return "invalid uri";
+	case GST_DISCOVERER_TIMEOUT:
+		return "timeout";
+	case GST_DISCOVERER_MISSING_PLUGINS:
+		return "missing plugins";
+	default:
+		return "error";
+	}
+}
+
+static void fill_result(PlayerProbeResult * r, GstDiscovererInfo * info)
+{
+	GstDiscovererStreamInfo *top;
+	GList *streams;
+
+	r->duration = gst_discoverer_info_get_duration(info);
+	r->seekable = gst_discoverer_info_get_seekable(info);
+
+	top = gst_discoverer_info_get_stream_info(info);
+	if (top) {
+		if (GST_IS_DISCOVERER_CONTAINER_INFO(top))
+			r->container = caps_name(top);
+		gst_discoverer_stream_info_unref(top);
+	}
+
+	streams = gst_discoverer_info_get_video_streams(info);
+	r->video_streams = g_list_length(streams);
+	if (streams) {
+		GstDiscovererVideoInfo *video = streams->data;
+
+		r->video_codec = caps_name(streams->data);
+		r->width = gst_discoverer_video_info_get_width(video);
+		r->height = gst_discoverer_video_info_get_height(video);
+		r->fps_n = gst_discoverer_video_info_get_framerate_num(video);
+		r->fps_d = gst_discoverer_video_info_get_framerate_denom(video);
+		r->video_bitrate = gst_discoverer_video_info_get_bitrate(video);
+	}
+	gst_discoverer_stream_info_list_free(streams);
+
+	streams = gst_discoverer_info_get_audio_streams(info);
+	r->audio_streams = g_list_length(streams);
+	if (streams) {
+		GstDiscovererAudioInfo *audio = streams->data;
+
+		r->audio_codec = caps_name(streams->data);
+		r->rate = gst_discoverer_audio_info_get_sample_rate(audio);
+		r->channels = gst_discoverer_audio_info_get_channels(audio);
+		r->audio_bitrate = gst_discoverer_audio_info_get_bitrate(audio);
+	}
+	gst_discoverer_stream_info_list_free(streams);
+
+	streams = gst_discoverer_info_get_subtitle_streams(info);
+	r->subtitle_streams = g_list_length(streams);
+	gst_discoverer_stream_info_list_free(streams);
+}
+
+/* TRUE when the outcome holds as long as the file doesn't change: a timeout
+ * or a missing plugin may not happen next time */
+static gboolean discover(PlayerProber * prober, PlayerProbeResult * r)
+{
+	GstDiscoverer *discoverer = g_private_get(&discoverer_key);
+	GstDiscovererInfo *info;
+	GstDiscovererResult result = GST_DISCOVERER_ERROR;
+	GError *error = NULL;
+
+	if (!discoverer) {
+		discoverer = gst_discoverer_new(prober->timeout, &error);
+		if (!discoverer) {
+			r->result = -1;
+			r->error = g_strdup(error->message);
+			g_clear_error(&error);
+			return FALSE;
+		}
+		g_private_set(&discoverer_key, discoverer);
+	}
+
+	info = gst_discoverer_discover_uri(discoverer, r->uri, &error);
+	if (info)
+		result = gst_discoverer_info_get_result(info);
+	if (result == GST_DISCOVERER_OK) {
+		fill_result(r, info);
+	} else {
+		r->result = -1;
+		r->error = g_strdup(error ? error->message :
+				    discoverer_error(result));
+	}
+	g_clear_error(&error);
+	if (info)
+		gst_discoverer_info_unref(info);
+
+	return info && (result == GST_DISCOVERER_OK
+			|| result == GST_DISCOVERER_URI_INVALID
+			|| result == GST_DISCOVERER_ERROR);
+}
+
+/* Main thread: report what the workers found */
+static gboolean results_dispatch(PlayerProber * prober)
+{
+	PlayerProbeResult *r;
+
+	g_mutex_lock(&prober->results_lock);
+	prober->results_id = 0;
+	g_mutex_unlock(&prober->results_lock);
+
+	while ((r = g_async_queue_try_pop(prober->results))) {
+		if (prober->done)
+			prober->done(r, prober->user_data);
+		result_free(r);
+		g_atomic_int_add(&prober->pending, -1);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static void probe_job(gchar * uri, PlayerProber * prober)
+{
+	PlayerProbeResult *r = g_new0(PlayerProbeResult, 1);
+	gchar *path = g_filename_from_uri(uri, NULL, NULL);
+	GStatBuf st;
+	gboolean local = path && g_stat(path, &st) == 0;
+
+	r->uri = uri;
+	r->duration = GST_CLOCK_TIME_NONE;
+
+	/* Network streams may change behind the same uri: never cached */
+	if (!local || !prober->cache || !cache_lookup(prober, path, &st, r)) {
+		if (discover(prober, r) && local && prober->cache)
+			cache_store(prober, path, &st, r);
+	}
+	DBG("%s%s", uri, r->cached ? " (cached)" : "");
+	g_free(path);
+
+	g_async_queue_push(prober->results, r);
+	g_mutex_lock(&prober->results_lock);
+	if (!prober->results_id)
+		prober->results_id =
+		    g_idle_add((GSourceFunc) results_dispatch, prober);
+	g_mutex_unlock(&prober->results_lock);
+}
+
+/******************************************************************************/
+/*                                    API                                     */
+/******************************************************************************/
+
+PlayerProber *player_prober_new(guint workers, GstClockTime timeout,
+				const gchar * cache_file, PlayerProbeDone done,
+				gpointer user_data)
+{
+	PlayerProber *prober;
+
+	FUNC_ENTER;
+
+	player_init_once();
+	g_mutex_init(&prober->cache_lock);
+	g_mutex_init(&prober->results_lock);
+	prober = g_new0(PlayerProber, 1);
+	prober->timeout = timeout ? timeout : PROBE_DEFAULT_TIMEOUT;
+	prober->done = done;
+	prober->user_data = user_data;
+	prober->results = g_async_queue_new();
+	g_mutex_init(&prober->cache_lock);
+	if (cache_file) {
+		prober->cache_file = g_strdup(cache_file);
+		prober->cache = g_key_file_new();
+		/* Missing or unreadable: start over */
+		g_key_file_load_from_file(prober->cache, cache_file,
+					  G_KEY_FILE_NONE, NULL);
+	}
+
+	/* Exclusive threads: each keeps its discoverer until the end */
+	prober->pool = g_thread_pool_new((GFunc) probe_job, prober,
+					 workers ? workers :
+					 g_get_num_processors(), TRUE, NULL);
+
+	return prober;
+}
+
+void player_prober_add(PlayerProber * prober, const gchar * uri)
+{
+	if (!prober || !uri)
+		return;
+
+	g_atomic_int_inc(&prober->pending);
+	g_thread_pool_push(prober->pool, g_strdup(uri), NULL);
+}
+
+/* Uris added but not reported yet */
+guint player_prober_pending(PlayerProber * prober)
+{
+	return prober ? g_atomic_int_get(&prober->pending) : 0;
+}
+
+/* Appends s as a JSON string, quotes included, or null */
+void player_json_string(GString * json, const gchar * s)
+{
+	if (!s) {
+		g_string_append(json, "null");
+		return;
+	}
+
+	g_string_append_c(json, '"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			g_string_append_printf(json, "\\%c", *s);
+		else if ((guchar) * s < 0x20)
+			g_string_append_printf(json, "\\u%04x", *s);
+		else
+			g_string_append_c(json, *s);
+	}
+	g_string_append_c(json, '"');
+}
+
+/* One line of JSON, without the newline. Free with g_free(). */
+gchar *player_probe_result_to_json(const PlayerProbeResult * r)
+{
+	GString *json = g_string_new("{\"uri\":");
+
+	player_json_string(json, r->uri);
+	g_string_append_printf(json, ",\"ok\":%s,\"cached\":%s",
+			       r->result == 0 ? "true" : "false",
+			       r->cached ? "true" : "false");
+	if (r->result < 0) {
+		g_string_append(json, ",\"error\":");
+		player_json_string(json, r->error);
+		g_string_append_c(json, '}');
+		return g_string_free(json, FALSE);
+	}
+
+	g_string_append_printf(json, ",\"duration_ms\":%.0f,\"seekable\":%s",
+			       GST_CLOCK_TIME_IS_VALID(r->duration) ?
+			       r->duration / 1e6 : -1.0,
+			       r->seekable ? "true" : "false");
+	g_string_append(json, ",\"container\":");
+	player_json_string(json, r->container);
+	if (r->video_codec) {
+		g_string_append(json, ",\"video\":{\"codec\":");
+		player_json_string(json, r->video_codec);
+		g_string_append_printf(json, ",\"width\":%d,\"height\":%d"
+				       ",\"fps\":%.3f,\"bitrate\":%u}",
+				       r->width, r->height,
+				       r->fps_d ? (gdouble) r->fps_n /
+				       r->fps_d : 0.0, r->video_bitrate);
+	}
+	if (r->audio_codec) {
+		g_string_append(json, ",\"audio\":{\"codec\":");
+		player_json_string(json, r->audio_codec);
+		g_string_append_printf(json, ",\"rate\":%d,\"channels\":%d"
+				       ",\"bitrate\":%u}", r->rate,
+				       r->channels, r->audio_bitrate);
+	}
+	g_string_append_printf(json, ",\"streams\":{\"video\":%u,\"audio\":%u"
+			       ",\"subtitle\":%u}}", r->video_streams,
+			       r->audio_streams, r->subtitle_streams);
+
+	return g_string_free(json, FALSE);
+}
+
+/* Uris still queued are discovered first, their results are not reported */
+void player_prober_free(PlayerProber * prober)
+{
+	PlayerProbeResult *r;
+	GError *error = NULL;
+
+	FUNC_ENTER;
+
+	if (!prober)
+		return;
+
+	g_thread_pool_free(prober->pool, FALSE, TRUE);
+	if (prober->results_id)
+		g_source_remove(prober->results_id);
+	while ((r = g_async_queue_try_pop(prober->results)))
+		result_free(r);
+	g_async_queue_unref(prober->results);
+
+	if (prober->cache) {
+		if (prober->cache_dirty
+		    && !g_key_file_save_to_file(prober->cache,
+						prober->cache_file, &error)) {
+			g_printerr("Could not save %s: %s\n",
+				   prober->cache_file, error->message);
+			g_clear_error(&error);
+		}
+		g_key_file_free(prober->cache);
+		g_free(prober->cache_file);
+	}
+	g_mutex_clear(&prober->cache_lock);
+	g_mutex_clear(&prober->results_lock);
+	g_free(prober);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <gst/gst.h>
+
+/* Batch media discovery, without a player. A bounded pool of worker threads
+ * each owns a discoverer, results come back in the main loop in completion
+ * order. Local files are looked up first in an optional cache keyed by path,
+ * size and modification time. Timeouts and missing plugins are not cached,
+ * the next probe tries again. */
+typedef struct _PlayerProber PlayerProber;
+
+typedef struct _PlayerProbeResult {
+	gchar *uri;
+	gint result;		/* 0, or -1 with error set */
+	gchar *error;
+	gboolean cached;	/* Served from the cache, not discovered */
+	GstClockTime duration;
+	gboolean seekable;
+	gchar *container;	/* Media types, NULL when absent */
+	gchar *video_codec;
+	gint width, height;
+	gint fps_n, fps_d;
+	guint video_bitrate;
+	gchar *audio_codec;
+	gint rate, channels;
+	guint audio_bitrate;
+	guint video_streams, audio_streams, subtitle_streams;
+} PlayerProbeResult;
+
+typedef void (*PlayerProbeDone) (const PlayerProbeResult * result,
+				 gpointer user_data);
+
+/* workers of 0 uses one per core, cache_file may be NULL */
+PlayerProber *player_prober_new(guint workers, GstClockTime timeout,
+				const gchar * cache_file, PlayerProbeDone done,
+				gpointer user_data);
+void player_prober_add(PlayerProber * prober, const gchar * uri);
+guint player_prober_pending(PlayerProber * prober);
+gchar *player_probe_result_to_json(const PlayerProbeResult * result);
+/* Waits for the workers and writes the cache back */
+void player_prober_free(PlayerProber * prober);
@@ -0,0 +1,583 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Records reach the disk in batches, at most this often */
+#define RESUME_BATCH_INTERVAL (2 * G_TIME_SPAN_SECOND)
+/* While playing, the position is saved this often */
+#define RESUME_SAVE_INTERVAL (10 * G_TIME_SPAN_SECOND)
+/* So close to the end, the next open starts over */
+#define RESUME_END_MARGIN (5 * GST_SECOND)
+/* Rewrite the log when it holds twice as many records as entries */
+#define RESUME_COMPACT_MIN 1024
+#define KEY_LENGTH 32
+
+/* Resume store. One line per record appended to a log file, keyed by the
+ * md5 of uri, size and mtime, so a modified file starts over. The last
+ * record of a key wins. The index maps each key to the offset and length
+ * of its last record: a lookup is one hash lookup and one pread, whatever
+ * the number of entries. Players only queue records, a writer thread
+ * appends them in one write per batch and updates the index. Other
+ * processes may append to the same log: writes hold an flock() and take
+ * their offset from the end of the file, and a record read back must carry
+ * the key looked up. The log is compacted when opened, only by a process
+ * that has it to itself: each process holds a shared flock() on a sidecar
+ * lock file while the store is open, and compacting takes it exclusive.
+ * Line format, tab separated:
+ * key position duration audio text escaped-summary */
+
+typedef struct _IndexEntry {
+	gint64 offset;
+	guint length;
+} IndexEntry;
+
+static GMutex store_lock;
+static GCond store_cond;
+static gchar *store_path;
+static gint store_fd = -1;	/* Appends, writer thread only */
+static gint store_read_fd = -1;	/* Lookups, under the lock */
+static gint store_lock_fd = -1;	/* Sidecar, shared while open */
+static gint64 store_size;
+static guint64 store_records;	/* Lines in the log */
+static GHashTable *store_index;	/* key -> IndexEntry */
+static GHashTable *store_pending;	/* key -> line, queued */
+static GHashTable *store_writing;	/* key -> line, being written */
+static GThread *store_writer;
+static gboolean store_quit;
+static PlayerResumeStats store_stats;
+
+static gchar *resume_key(const gchar * uri)
+{
+	GStatBuf st = { 0 };
+	gchar *path, *str, *key;
+
+	path = g_str_has_prefix(uri, "file://") ?
+	    g_filename_from_uri(uri, NULL, NULL) : NULL;
+	if (!path || g_stat(path, &st) < 0)
+		memset(&st, 0, sizeof(st));
+	g_free(path);
+
+	str = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT,
+			      uri, (gint64) st.st_size, (gint64) st.st_mtime);
+	key = g_compute_checksum_for_string(G_CHECKSUM_MD5, str, -1);
+	g_free(str);
+
+	return key;
+}
+
+static gchar *format_line(const gchar * key, const PlayerResumeInfo * info)
+{
+	gchar *summary = g_strescape(info->summary ? info->summary : "", NULL);
+	gchar *line;
+
+	line = g_strdup_printf("%s\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT
+			       "\t%d\t%d\t%s\n", key, info->position,
+			       info->duration, info->audio, info->text,
+			       summary);
+	g_free(summary);
+
+	return line;
+}
+
+/* FALSE when the line is not a record of key */
+static gboolean parse_line(const gchar * key, const gchar * line,
+			   gsize length, PlayerResumeInfo * info)
+{
+	gchar *copy = g_strndup(line, length);
+	gchar **fields;
+	gboolean ok;
+
+	g_strchomp(copy);
+	fields = g_strsplit(copy, "\t", 6);
+	ok = g_strv_length(fields) == 6 && !g_strcmp0(fields[0], key);
+	if (ok) {
+		info->position = g_ascii_strtoull(fields[1], NULL, 10);
+		info->duration = g_ascii_strtoull(fields[2], NULL, 10);
+		info->audio = atoi(fields[3]);
+		info->text = atoi(fields[4]);
+		info->summary = g_strcompress(fields[5]);
+	}
+	g_strfreev(fields);
+	g_free(copy);
+
+	return ok;
+}
+
+/******************************************************************************/
+/*                                   Writer                                   */
+/******************************************************************************/
+
+static void write_batch(GHashTable * batch)
+{
+	GHashTableIter iter;
+	gpointer key, line;
+	GString *buf = g_string_new(NULL);
+	GArray *offsets = g_array_new(FALSE, FALSE, sizeof(gint64));
+	gssize written = 0;
+	gint64 base;
+	guint i = 0;
+
+	/* Same iteration order twice, the table doesn't change meanwhile */
+	g_hash_table_iter_init(&iter, batch);
+	while (g_hash_table_iter_next(&iter, &key, &line)) {
+		gint64 offset = buf->len;
+
+		g_array_append_val(offsets, offset);
+		g_string_append(buf, line);
+	}
+
+	/* Other processes append too: where we write is only known under
+	 * the lock */
+	while (flock(store_fd, LOCK_EX) < 0 && errno == EINTR) ;
+	base = lseek(store_fd, 0, SEEK_END);
+	while (base >= 0 && written < (gssize) buf->len) {
+		gssize n = write(store_fd, buf->str + written,
+				 buf->len - written);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			g_printerr("Could not write %s: %s\n", store_path,
+				   g_strerror(errno));
+			break;
+		}
+		written += n;
+	}
+	/* Don't leave a partial line for the next record to follow */
+	if (base >= 0 && written && written < (gssize) buf->len
+	    && ftruncate(store_fd, base) < 0)
+		g_printerr("Could not truncate %s\n", store_path);
+	flock(store_fd, LOCK_UN);
+
+	g_mutex_lock(&store_lock);
+	if (base >= 0 && written == (gssize) buf->len) {
+		g_hash_table_iter_init(&iter, batch);
+		while (g_hash_table_iter_next(&iter, &key, &line)) {
+			IndexEntry *entry = g_new(IndexEntry, 1);
+
+			entry->offset = base +
+			    g_array_index(offsets, gint64, i++);
+			entry->length = strlen(line);
+			g_hash_table_replace(store_index, g_strdup(key), entry);
+		}
+		store_size = base + buf->len;
+		store_records += g_hash_table_size(batch);
+		store_stats.records_written += g_hash_table_size(batch);
+		store_stats.batches++;
+	}
+	store_writing = NULL;
+	g_mutex_unlock(&store_lock);
+
+	g_array_free(offsets, TRUE);
+	g_string_free(buf, TRUE);
+}
+
+static gpointer writer_thread(gpointer unused)
+{
+	GHashTable *batch;
+	gint64 deadline;
+	gboolean quit;
+
+	g_mutex_lock(&store_lock);
+	for (;;) {
+		while (!store_quit && !g_hash_table_size(store_pending))
+			g_cond_wait(&store_cond, &store_lock);
+
+		/* Let more records join the batch */
+		deadline = g_get_monotonic_time() + RESUME_BATCH_INTERVAL;
+		while (!store_quit
+		       && g_cond_wait_until(&store_cond, &store_lock, deadline));
+
+		quit = store_quit;
+		if (g_hash_table_size(store_pending)) {
+			batch = store_pending;
+			store_pending = g_hash_table_new_full(g_str_hash,
+							      g_str_equal,
+							      g_free, g_free);
+			store_writing = batch;
+			g_mutex_unlock(&store_lock);
+			write_batch(batch);
+			g_hash_table_unref(batch);
+			g_mutex_lock(&store_lock);
+		}
+		if (quit)
+			break;
+	}
+	g_mutex_unlock(&store_lock);
+
+	return NULL;
+}
+
+/******************************************************************************/
+/*                                    Store                                   */
+/******************************************************************************/
+
+/* Index every complete line of the log, last record of a key wins.
+ * Returns the size of the complete part. */
+static gint64 load_index(const gchar * contents, gsize length)
+{
+	const gchar *line = contents, *end;
+	IndexEntry *entry;
+
+	while (line < contents + length
+	       && (end = memchr(line, '\n', contents + length - line))) {
+		if (end - line > KEY_LENGTH && line[KEY_LENGTH] == '\t') {
+			entry = g_new(IndexEntry, 1);
+			entry->offset = line - contents;
+			entry->length = end - line + 1;
+			g_hash_table_replace(store_index,
+					     g_strndup(line, KEY_LENGTH),
+					     entry);
+			store_records++;
+		}
+		line = end + 1;
+	}
+
+	return line - contents;
+}
+
+/* Keep the last record of each key only, in a new file renamed over.
+ * Only while no other process has the log open. */
+static void compact(const gchar * contents)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *buf = g_string_new(NULL);
+	gchar *tmp = g_strconcat(store_path, ".tmp", NULL);
+
+	g_hash_table_iter_init(&iter, store_index);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		IndexEntry *entry = value;
+
+		g_string_append_len(buf, contents + entry->offset,
+				    entry->length);
+	}
+
+	if (!g_file_set_contents(tmp, buf->str, buf->len, NULL)
+	    || g_rename(tmp, store_path) < 0) {
+		/* The old log is still there, and still indexed */
+		g_printerr("Could not compact %s\n", store_path);
+		g_unlink(tmp);
+		g_free(tmp);
+		g_string_free(buf, TRUE);
+		return;
+	}
+
+	/* Same order as above, the table didn't change */
+	store_size = 0;
+	g_hash_table_iter_init(&iter, store_index);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		IndexEntry *entry = value;
+
+		entry->offset = store_size;
+		store_size += entry->length;
+	}
+	DBG("compacted %" G_GUINT64_FORMAT " records into %u",
+	    store_records, g_hash_table_size(store_index));
+	store_records = g_hash_table_size(store_index);
+	g_free(tmp);
+	g_string_free(buf, TRUE);
+}
+
+static void store_close(void)
+{
+	if (store_writer) {
+		g_mutex_lock(&store_lock);
+		store_quit = TRUE;
+		g_cond_signal(&store_cond);
+		g_mutex_unlock(&store_lock);
+		/* The writer flushes what is queued before leaving */
+		g_thread_join(store_writer);
+		store_writer = NULL;
+	}
+	g_mutex_lock(&store_lock);
+	if (store_fd >= 0)
+		close(store_fd);
+	if (store_read_fd >= 0)
+		close(store_read_fd);
+	/* Other processes may compact again */
+	if (store_lock_fd >= 0)
+		close(store_lock_fd);
+	store_fd = store_read_fd = store_lock_fd = -1;
+	g_clear_pointer(&store_index, g_hash_table_unref);
+	g_clear_pointer(&store_pending, g_hash_table_unref);
+	g_clear_pointer(&store_path, g_free);
+	store_size = 0;
+	store_records = 0;
+	store_quit = FALSE;
+	g_mutex_unlock(&store_lock);
+}
+
+/* Open the store at path, created if needed, or close it with NULL. Every
+ * player of the process shares it. */
+gint player_resume_configure(const gchar * path)
+{
+	GMappedFile *mapped = NULL;
+	const gchar *contents = "";
+	gsize length = 0;
+	gchar *dir, *lock_path;
+	gint64 complete;
+	gboolean alone;
+
+	FUNC_ENTER;
+
+	store_close();
+	if (!path)
+		return 0;
+
+	dir = g_path_get_dirname(path);
+	g_mkdir_with_parents(dir, 0700);
+	g_free(dir);
+
+	store_path = g_strdup(path);
+	memset(&store_stats, 0, sizeof(store_stats));
+	store_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					    g_free);
+	store_pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					      g_free);
+
+	/* Processes that have the log open append to its inode, which a
+	 * compaction renames away: only compact when nobody else has it open.
+	 * Those opening it meanwhile wait for the shared lock. */
+	lock_path = g_strconcat(path, ".lock", NULL);
+	store_lock_fd = g_open(lock_path, O_RDWR | O_CREAT, 0600);
+	g_free(lock_path);
+	if (store_lock_fd < 0) {
+		g_printerr("Could not open %s.lock: %s\n", path,
+			   g_strerror(errno));
+		store_close();
+		return -1;
+	}
+	alone = flock(store_lock_fd, LOCK_EX | LOCK_NB) == 0;
+	if (!alone)
+		while (flock(store_lock_fd, LOCK_SH) < 0 && errno == EINTR) ;
+
+	if (g_file_test(path, G_FILE_TEST_EXISTS)
+	    && !(mapped = g_mapped_file_new(path, FALSE, NULL))) {
+		g_printerr("Could not read %s\n", path);
+		store_close();
+		return -1;
+	}
+	if (mapped && g_mapped_file_get_length(mapped)) {
+		contents = g_mapped_file_get_contents(mapped);
+		length = g_mapped_file_get_length(mapped);
+	}
+
+	store_size = complete = load_index(contents, length);
+	if (alone && store_records >= RESUME_COMPACT_MIN
+	    && store_records > 2 * g_hash_table_size(store_index))
+		compact(contents);
+	if (mapped)
+		g_mapped_file_unref(mapped);
+
+	/* After the compaction, so that we write to the new log */
+	store_fd = g_open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	store_read_fd = g_open(path, O_RDONLY, 0);
+	if (alone)
+		flock(store_lock_fd, LOCK_SH);
+	if (store_fd < 0 || store_read_fd < 0) {
+		g_printerr("Could not open %s: %s\n", path, g_strerror(errno));
+		store_close();
+		return -1;
+	}
+	/* A crash in the middle of a write leaves a partial line. Unless the
+	 * log grew since we read it: another process was writing it. */
+	if (store_size == complete && complete < (gint64) length) {
+		struct stat st;
+
+		while (flock(store_fd, LOCK_EX) < 0 && errno == EINTR) ;
+		if (fstat(store_fd, &st) == 0 && st.st_size == (off_t) length
+		    && ftruncate(store_fd, complete) < 0)
+			g_printerr("Could not truncate %s\n", path);
+		flock(store_fd, LOCK_UN);
+	}
+
+	store_writer = g_thread_new("resume-writer", writer_thread, NULL);
+	return 0;
+}
+
+/* Any thread. O(1): the queued record if any, else one read */
+gboolean player_resume_lookup(const gchar * uri, PlayerResumeInfo * info)
+{
+	IndexEntry *entry;
+	const gchar *line = NULL;
+	gchar *key, *buf = NULL;
+	gboolean ok = FALSE;
+
+	if (!uri || !info)
+		return FALSE;
+	memset(info, 0, sizeof(*info));
+
+	key = resume_key(uri);
+	g_mutex_lock(&store_lock);
+	if (store_pending) {
+		if (!(line = g_hash_table_lookup(store_pending, key))
+		    && store_writing)
+			line = g_hash_table_lookup(store_writing, key);
+		if (line) {
+			ok = parse_line(key, line, strlen(line), info);
+		} else if ((entry = g_hash_table_lookup(store_index, key))) {
+			buf = g_malloc(entry->length);
+			ok = pread(store_read_fd, buf, entry->length,
+				   entry->offset) == (gssize) entry->length
+			    && parse_line(key, buf, entry->length, info);
+		}
+		store_stats.lookups++;
+	}
+	g_mutex_unlock(&store_lock);
+
+	g_free(buf);
+	g_free(key);
+
+	return ok;
+}
+
+/* Any thread, doesn't touch the disk: queued for the writer */
+void player_resume_store(const gchar * uri, const PlayerResumeInfo * info)
+{
+	gchar *key;
+
+	if (!uri || !info)
+		return;
+
+	key = resume_key(uri);
+	g_mutex_lock(&store_lock);
+	if (store_pending) {
+		g_hash_table_replace(store_pending, key,
+				     format_line(key, info));
+		g_cond_signal(&store_cond);
+		key = NULL;
+	}
+	g_mutex_unlock(&store_lock);
+	g_free(key);
+}
+
+void player_resume_info_clear(PlayerResumeInfo * info)
+{
+	if (info)
+		g_clear_pointer(&info->summary, g_free);
+}
+
+void player_resume_get_stats(PlayerResumeStats * stats)
+{
+	if (!stats)
+		return;
+
+	g_mutex_lock(&store_lock);
+	*stats = store_stats;
+	stats->entries = store_index ? g_hash_table_size(store_index) : 0;
+	stats->log_bytes = store_size;
+	g_mutex_unlock(&store_lock);
+}
+
+/******************************************************************************/
+/*                                   Player                                   */
+/******************************************************************************/
+
+/* The uri was just set: what we know shows right away, without waiting for
+ * a duration query or tags. seek is FALSE after a gapless switch, which
+ * must not be interrupted. */
+void player_resume_load(PlayerData * data, gboolean seek)
+{
+	PlayerResumeInfo info;
+
+	data->resume_position = GST_CLOCK_TIME_NONE;
+	data->resume_audio = data->resume_text = -1;
+	data->resume_saved = g_get_monotonic_time();
+	if (!data->uri || !player_resume_lookup(data->uri, &info))
+		return;
+
+	DBG("%s at %" GST_TIME_FORMAT, data->uri,
+	    GST_TIME_ARGS(info.position));
+	if (GST_CLOCK_TIME_IS_VALID(info.duration)) {
+		data->duration = info.duration;
+		if (data->slider)
+			gtk_range_set_range(GTK_RANGE(data->slider), 0,
+					    (gdouble) info.duration /
+					    GST_SECOND);
+	}
+	if (info.summary && info.summary[0])
+		player_streams_restore_text(data, info.summary);
+	if (seek) {
+		data->resume_position = info.position;
+		data->resume_audio = info.audio;
+		data->resume_text = info.text;
+	}
+	player_resume_info_clear(&info);
+}
+
+/* Main thread, prerolled: back where we were, with the same streams */
+void player_resume_apply(PlayerData * data)
+{
+	GstClockTime position = data->resume_position;
+	gint n = 0;
+
+	data->resume_position = GST_CLOCK_TIME_NONE;
+	if (player_is_live(data))
+		return;
+
+	if (data->resume_audio >= 0) {
+		g_object_get(data->playbin, "n-audio", &n, NULL);
+		if (data->resume_audio < n)
+			g_object_set(data->playbin, "current-audio",
+				     data->resume_audio, NULL);
+	}
+	if (data->resume_text >= 0)
+		player_set_text_stream(data, data->resume_text);
+	data->resume_audio = data->resume_text = -1;
+
+	if (GST_CLOCK_TIME_IS_VALID(position) && position > 0)
+		player_seek_at_rate(data, position, data->rate,
+				    GST_SEEK_FLAG_FLUSH |
+				    GST_SEEK_FLAG_ACCURATE);
+}
+
+/* Queue the state of the current item. finished starts it over next
+ * time. Without a position, nothing is saved. */
+void player_resume_save(PlayerData * data, gboolean finished)
+{
+	PlayerResumeInfo info = { 0 };
+	gint64 position = 0;
+	guint flags = 0;
+
+	if (!data->uri || !store_writer || player_is_live(data))
+		return;
+	if (!finished
+	    && !gst_element_query_position(data->playbin, GST_FORMAT_TIME,
+					   &position))
+		return;
+
+	info.duration = data->duration;
+	info.position = position;
+	if (GST_CLOCK_TIME_IS_VALID(info.duration)
+	    && info.position + RESUME_END_MARGIN >= info.duration)
+		info.position = 0;
+	g_object_get(data->playbin, "current-audio", &info.audio,
+		     "current-text", &info.text, "flags", &flags, NULL);
+	/* No text stream shown at all */
+	if (!(flags & PLAY_FLAG_TEXT))
+		info.text = -1;
+	info.summary = player_streams_dup_text(data);
+
+	player_resume_store(data->uri, &info);
+	player_resume_info_clear(&info);
+	data->resume_saved = g_get_monotonic_time();
+}
+
+/* Position updates, main thread: save now and then while playing */
+void player_resume_tick(PlayerData * data)
+{
+	if (store_writer && g_get_monotonic_time() - data->resume_saved >=
+	    RESUME_SAVE_INTERVAL)
+		player_resume_save(data, FALSE);
+}
@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gst/video/video.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Frame grabs. The main thread only takes a reference on the last sample of
+ * the video sink, conversion and encoding run in a thread pool and the
+ * result comes back to the main loop. */
+
+typedef struct _SnapshotJob {
+	PlayerData *data;
+	GstSample *sample;
+	gchar *path;
+	const gchar *type;	/* gdk-pixbuf image type */
+	gint width, height;
+	PlayerSnapshotDone done;
+	gpointer user_data;
+	gint result;
+	GstClockTime request;
+} SnapshotJob;
+
+struct _PlayerSnapshots {
+	GThreadPool *pool;
+	GAsyncQueue *done;	/* SnapshotJob * encoded or failed */
+	GMutex done_lock;
+	guint done_id;		/* Idle reporting them, 0 when none */
+};
+
+static void job_free(SnapshotJob * job)
+{
+	gst_sample_unref(job->sample);
+	g_free(job->path);
+	g_free(job);
+}
+
+/* Convert to RGB at width x height, 0 for either keeps the display aspect
+ * ratio, 0 for both keeps the frame size. Any thread. */
+GdkPixbuf *player_sample_to_pixbuf(GstSample * sample, gint width,
+				   gint height)
+{
+	GstVideoInfo in, out;
+	GstVideoFrame src, dst;
+	GstVideoConverter *convert;
+	GdkPixbuf *pixbuf;
+
+	if (!gst_video_info_from_caps(&in, gst_sample_get_caps(sample)))
+		return NULL;
+
+	if (!width && !height) {
+		width = in.width;
+		height = in.height;
+	} else if (!width) {
+		width = gst_util_uint64_scale_int(height, in.width * in.par_n,
+						  in.height * in.par_d);
+	} else if (!height) {
+		height = gst_util_uint64_scale_int(width, in.height * in.par_d,
+						   in.width * in.par_n);
+	}
+	if (width <= 0 || height <= 0)
+		return NULL;
+
+	if (!gst_video_frame_map(&src, &in, gst_sample_get_buffer(sample),
+				 GST_MAP_READ))
+		return NULL;
+
+	pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+	gst_video_info_set_format(&out, GST_VIDEO_FORMAT_RGB, width, height);
+	out.stride[0] = gdk_pixbuf_get_rowstride(pixbuf);
+	memset(&dst, 0, sizeof(dst));
+	dst.info = out;
+	dst.data[0] = gdk_pixbuf_get_pixels(pixbuf);
+
+	/* Scales and converts in one pass, with the orc/SIMD paths */
+	convert = gst_video_converter_new(&in, &out, NULL);
+	gst_video_converter_frame(convert, &src, &dst);
+	gst_video_converter_free(convert);
+	gst_video_frame_unmap(&src);
+
+	return pixbuf;
+}
+
+/* Main thread: report finished grabs */
+static gboolean done_idle_cb(struct _PlayerSnapshots *s)
+{
+	SnapshotJob *job;
+
+	g_mutex_lock(&s->done_lock);
+	s->done_id = 0;
+	g_mutex_unlock(&s->done_lock);
+
+	while ((job = g_async_queue_try_pop(s->done))) {
+		if (job->done)
+			job->done(job->data, job->path, job->result,
+				  job->user_data);
+		job_free(job);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Pool thread */
+static void encode_job(SnapshotJob * job, struct _PlayerSnapshots *s)
+{
+	PlayerRenderStats *stats = &job->data->render_stats;
+	GError *error = NULL;
+	GdkPixbuf *pixbuf;
+	GstClockTime latency;
+
+	pixbuf = player_sample_to_pixbuf(job->sample, job->width, job->height);
+	if (!pixbuf) {
+		job->result = -1;
+	} else if (!gdk_pixbuf_save(pixbuf, job->path, job->type, &error,
+				    NULL)) {
+		g_printerr("Could not save %s: %s\n", job->path,
+			   error->message);
+		g_clear_error(&error);
+		job->result = -1;
+	}
+	g_clear_object(&pixbuf);
+
+	if (job->result == 0) {
+		latency = gst_util_get_timestamp() - job->request;
+		g_mutex_lock(&job->data->stats_lock);
+		stats->snapshots++;
+		stats->snapshot_latency =
+		    (stats->snapshot_latency * (stats->snapshots - 1) +
+		     latency) / stats->snapshots;
+		g_mutex_unlock(&job->data->stats_lock);
+	}
+
+	g_async_queue_push(s->done, job);
+	g_mutex_lock(&s->done_lock);
+	if (!s->done_id)
+		s->done_id = g_idle_add((GSourceFunc) done_idle_cb, s);
+	g_mutex_unlock(&s->done_lock);
+}
+
+static const gchar *image_type(const gchar * path)
+{
+	const gchar *ext = strrchr(path, '.');
+
+	if (!ext)
+		return NULL;
+	if (!g_ascii_strcasecmp(ext, ".png"))
+		return "png";
+	if (!g_ascii_strcasecmp(ext, ".jpg")
+	    || !g_ascii_strcasecmp(ext, ".jpeg"))
+		return "jpeg";
+	return NULL;
+}
+
+/* Save the frame on screen to path, PNG or JPEG from its extension, scaled
+ * like player_sample_to_pixbuf(). Returns at once, done is called from the
+ * main loop with the result of the encode. Main thread only. */
+gint player_snapshot(PlayerData * data, const gchar * path, gint width,
+		     gint height, PlayerSnapshotDone done, gpointer user_data)
+{
+	struct _PlayerSnapshots *s;
+	SnapshotJob *job;
+	GstSample *sample = NULL;
+	const gchar *type;
+
+	FUNC_ENTER;
+
+	if (!data || !path || width < 0 || height < 0
+	    || !(type = image_type(path)))
+		return -EINVAL;
+
+	g_object_get(data->playbin, "sample", &sample, NULL);
+	if (!sample) {
+		DBG("no frame to grab");
+		return -1;
+	}
+
+	if (!(s = data->snapshots)) {
+		s = g_new0(struct _PlayerSnapshots, 1);
+		s->done = g_async_queue_new();
+		g_mutex_init(&s->done_lock);
+		s->pool =
+		    g_thread_pool_new((GFunc) encode_job, s, 1, FALSE, NULL);
+		data->snapshots = s;
+	}
+
+	job = g_new0(SnapshotJob, 1);
+	job->data = data;
+	job->sample = sample;
+	job->path = g_strdup(path);
+	job->type = type;
+	job->width = width;
+	job->height = height;
+	job->done = done;
+	job->user_data = user_data;
+	job->request = gst_util_get_timestamp();
+	g_thread_pool_push(s->pool, job, NULL);
+
+	return 0;
+}
+
+/* Grabs already requested are still written, but not reported */
+void player_snapshot_free(PlayerData * data)
+{
+	struct _PlayerSnapshots *s = data->snapshots;
+	SnapshotJob *job;
+
+	if (!s)
+		return;
+
+	g_thread_pool_free(s->pool, FALSE, TRUE);
+	if (s->done_id)
+		g_source_remove(s->done_id);
+	while ((job = g_async_queue_try_pop(s->done)))
+		job_free(job);
+	g_async_queue_unref(s->done);
+	g_mutex_clear(&s->done_lock);
+	g_free(s);
+	data->snapshots = NULL;
+}
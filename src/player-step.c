@@ -0,0 +1,515 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gst/video/videooverlay.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Frame stepping. Forward steps ask the video sink for the next frame with a
+ * STEP event. Backward steps are served from a cache of the last frames that
+ * reached the sink while paused, copied so that the decoder pools are not
+ * starved, and drawn by us over the video. Once the cache is exhausted we
+ * seek back a window of frames and step through it up to where we were,
+ * which fills the cache again for the next backward steps. */
+
+/* Frames a refill decodes at most, besides the ones asked for */
+#define REFILL_FRAMES 32
+
+typedef enum {
+	REFILL_NONE,
+	REFILL_SEEK,		/* Waiting for the seek to land */
+	REFILL_STEP,		/* Waiting for the step back up to be done */
+} Refill;
+
+struct _PlayerStepCache {
+	GMutex lock;
+	GQueue frames;		/* GstSample, oldest first */
+	gsize bytes;
+	gsize max_bytes;
+	guint back;		/* Frames shown before the newest, 0 when live */
+	GdkPixbuf *pixbuf;	/* Frame drawn while back > 0 */
+	GstClockTime request;	/* Pending cached step measurement */
+	gboolean forward;
+	gboolean decoded;	/* The pending step needed a refill */
+	gsize frame_bytes;	/* Size of the last frame, sizes refills */
+	Refill refill;
+	guint refill_frames;	/* Frames to step once the seek landed */
+	guint refill_back;	/* Frame to show once stepped */
+};
+
+static void cache_clear_locked(struct _PlayerStepCache *cache)
+{
+	GstSample *sample;
+
+	while ((sample = g_queue_pop_head(&cache->frames)))
+		gst_sample_unref(sample);
+	cache->bytes = 0;
+	cache->back = 0;
+	g_clear_object(&cache->pixbuf);
+}
+
+/* Frames kept are limited by memory, not by count */
+static void cache_trim_locked(struct _PlayerStepCache *cache)
+{
+	while (cache->bytes > cache->max_bytes && cache->frames.length > 1) {
+		GstSample *oldest = g_queue_pop_head(&cache->frames);
+
+		cache->bytes -= gst_buffer_get_size(gst_sample_get_buffer(oldest));
+		gst_sample_unref(oldest);
+		if (cache->back >= cache->frames.length)
+			cache->back = cache->frames.length - 1;
+	}
+}
+
+/* From the render probe, in the streaming thread */
+void player_step_record(PlayerData * data, GstPad * pad, GstBuffer * buffer)
+{
+	struct _PlayerStepCache *cache = data->step;
+	GstBuffer *copy;
+	GstCaps *caps;
+
+	if (!cache)
+		return;
+
+	/* Copying every frame played through would cost more than backward
+	 * steps gain, refills cover them. What was kept before is not
+	 * contiguous with the frames that follow anymore. */
+	if (GST_STATE(GST_PAD_PARENT(pad)) == GST_STATE_PLAYING) {
+		g_mutex_lock(&cache->lock);
+		if (cache->frames.length)
+			cache_clear_locked(cache);
+		g_mutex_unlock(&cache->lock);
+		return;
+	}
+
+	caps = gst_pad_get_current_caps(pad);
+	if (!caps)
+		return;
+	copy = gst_buffer_copy_deep(buffer);
+
+	g_mutex_lock(&cache->lock);
+	/* A live frame: whatever we were showing is over */
+	cache->back = 0;
+	g_clear_object(&cache->pixbuf);
+	g_queue_push_tail(&cache->frames, gst_sample_new(copy, caps, NULL, NULL));
+	cache->frame_bytes = gst_buffer_get_size(copy);
+	cache->bytes += cache->frame_bytes;
+	cache_trim_locked(cache);
+	g_mutex_unlock(&cache->lock);
+
+	gst_buffer_unref(copy);
+	gst_caps_unref(caps);
+}
+
+/* Anything cached is out of date after a seek */
+void player_step_reset(PlayerData * data)
+{
+	struct _PlayerStepCache *cache = data->step;
+
+	if (!cache)
+		return;
+
+	g_mutex_lock(&cache->lock);
+	cache_clear_locked(cache);
+	cache->refill = REFILL_NONE;
+	g_mutex_unlock(&cache->lock);
+}
+
+static void measure_cached_step(PlayerData * data,
+				struct _PlayerStepCache *cache)
+{
+	PlayerRenderStats *stats = &data->render_stats;
+	GstClockTime latency;
+
+	if (!GST_CLOCK_TIME_IS_VALID(cache->request))
+		return;
+
+	latency = gst_util_get_timestamp() - cache->request;
+	cache->request = GST_CLOCK_TIME_NONE;
+
+	g_mutex_lock(&data->stats_lock);
+	if (!cache->decoded)
+		stats->steps_cached++;
+	if (cache->forward) {
+		stats->steps_forward++;
+		stats->step_forward_latency =
+		    (stats->step_forward_latency * (stats->steps_forward - 1) +
+		     latency) / stats->steps_forward;
+	} else {
+		stats->steps_backward++;
+		stats->step_backward_latency =
+		    (stats->step_backward_latency *
+		     (stats->steps_backward - 1) + latency) /
+		    stats->steps_backward;
+	}
+	g_mutex_unlock(&data->stats_lock);
+}
+
+/* Main thread: convert the frame to show and have it drawn */
+static void show_cached_locked(PlayerData * data,
+			       struct _PlayerStepCache *cache)
+{
+	GstSample *sample;
+
+	g_clear_object(&cache->pixbuf);
+	if (cache->back) {
+		sample = g_queue_peek_nth(&cache->frames,
+					  cache->frames.length - 1 -
+					  cache->back);
+		cache->pixbuf = player_sample_to_pixbuf(sample, 0, 0);
+	}
+
+	if (!data->video_window) {
+		/* Nothing draws in headless mode, the frame is ready */
+		measure_cached_step(data, cache);
+		return;
+	}
+
+	/* Back to the newest frame: the sink has it, make it draw again */
+	if (!cache->back && data->render_mode == PLAYER_RENDER_OVERLAY)
+		gst_video_overlay_expose(GST_VIDEO_OVERLAY(data->playbin));
+	gtk_widget_queue_draw(data->video_window);
+	if (data->fullscreen_area)
+		gtk_widget_queue_draw(data->fullscreen_area);
+}
+
+/* Called from the draw handlers: TRUE if a cached frame was drawn */
+gboolean player_step_draw(PlayerData * data, GtkWidget * widget, cairo_t * cr)
+{
+	struct _PlayerStepCache *cache = data->step;
+	GtkAllocation allocation;
+	gdouble scale;
+	gint width, height;
+
+	if (!cache)
+		return FALSE;
+
+	g_mutex_lock(&cache->lock);
+	if (!cache->pixbuf) {
+		g_mutex_unlock(&cache->lock);
+		return FALSE;
+	}
+
+	gtk_widget_get_allocation(widget, &allocation);
+	cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_paint(cr);
+
+	/* Keep the aspect ratio, centered like the sinks do */
+	width = gdk_pixbuf_get_width(cache->pixbuf);
+	height = gdk_pixbuf_get_height(cache->pixbuf);
+	scale = MIN((gdouble) allocation.width / width,
+		    (gdouble) allocation.height / height);
+	cairo_translate(cr, (allocation.width - width * scale) / 2,
+			(allocation.height - height * scale) / 2);
+	cairo_scale(cr, scale, scale);
+	gdk_cairo_set_source_pixbuf(cr, cache->pixbuf, 0, 0);
+	cairo_paint(cr);
+
+	measure_cached_step(data, cache);
+	g_mutex_unlock(&cache->lock);
+
+	return TRUE;
+}
+
+/* Frame rate from the caps the sink got, FALSE if unknown */
+static gboolean frame_rate(PlayerData * data, gint * n, gint * d)
+{
+	GstElement *sink = NULL;
+	GstPad *pad;
+	GstCaps *caps = NULL;
+
+	*n = 0;
+	*d = 1;
+	g_object_get(data->playbin, "video-sink", &sink, NULL);
+	if (!sink)
+		return FALSE;
+	pad = gst_element_get_static_pad(sink, "sink");
+	if (pad) {
+		caps = gst_pad_get_current_caps(pad);
+		gst_object_unref(pad);
+	}
+	if (caps) {
+		gst_structure_get_fraction(gst_caps_get_structure(caps, 0),
+					   "framerate", n, d);
+		gst_caps_unref(caps);
+	}
+	gst_object_unref(sink);
+
+	return *n > 0 && *d > 0;
+}
+
+/* Duration of one frame, 0 if unknown */
+static GstClockTime frame_duration(PlayerData * data)
+{
+	gint n, d;
+
+	if (!frame_rate(data, &n, &d))
+		return 0;
+	return gst_util_uint64_scale_int(GST_SECOND, d, n);
+}
+
+static void start_step_measure(PlayerData * data, gboolean forward)
+{
+	g_mutex_lock(&data->stats_lock);
+	data->step_time = gst_util_get_timestamp();
+	data->step_forward = forward;
+	g_mutex_unlock(&data->stats_lock);
+}
+
+static gint step_forward(PlayerData * data, guint frames)
+{
+	GstElement *sink = NULL;
+	gboolean ret;
+
+	g_object_get(data->playbin, "video-sink", &sink, NULL);
+	if (!sink)
+		return -1;
+
+	start_step_measure(data, TRUE);
+	ret = gst_element_send_event(sink,
+				     gst_event_new_step(GST_FORMAT_BUFFERS,
+							frames, 1.0, TRUE,
+							FALSE));
+	gst_object_unref(sink);
+
+	return ret ? 0 : -1;
+}
+
+/* The cache has nothing older: decode again from the keyframe before. With
+ * a cache, seek back a whole window and step up to from, so that the frames
+ * in between are recorded and the next steps are served from the cache. */
+static gint step_backward_seek(PlayerData * data, GstClockTime from,
+			       guint frames)
+{
+	struct _PlayerStepCache *cache = data->step;
+	GstClockTime duration = frame_duration(data);
+	GstClockTime target;
+	guint window = frames;
+	gsize held;
+
+	if (!duration || !GST_CLOCK_TIME_IS_VALID(from))
+		return -1;
+
+	if (cache) {
+		g_mutex_lock(&cache->lock);
+		/* As many as the cache holds, from included */
+		held = cache->frame_bytes ?
+		    cache->max_bytes / cache->frame_bytes : 0;
+		if (held > 1)
+			window = MAX(window, MIN(REFILL_FRAMES, held - 1));
+		g_mutex_unlock(&cache->lock);
+	}
+	window = MIN(window, from / duration);
+	if (!window)
+		return 0;
+
+	target = from - window * duration;
+	DBG("seek back to %" GST_TIME_FORMAT ", %u frames before",
+	    GST_TIME_ARGS(target), window);
+	if (!cache)
+		start_step_measure(data, FALSE);
+
+	if (!player_seek_at_rate(data, target, 1.0,
+				 GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE))
+		return -1;
+	if (!cache)
+		return 0;
+
+	/* The seek cleared the cache, ASYNC_DONE carries on */
+	g_mutex_lock(&cache->lock);
+	cache->refill = REFILL_SEEK;
+	cache->refill_frames = window;
+	cache->refill_back = MIN(frames, window);
+	cache->request = gst_util_get_timestamp();
+	cache->forward = FALSE;
+	cache->decoded = TRUE;
+	g_mutex_unlock(&cache->lock);
+
+	return 0;
+}
+
+/* Main thread, on ASYNC_DONE: the refill seek landed on the oldest frame of
+ * the window, step through the others. Flushing steps skip the rendering
+ * but the render probe still records them. */
+void player_step_async_done(PlayerData * data)
+{
+	struct _PlayerStepCache *cache = data->step;
+	GstElement *sink = NULL;
+	gboolean ret = FALSE;
+	guint frames;
+
+	if (!cache)
+		return;
+
+	g_mutex_lock(&cache->lock);
+	if (cache->refill != REFILL_SEEK) {
+		g_mutex_unlock(&cache->lock);
+		return;
+	}
+	cache->refill = REFILL_STEP;
+	frames = cache->refill_frames;
+	g_mutex_unlock(&cache->lock);
+
+	g_object_get(data->playbin, "video-sink", &sink, NULL);
+	if (sink) {
+		ret = gst_element_send_event(sink,
+					     gst_event_new_step
+					     (GST_FORMAT_BUFFERS, frames, 1.0,
+					      TRUE, FALSE));
+		gst_object_unref(sink);
+	}
+	if (!ret) {
+		g_mutex_lock(&cache->lock);
+		cache->refill = REFILL_NONE;
+		cache->request = GST_CLOCK_TIME_NONE;
+		g_mutex_unlock(&cache->lock);
+	}
+}
+
+/* Main thread, on STEP_DONE: back where we were, show the frame asked for */
+void player_step_done(PlayerData * data)
+{
+	struct _PlayerStepCache *cache = data->step;
+
+	if (!cache)
+		return;
+
+	g_mutex_lock(&cache->lock);
+	if (cache->refill == REFILL_STEP) {
+		cache->refill = REFILL_NONE;
+		cache->back = cache->frames.length ?
+		    MIN(cache->refill_back, cache->frames.length - 1) : 0;
+		show_cached_locked(data, cache);
+	}
+	g_mutex_unlock(&cache->lock);
+}
+
+/* Step by frames, backward when negative. Playback pauses first. */
+gint player_step(PlayerData * data, gint frames)
+{
+	struct _PlayerStepCache *cache;
+	GstClockTime oldest = GST_CLOCK_TIME_NONE;
+	gboolean forward = frames > 0;
+	gint64 position;
+	guint n;
+
+	FUNC_ENTER;
+
+	if (!data || !frames)
+		return -EINVAL;
+
+	if (data->state == GST_STATE_PLAYING) {
+		player_buffering_reset(data, FALSE);
+		gst_element_set_state(data->playbin, GST_STATE_PAUSED);
+		player_sync_controls(data, FALSE);
+	}
+
+	cache = data->step;
+	if (!cache)
+		return frames > 0 ? step_forward(data, frames) :
+		    gst_element_query_position(data->playbin, GST_FORMAT_TIME,
+					       &position) ?
+		    step_backward_seek(data, position, -frames) : -1;
+
+	g_mutex_lock(&cache->lock);
+	if (frames > 0) {
+		/* Walk forward in the cache first, then ask the sink */
+		n = MIN((guint) frames, cache->back);
+		cache->back -= n;
+		frames -= n;
+	} else {
+		n = MIN((guint) - frames,
+			cache->frames.length ? cache->frames.length - 1 -
+			cache->back : 0);
+		cache->back += n;
+		frames += n;
+		if (frames && cache->frames.length)
+			oldest =
+			    GST_BUFFER_PTS(gst_sample_get_buffer
+					   (g_queue_peek_nth
+					    (&cache->frames,
+					     cache->frames.length - 1 -
+					     cache->back)));
+	}
+	if (n) {
+		/* Otherwise the sink answers, measured by the render probe */
+		if (!frames) {
+			cache->request = gst_util_get_timestamp();
+			cache->forward = forward;
+			cache->decoded = FALSE;
+		}
+		show_cached_locked(data, cache);
+	}
+	g_mutex_unlock(&cache->lock);
+
+	if (frames > 0)
+		return step_forward(data, frames);
+	if (frames < 0) {
+		if (!GST_CLOCK_TIME_IS_VALID(oldest)
+		    && gst_element_query_position(data->playbin,
+						  GST_FORMAT_TIME, &position))
+			oldest = position;
+		return step_backward_seek(data, oldest, -frames);
+	}
+	return 0;
+}
+
+/* Accurate seek to a frame number, from the frame rate of the stream */
+gint player_seek_frame(PlayerData * data, guint64 frame)
+{
+	gint n, d;
+
+	if (!data)
+		return -EINVAL;
+
+	if (!frame_rate(data, &n, &d))
+		return -1;
+
+	/* Round up: at 30000/1001 a truncated time falls before the frame */
+	return player_command_seek(data,
+				   gst_util_uint64_scale_ceil(frame,
+							      d * GST_SECOND,
+							      n));
+}
+
+/* Keep up to max_bytes of decoded frames for backward steps, 0 disables */
+void player_set_step_cache(PlayerData * data, gsize max_bytes)
+{
+	struct _PlayerStepCache *cache;
+
+	if (!data)
+		return;
+
+	if (!data->step && max_bytes) {
+		cache = g_new0(struct _PlayerStepCache, 1);
+		g_mutex_init(&cache->lock);
+		g_queue_init(&cache->frames);
+		cache->request = GST_CLOCK_TIME_NONE;
+		cache->max_bytes = max_bytes;
+		data->step = cache;
+	} else if ((cache = data->step)) {
+		g_mutex_lock(&cache->lock);
+		cache->max_bytes = max_bytes;
+		if (max_bytes)
+			cache_trim_locked(cache);
+		else
+			cache_clear_locked(cache);
+		g_mutex_unlock(&cache->lock);
+	}
+}
+
+void player_step_free(PlayerData * data)
+{
+	struct _PlayerStepCache *cache = data->step;
+
+	if (!cache)
+		return;
+
+	cache_clear_locked(cache);
+	g_mutex_clear(&cache->lock);
+	g_free(cache);
+	data->step = NULL;
+}
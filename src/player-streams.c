@@ -0,0 +1,525 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Stream info model. Each stream is described by a PlayerStream, filled from
+ * the stream collection posted by the demuxer, then from the tags and caps
+ * playbin reports in the streaming threads, only for the stream that
+ * changed. Queries copy the descriptors out, the panel text is rendered from
+ * them and the main thread just swaps it in, at most once per frame. */
+
+typedef struct _StreamEntry {
+	PlayerStream info;
+	gchar *text;		/* Rendered lines for the stream info panel */
+} StreamEntry;
+
+static const gchar *tags_signals[] = {
+	"get-video-tags",
+	"get-audio-tags",
+	"get-text-tags",
+};
+
+static const gchar *pad_signals[] = {
+	"get-video-pad",
+	"get-audio-pad",
+	"get-text-pad",
+};
+
+static void entry_clear(StreamEntry * entry)
+{
+	g_clear_pointer(&entry->text, g_free);
+}
+
+static StreamEntry *stream_at_locked(GArray * streams,
+				     PlayerStreamType type, gint index)
+{
+	guint i;
+
+	if ((guint) index >= streams->len) {
+		i = streams->len;
+		g_array_set_size(streams, index + 1);
+		for (; i < streams->len; i++) {
+			g_array_index(streams, StreamEntry, i).info.type = type;
+			g_array_index(streams, StreamEntry, i).info.index = i;
+		}
+	}
+	return &g_array_index(streams, StreamEntry, index);
+}
+
+static void stream_set_tags(PlayerStream * stream, const GstTagList * tags)
+{
+	const gchar *str;
+	guint rate;
+
+	if (gst_tag_list_peek_string_index(tags,
+					   stream->type == PLAYER_STREAM_VIDEO ?
+					   GST_TAG_VIDEO_CODEC :
+					   stream->type == PLAYER_STREAM_AUDIO ?
+					   GST_TAG_AUDIO_CODEC :
+					   GST_TAG_SUBTITLE_CODEC, 0, &str))
+		g_strlcpy(stream->codec, str, sizeof(stream->codec));
+	if (gst_tag_list_peek_string_index(tags, GST_TAG_LANGUAGE_CODE, 0, &str))
+		g_strlcpy(stream->language, str, sizeof(stream->language));
+	if (gst_tag_list_get_uint(tags, GST_TAG_BITRATE, &rate))
+		stream->bitrate = rate;
+}
+
+/* Encoded caps from the collection or decoded caps from playbin, whatever
+ * fields they carry */
+static void stream_set_caps(PlayerStream * stream, const GstCaps * caps)
+{
+	GstStructure *s;
+	const gchar *name;
+
+	if (!caps || gst_caps_is_empty(caps) || gst_caps_is_any(caps))
+		return;
+
+	s = gst_caps_get_structure(caps, 0);
+	name = gst_structure_get_name(s);
+	if (!g_str_has_suffix(name, "/x-raw"))
+		g_strlcpy(stream->media_type, name, sizeof(stream->media_type));
+
+	switch (stream->type) {
+	case PLAYER_STREAM_VIDEO:
+		gst_structure_get_int(s, "width", &stream->width);
+		gst_structure_get_int(s, "height", &stream->height);
+		gst_structure_get_fraction(s, "framerate", &stream->fps_n,
+					   &stream->fps_d);
+		break;
+	case PLAYER_STREAM_AUDIO:
+		gst_structure_get_int(s, "rate", &stream->rate);
+		gst_structure_get_int(s, "channels", &stream->channels);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Same layout as the panel always had, plus what the caps tell */
+static void stream_render(StreamEntry * entry)
+{
+	PlayerStream *stream = &entry->info;
+	GString *str = g_string_new(NULL);
+
+	switch (stream->type) {
+	case PLAYER_STREAM_VIDEO:
+		g_string_append_printf(str, "video stream %d:\n", stream->index);
+		g_string_append_printf(str, "  codec: %s\n",
+				       stream->codec[0] ? stream->codec :
+				       "unknown");
+		if (stream->width && stream->height)
+			g_string_append_printf(str, "  resolution: %dx%d\n",
+					       stream->width, stream->height);
+		if (stream->fps_n && stream->fps_d)
+			g_string_append_printf(str, "  framerate: %.2f\n",
+					       (gdouble) stream->fps_n /
+					       stream->fps_d);
+		break;
+	case PLAYER_STREAM_AUDIO:
+		g_string_append_printf(str, "\naudio stream %d:\n",
+				       stream->index);
+		if (stream->codec[0])
+			g_string_append_printf(str, "  codec: %s\n",
+					       stream->codec);
+		if (stream->language[0])
+			g_string_append_printf(str, "  language: %s\n",
+					       stream->language);
+		if (stream->bitrate)
+			g_string_append_printf(str, "  bitrate: %d\n",
+					       stream->bitrate);
+		if (stream->rate)
+			g_string_append_printf(str, "  sample rate: %d\n",
+					       stream->rate);
+		if (stream->channels)
+			g_string_append_printf(str, "  channels: %d\n",
+					       stream->channels);
+		break;
+	case PLAYER_STREAM_TEXT:
+		g_string_append_printf(str, "\nsubtitle stream %d:\n",
+				       stream->index);
+		if (stream->language[0])
+			g_string_append_printf(str, "  language: %s\n",
+					       stream->language);
+		break;
+	}
+	if (stream->decoder[0])
+		g_string_append_printf(str, "  decoder: %s\n", stream->decoder);
+
+	g_free(entry->text);
+	entry->text = g_string_free(str, FALSE);
+}
+
+/* Concatenate the cached per-stream text, O(streams) */
+static void rebuild_text_locked(PlayerData * data)
+{
+	GString *str = g_string_new(NULL);
+	guint type, i;
+
+	for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT; type++)
+		for (i = 0; i < data->streams[type]->len; i++) {
+			StreamEntry *entry =
+			    &g_array_index(data->streams[type], StreamEntry,
+					   i);
+			if (entry->text)
+				g_string_append(str, entry->text);
+		}
+
+	g_free(data->streams_text);
+	data->streams_text = g_string_free(str, FALSE);
+}
+
+static gboolean
+streams_tick_cb(GtkWidget * widget, GdkFrameClock * clock, PlayerData * data)
+{
+	gchar *text;
+
+	/* Changes from now on need a new update */
+	g_atomic_int_set(&data->streams_pending, 0);
+	data->streams_tick_id = 0;
+
+	g_mutex_lock(&data->streams_lock);
+	text = g_strdup(data->streams_text);
+	g_mutex_unlock(&data->streams_lock);
+
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer
+				 (GTK_TEXT_VIEW(data->streams_list)),
+				 text ? text : "", -1);
+	g_free(text);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean streams_idle_cb(PlayerData * data)
+{
+	g_mutex_lock(&data->streams_lock);
+	data->streams_idle_id = 0;
+	g_mutex_unlock(&data->streams_lock);
+
+	if (!data->streams_tick_id)
+		data->streams_tick_id =
+		    gtk_widget_add_tick_callback(data->streams_list,
+						 (GtkTickCallback)
+						 streams_tick_cb, data, NULL);
+	return G_SOURCE_REMOVE;
+}
+
+/* Any thread: a burst of changes only wakes the main thread once */
+static void schedule_update(PlayerData * data)
+{
+	if (!data->streams_list)
+		return;
+
+	if (g_atomic_int_compare_and_exchange(&data->streams_pending, 0, 1)) {
+		g_mutex_lock(&data->streams_lock);
+		data->streams_idle_id =
+		    g_idle_add((GSourceFunc) streams_idle_cb, data);
+		g_mutex_unlock(&data->streams_lock);
+	}
+}
+
+static GArray *streams_new(void)
+{
+	GArray *streams = g_array_new(FALSE, TRUE, sizeof(StreamEntry));
+
+	g_array_set_clear_func(streams, (GDestroyNotify) entry_clear);
+	return streams;
+}
+
+/* Between about-to-finish and its STREAM_START, the demuxer and decoders
+ * describe the queued item while the current one still plays */
+static gboolean queued_locked(PlayerData * data)
+{
+	return data->next_streams[PLAYER_STREAM_VIDEO] != NULL;
+}
+
+static GArray *target_locked(PlayerData * data, PlayerStreamType type)
+{
+	return queued_locked(data) ? data->next_streams[type] :
+	    data->streams[type];
+}
+
+void player_streams_init(PlayerData * data)
+{
+	guint type;
+
+	g_mutex_init(&data->streams_lock);
+	for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT; type++)
+		data->streams[type] = streams_new();
+}
+
+/* Called from the streaming thread that emitted *-tags-changed */
+void player_streams_update(PlayerData * data, PlayerStreamType type,
+			   gint index)
+{
+	GstTagList *tags = NULL;
+	GstPad *pad = NULL;
+	GstCaps *caps = NULL;
+	StreamEntry *entry;
+
+	FUNC_ENTER;
+
+	if (index < 0)
+		return;
+
+	g_signal_emit_by_name(data->playbin, tags_signals[type], index, &tags);
+	g_signal_emit_by_name(data->playbin, pad_signals[type], index, &pad);
+	if (pad) {
+		caps = gst_pad_get_current_caps(pad);
+		gst_object_unref(pad);
+	}
+
+	g_mutex_lock(&data->streams_lock);
+	entry = stream_at_locked(data->streams[type], type, index);
+	if (tags)
+		stream_set_tags(&entry->info, tags);
+	stream_set_caps(&entry->info, caps);
+	stream_render(entry);
+	rebuild_text_locked(data);
+	g_mutex_unlock(&data->streams_lock);
+
+	if (tags)
+		gst_tag_list_unref(tags);
+	if (caps)
+		gst_caps_unref(caps);
+
+	schedule_update(data);
+}
+
+static gint collection_type(GstStream * stream)
+{
+	GstStreamType type = gst_stream_get_stream_type(stream);
+
+	if (type & GST_STREAM_TYPE_VIDEO)
+		return PLAYER_STREAM_VIDEO;
+	if (type & GST_STREAM_TYPE_AUDIO)
+		return PLAYER_STREAM_AUDIO;
+	if (type & GST_STREAM_TYPE_TEXT)
+		return PLAYER_STREAM_TEXT;
+	return -1;
+}
+
+/* Main thread, on STREAM_COLLECTION: the demuxer describes every stream at
+ * once, before any decoder exists. Streams are numbered per type in
+ * collection order, like playbin numbers its pads. */
+void player_streams_set_collection(PlayerData * data,
+				   GstStreamCollection * collection)
+{
+	gint index[PLAYER_STREAM_TEXT + 1] = { 0 };
+	gboolean queued;
+	guint i, n;
+
+	FUNC_ENTER;
+
+	n = gst_stream_collection_get_size(collection);
+
+	g_mutex_lock(&data->streams_lock);
+	queued = queued_locked(data);
+	for (i = 0; i < n; i++) {
+		GstStream *stream = gst_stream_collection_get_stream(collection,
+								     i);
+		gint type = collection_type(stream);
+		GstTagList *tags;
+		GstCaps *caps;
+		StreamEntry *entry;
+
+		if (type < 0)
+			continue;
+
+		entry = stream_at_locked(target_locked(data, type), type,
+					 index[type]++);
+		tags = gst_stream_get_tags(stream);
+		if (tags) {
+			stream_set_tags(&entry->info, tags);
+			gst_tag_list_unref(tags);
+		}
+		caps = gst_stream_get_caps(stream);
+		if (caps) {
+			stream_set_caps(&entry->info, caps);
+			gst_caps_unref(caps);
+		}
+		stream_render(entry);
+	}
+	if (!queued)
+		rebuild_text_locked(data);
+	g_mutex_unlock(&data->streams_lock);
+
+	if (!queued)
+		schedule_update(data);
+}
+
+static PlayerStreamType decoder_type(GstElement * decoder)
+{
+	const gchar *klass =
+	    gst_element_factory_get_metadata(gst_element_get_factory(decoder),
+					     GST_ELEMENT_METADATA_KLASS);
+
+	if (strstr(klass, "Video") || strstr(klass, "Image"))
+		return PLAYER_STREAM_VIDEO;
+	if (strstr(klass, "Audio"))
+		return PLAYER_STREAM_AUDIO;
+	return PLAYER_STREAM_TEXT;
+}
+
+/* Called from the streaming thread once a decoder got its input caps. The
+ * decoder goes to the first stream of its type that has none yet and whose
+ * encoded format, when known, matches. */
+void player_streams_set_decoder(PlayerData * data, GstElement * decoder,
+				GstCaps * caps)
+{
+	PlayerStreamType type = decoder_type(decoder);
+	const gchar *name =
+	    gst_structure_get_name(gst_caps_get_structure(caps, 0));
+	GArray *streams;
+	StreamEntry *entry = NULL;
+	gboolean queued;
+	guint i;
+
+	g_mutex_lock(&data->streams_lock);
+	queued = queued_locked(data);
+	streams = target_locked(data, type);
+	for (i = 0; i < streams->len && !entry; i++) {
+		StreamEntry *e = &g_array_index(streams, StreamEntry, i);
+
+		if (!e->info.decoder[0] && (!e->info.media_type[0] ||
+					    !strcmp(e->info.media_type, name)))
+			entry = e;
+	}
+	/* Decoder created before anything described the stream */
+	if (!entry)
+		entry = stream_at_locked(streams, type, streams->len);
+
+	g_strlcpy(entry->info.decoder,
+		  gst_plugin_feature_get_name(gst_element_get_factory(decoder)),
+		  sizeof(entry->info.decoder));
+	if (!entry->info.media_type[0])
+		g_strlcpy(entry->info.media_type, name,
+			  sizeof(entry->info.media_type));
+	stream_render(entry);
+	if (!queued)
+		rebuild_text_locked(data);
+	g_mutex_unlock(&data->streams_lock);
+
+	if (!queued)
+		schedule_update(data);
+}
+
+/* A new item starts: forget every stream, the queued ones too */
+void player_streams_clear(PlayerData * data)
+{
+	guint type;
+
+	g_mutex_lock(&data->streams_lock);
+	for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT; type++) {
+		g_array_set_size(data->streams[type], 0);
+		g_clear_pointer(&data->next_streams[type], g_array_unref);
+	}
+	rebuild_text_locked(data);
+	g_mutex_unlock(&data->streams_lock);
+
+	schedule_update(data);
+}
+
+/* From about-to-finish, before the next uri is set: what gets described
+ * from now on belongs to that item */
+void player_streams_queue_next(PlayerData * data)
+{
+	guint type;
+
+	g_mutex_lock(&data->streams_lock);
+	for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT; type++) {
+		g_clear_pointer(&data->next_streams[type], g_array_unref);
+		data->next_streams[type] = streams_new();
+	}
+	g_mutex_unlock(&data->streams_lock);
+}
+
+/* Main thread, STREAM_START of the queued item: its streams take over */
+void player_streams_switch(PlayerData * data)
+{
+	guint type;
+
+	g_mutex_lock(&data->streams_lock);
+	if (queued_locked(data)) {
+		for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT;
+		     type++) {
+			g_array_unref(data->streams[type]);
+			data->streams[type] = data->next_streams[type];
+			data->next_streams[type] = NULL;
+		}
+	}
+	rebuild_text_locked(data);
+	g_mutex_unlock(&data->streams_lock);
+
+	schedule_update(data);
+}
+
+/* Main thread: text remembered from a previous run, shown until the
+ * streams describe themselves. A gapless switch already knows them. */
+void player_streams_restore_text(PlayerData * data, const gchar * text)
+{
+	guint type, known = 0;
+
+	g_mutex_lock(&data->streams_lock);
+	for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT; type++)
+		known += data->streams[type]->len;
+	if (!known) {
+		g_free(data->streams_text);
+		data->streams_text = g_strdup(text);
+	}
+	g_mutex_unlock(&data->streams_lock);
+
+	schedule_update(data);
+}
+
+gchar *player_streams_dup_text(PlayerData * data)
+{
+	gchar *text;
+
+	g_mutex_lock(&data->streams_lock);
+	text = g_strdup(data->streams_text);
+	g_mutex_unlock(&data->streams_lock);
+
+	return text;
+}
+
+void player_streams_free(PlayerData * data)
+{
+	guint type;
+
+	if (data->streams_idle_id)
+		g_source_remove(data->streams_idle_id);
+	if (data->streams_tick_id)
+		gtk_widget_remove_tick_callback(data->streams_list,
+						data->streams_tick_id);
+	for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT; type++) {
+		g_array_unref(data->streams[type]);
+		g_clear_pointer(&data->next_streams[type], g_array_unref);
+	}
+	g_free(data->streams_text);
+	g_mutex_clear(&data->streams_lock);
+}
+
+/* Copy the descriptors of up to max streams, video first, then audio and
+ * text. Returns the number of streams, which may be more than max. Does not
+ * allocate, so it can be polled cheaply. */
+guint player_get_streams(PlayerData * data, PlayerStream * streams, guint max)
+{
+	guint type, i, n = 0;
+
+	if (!data)
+		return 0;
+
+	g_mutex_lock(&data->streams_lock);
+	for (type = PLAYER_STREAM_VIDEO; type <= PLAYER_STREAM_TEXT; type++)
+		for (i = 0; i < data->streams[type]->len; i++, n++)
+			if (streams && n < max)
+				streams[n] =
+				    g_array_index(data->streams[type],
+						  StreamEntry, i).info;
+	g_mutex_unlock(&data->streams_lock);
+
+	return n;
+}
@@ -0,0 +1,454 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "player.h"
+#include "player-private.h"
+
+/* Subtitles. Embedded streams are left to playbin. External files are parsed
+ * once into a cue store sorted by start time, read as a balanced search tree
+ * whose nodes know the latest end below them: the cues shown at a position
+ * cost a walk down the tree, however large the file and however long its
+ * cues, and seeking costs nothing. A textoverlay in front
+ * of the video sink shows them, updated from a probe as frames go by. */
+
+typedef struct _Cue {
+	GstClockTime start;
+	GstClockTime end;
+	guint text;		/* Offset in the text blob */
+} Cue;
+
+struct _PlayerSubtitles {
+	GMutex lock;
+	GArray *cues;		/* Cue, by start time */
+	GArray *max_end;	/* GstClockTime, latest end in the subtree at i */
+	GString *texts;		/* Pango markup, NUL separated */
+	GstElement *overlay;	/* NULL in headless mode */
+	gchar *shown;		/* Text on screen, NULL when none */
+	gboolean visible;
+};
+
+/******************************************************************************/
+/*                                  Parsing                                   */
+/******************************************************************************/
+
+typedef struct _ParseState {
+	GArray *cues;
+	GString *texts;
+} ParseState;
+
+static void add_cue(ParseState * p, GstClockTime start, GstClockTime end,
+		    const gchar * markup)
+{
+	Cue cue;
+
+	if (end <= start || !*markup)
+		return;
+
+	cue.start = start;
+	cue.end = end;
+	cue.text = p->texts->len;
+	g_string_append_len(p->texts, markup, strlen(markup) + 1);
+	g_array_append_val(p->cues, cue);
+}
+
+static gchar *replace_all(gchar * text, const gchar * from, const gchar * to)
+{
+	gchar **parts = g_strsplit(text, from, -1);
+	gchar *result = g_strjoinv(to, parts);
+
+	g_strfreev(parts);
+	g_free(text);
+	return result;
+}
+
+/* SRT keeps its own <b>, <i> and <u>, which pango knows, anything else
+ * is plain text */
+static gchar *srt_markup(const gchar * text)
+{
+	static const gchar *const tags[][2] = {
+		{"&lt;b&gt;", "<b>"}, {"&lt;/b&gt;", "</b>"},
+		{"&lt;i&gt;", "<i>"}, {"&lt;/i&gt;", "</i>"},
+		{"&lt;u&gt;", "<u>"}, {"&lt;/u&gt;", "</u>"},
+	};
+	gchar *markup = g_markup_escape_text(text, -1);
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(tags); i++)
+		if (strstr(markup, tags[i][0]))
+			markup = replace_all(markup, tags[i][0], tags[i][1]);
+
+	return markup;
+}
+
+static gboolean parse_srt_time(const gchar * s, GstClockTime * t)
+{
+	guint h, m, sec, ms;
+
+	if (sscanf(s, "%u:%u:%u%*[,.]%u", &h, &m, &sec, &ms) != 4)
+		return FALSE;
+	*t = ((h * 60 + m) * 60 + sec) * GST_SECOND + ms * GST_MSECOND;
+	return TRUE;
+}
+
+static void parse_srt(ParseState * p, gchar ** lines)
+{
+	GString *text = g_string_new(NULL);
+	GstClockTime start = 0, end = 0;
+	gboolean in_cue = FALSE;
+	gchar *arrow, *markup;
+
+	for (; *lines; lines++) {
+		gchar *line = g_strchomp(*lines);
+
+		if (!in_cue) {
+			arrow = strstr(line, "-->");
+			if (arrow && parse_srt_time(line, &start)
+			    && parse_srt_time(arrow + 3 + strspn(arrow + 3, " "),
+					      &end)) {
+				in_cue = TRUE;
+				g_string_truncate(text, 0);
+			}
+			continue;
+		}
+
+		if (*line) {
+			if (text->len)
+				g_string_append_c(text, '\n');
+			g_string_append(text, line);
+			continue;
+		}
+
+		/* A blank line ends the cue */
+		markup = srt_markup(text->str);
+		add_cue(p, start, end, markup);
+		g_free(markup);
+		in_cue = FALSE;
+	}
+	if (in_cue) {
+		markup = srt_markup(text->str);
+		add_cue(p, start, end, markup);
+		g_free(markup);
+	}
+	g_string_free(text, TRUE);
+}
+
+static gboolean parse_ass_time(const gchar * s, GstClockTime * t)
+{
+	guint h, m, sec, cs;
+
+	if (sscanf(s, "%u:%u:%u.%u", &h, &m, &sec, &cs) != 4)
+		return FALSE;
+	*t = ((h * 60 + m) * 60 + sec) * GST_SECOND + cs * 10 * GST_MSECOND;
+	return TRUE;
+}
+
+/* Only the text of Dialogue lines, override blocks are dropped */
+static void parse_ass(ParseState * p, gchar ** lines)
+{
+	GString *text = g_string_new(NULL);
+
+	for (; *lines; lines++) {
+		gchar **fields, *markup;
+		const gchar *c;
+		GstClockTime start, end;
+
+		if (!g_str_has_prefix(*lines, "Dialogue:"))
+			continue;
+
+		/* Layer, Start, End, Style, Name, MarginL/R/V, Effect, Text */
+		fields = g_strsplit(g_strchomp(*lines) + 9, ",", 10);
+		if (g_strv_length(fields) == 10
+		    && parse_ass_time(g_strstrip(fields[1]), &start)
+		    && parse_ass_time(g_strstrip(fields[2]), &end)) {
+			g_string_truncate(text, 0);
+			for (c = fields[9]; *c; c++) {
+				if (*c == '{' && strchr(c, '}')) {
+					c = strchr(c, '}');
+				} else if (*c == '\\' && (c[1] == 'N'
+							  || c[1] == 'n')) {
+					g_string_append_c(text, '\n');
+					c++;
+				} else {
+					g_string_append_c(text, *c);
+				}
+			}
+			markup = g_markup_escape_text(text->str, -1);
+			add_cue(p, start, end, markup);
+			g_free(markup);
+		}
+		g_strfreev(fields);
+	}
+	g_string_free(text, TRUE);
+}
+
+static gint compare_start(const Cue * a, const Cue * b)
+{
+	return a->start < b->start ? -1 : a->start > b->start;
+}
+
+/* The subtree of cues[lo..hi] has its root in the middle. Returns the latest
+ * end in it, stored at the root. */
+static GstClockTime index_cues(GArray * cues, GArray * max_end, gint lo,
+			       gint hi)
+{
+	GstClockTime end, left, right;
+	gint mid;
+
+	if (lo > hi)
+		return 0;
+
+	mid = lo + (hi - lo) / 2;
+	left = index_cues(cues, max_end, lo, mid - 1);
+	right = index_cues(cues, max_end, mid + 1, hi);
+	end = MAX(g_array_index(cues, Cue, mid).end, MAX(left, right));
+	g_array_index(max_end, GstClockTime, mid) = end;
+
+	return end;
+}
+
+/******************************************************************************/
+/*                                   Lookup                                   */
+/******************************************************************************/
+
+/* In start order. A subtree that ends before position is skipped whole, as
+ * is what starts after it on the right. */
+static void find_locked(struct _PlayerSubtitles *s, GstClockTime position,
+			gint lo, gint hi, GPtrArray * found)
+{
+	while (lo <= hi) {
+		gint mid = lo + (hi - lo) / 2;
+		Cue *cue = &g_array_index(s->cues, Cue, mid);
+
+		if (g_array_index(s->max_end, GstClockTime, mid) <= position)
+			return;
+		find_locked(s, position, lo, mid - 1, found);
+		if (cue->start > position)
+			return;
+		if (cue->end > position)
+			g_ptr_array_add(found, s->texts->str + cue->text);
+		lo = mid + 1;
+	}
+}
+
+/* Markup of the cues at position, joined by lines, NULL if none */
+static gchar *lookup_locked(struct _PlayerSubtitles *s, GstClockTime position)
+{
+	GPtrArray *found;
+	gchar *text;
+
+	if (!s->cues || !s->cues->len)
+		return NULL;
+
+	found = g_ptr_array_new();
+	find_locked(s, position, 0, s->cues->len - 1, found);
+	g_ptr_array_add(found, NULL);
+	text = found->len > 1 ?
+	    g_strjoinv("\n", (gchar **) found->pdata) : NULL;
+	g_ptr_array_free(found, TRUE);
+
+	return text;
+}
+
+gchar *player_get_subtitle_at(PlayerData * data, GstClockTime position)
+{
+	struct _PlayerSubtitles *s;
+	gchar *text;
+
+	if (!data || !(s = data->subtitles))
+		return NULL;
+
+	g_mutex_lock(&s->lock);
+	text = lookup_locked(s, position);
+	g_mutex_unlock(&s->lock);
+
+	return text;
+}
+
+/* Streaming thread, before each frame reaches the overlay */
+static GstPadProbeReturn
+overlay_probe_cb(GstPad * pad, GstPadProbeInfo * info, PlayerData * data)
+{
+	struct _PlayerSubtitles *s = data->subtitles;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstEvent *event;
+	const GstSegment *segment;
+	GstClockTime position;
+	gchar *text = NULL;
+
+	if (!GST_BUFFER_PTS_IS_VALID(buffer))
+		return GST_PAD_PROBE_OK;
+	event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+	if (!event)
+		return GST_PAD_PROBE_OK;
+	gst_event_parse_segment(event, &segment);
+	position = gst_segment_to_stream_time(segment, GST_FORMAT_TIME,
+					      GST_BUFFER_PTS(buffer));
+	gst_event_unref(event);
+
+	g_mutex_lock(&s->lock);
+	if (s->visible && GST_CLOCK_TIME_IS_VALID(position))
+		text = lookup_locked(s, position);
+	/* Only bother the overlay when the text changes */
+	if (g_strcmp0(text, s->shown)) {
+		g_object_set(s->overlay, "text", text ? text : "", "silent",
+			     text == NULL, NULL);
+		g_free(s->shown);
+		s->shown = text;
+		text = NULL;
+	}
+	g_mutex_unlock(&s->lock);
+	g_free(text);
+
+	return GST_PAD_PROBE_OK;
+}
+
+/******************************************************************************/
+/*                                    API                                     */
+/******************************************************************************/
+
+/* From create_playbin(): the overlay stays in place, silent without cues */
+void player_subtitles_init(PlayerData * data)
+{
+	struct _PlayerSubtitles *s;
+	GstPad *pad;
+
+	s = g_new0(struct _PlayerSubtitles, 1);
+	g_mutex_init(&s->lock);
+	s->visible = TRUE;
+	data->subtitles = s;
+
+	if (data->render_mode == PLAYER_RENDER_HEADLESS)
+		return;
+
+	s->overlay = gst_element_factory_make("textoverlay", NULL);
+	if (!s->overlay)
+		return;
+	g_object_set(s->overlay, "silent", TRUE, "wait-text", FALSE,
+		     "valignment", 2 /* bottom */ , NULL);
+	g_object_set(data->playbin, "video-filter", s->overlay, NULL);
+
+	pad = gst_element_get_static_pad(s->overlay, "video_sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  (GstPadProbeCallback) overlay_probe_cb, data, NULL);
+	gst_object_unref(pad);
+}
+
+/* Load an SRT or ASS/SSA file for the current item, NULL unloads. Returns
+ * the number of cues. */
+gint player_set_subtitle_file(PlayerData * data, const gchar * path)
+{
+	struct _PlayerSubtitles *s;
+	ParseState p = { NULL, NULL };
+	GArray *max_end;
+	GError *error = NULL;
+	gchar *contents, **lines;
+
+	FUNC_ENTER;
+
+	if (!data || !(s = data->subtitles))
+		return -EINVAL;
+
+	if (path) {
+		if (!g_file_get_contents(path, &contents, NULL, &error)) {
+			g_printerr("Could not load %s: %s\n", path,
+				   error->message);
+			g_clear_error(&error);
+			return -1;
+		}
+
+		p.cues = g_array_new(FALSE, FALSE, sizeof(Cue));
+		p.texts = g_string_new(NULL);
+		lines = g_strsplit(contents, "\n", -1);
+		g_free(contents);
+		if (g_str_has_suffix(path, ".ass")
+		    || g_str_has_suffix(path, ".ssa"))
+			parse_ass(&p, lines);
+		else
+			parse_srt(&p, lines);
+		g_strfreev(lines);
+
+		/* Files are mostly sorted already, the sort is then cheap */
+		g_array_sort(p.cues, (GCompareFunc) compare_start);
+		max_end = g_array_sized_new(FALSE, FALSE, sizeof(GstClockTime),
+					    p.cues->len);
+		g_array_set_size(max_end, p.cues->len);
+		index_cues(p.cues, max_end, 0, (gint) p.cues->len - 1);
+		DBG("%u cues in %s", p.cues->len, path);
+	} else {
+		max_end = NULL;
+	}
+
+	g_mutex_lock(&s->lock);
+	if (s->cues) {
+		g_array_unref(s->cues);
+		g_array_unref(s->max_end);
+		g_string_free(s->texts, TRUE);
+	}
+	s->cues = p.cues;
+	s->max_end = max_end;
+	s->texts = p.texts;
+	g_mutex_unlock(&s->lock);
+
+	return p.cues ? (gint) p.cues->len : 0;
+}
+
+void player_set_subtitles_visible(PlayerData * data, gboolean visible)
+{
+	guint flags;
+
+	if (!data || !data->subtitles)
+		return;
+
+	data->subtitles->visible = visible;
+	/* Also playbin's own rendering of embedded streams */
+	g_object_get(data->playbin, "flags", &flags, NULL);
+	g_object_set(data->playbin, "flags", visible ?
+		     flags | PLAY_FLAG_TEXT : flags & ~PLAY_FLAG_TEXT, NULL);
+}
+
+gboolean player_get_subtitles_visible(PlayerData * data)
+{
+	return data && data->subtitles && data->subtitles->visible;
+}
+
+/* Show embedded text stream index, -1 for none */
+gint player_set_text_stream(PlayerData * data, gint index)
+{
+	gint n = 0;
+
+	if (!data)
+		return -EINVAL;
+
+	g_object_get(data->playbin, "n-text", &n, NULL);
+	if (index >= n)
+		return -EINVAL;
+
+	if (index < 0) {
+		player_set_subtitles_visible(data, FALSE);
+		return 0;
+	}
+	g_object_set(data->playbin, "current-text", index, NULL);
+	player_set_subtitles_visible(data, TRUE);
+
+	return 0;
+}
+
+void player_subtitles_free(PlayerData * data)
+{
+	struct _PlayerSubtitles *s = data->subtitles;
+
+	if (!s)
+		return;
+
+	if (s->cues) {
+		g_array_unref(s->cues);
+		g_array_unref(s->max_end);
+		g_string_free(s->texts, TRUE);
+	}
+	g_free(s->shown);
+	g_mutex_clear(&s->lock);
+	g_free(s);
+	data->subtitles = NULL;
+}
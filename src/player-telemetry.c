@@ -0,0 +1,419 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "player.h"
+#include "player-private.h"
+#include "player-json.h"
+
+/* Playback telemetry. Nothing is allocated, probed or listened to until
+ * player_set_telemetry() is called: a disabled player only pays for a NULL
+ * check per bus message and per element added to the pipeline. */
+
+/* Rolling average where a new sample weighs 1/16, n counts the samples */
+#define ROLLING_ADD(avg, sample, n) \
+	((avg) = (n) == 1 ? (sample) : \
+	 (avg) + (((gint64) (sample) - (gint64) (avg)) >> 4))
+
+/* QoS is only posted for late or dropped buffers: it counts drops, frames
+ * that reached the sink come from the render probe */
+typedef struct _QosSource {
+	guint64 dropped;
+	gboolean sink;		/* Dropped after reaching the sink */
+} QosSource;
+
+struct _PlayerTelemetryState {
+	gint enabled;
+	GMutex lock;
+	PlayerTelemetry counters;
+	GHashTable *qos;	/* Element posting QOS -> QosSource, per item */
+	GPtrArray *queues;	/* queue/queue2 elements to sample */
+	guint64 frames_base;	/* render_stats.frames when the item started */
+	guint panel_id;		/* Panel refresh timeout */
+};
+
+/* Shared by the two probes of one decoder */
+typedef struct _DecodeTimer {
+	gint ref;
+	struct _PlayerTelemetryState *t;
+	GstClockTime in;	/* Buffer entered the decoder */
+} DecodeTimer;
+
+static void decode_timer_unref(DecodeTimer * timer)
+{
+	if (g_atomic_int_dec_and_test(&timer->ref))
+		g_free(timer);
+}
+
+/* Decoding runs in the thread that pushes into the decoder: the time between
+ * a buffer entering and the next one leaving is the decode time, not counting
+ * what happens downstream. Decoders that reorder frames skip a sample. */
+static GstPadProbeReturn
+decode_in_probe_cb(GstPad * pad, GstPadProbeInfo * info, DecodeTimer * timer)
+{
+	if (g_atomic_int_get(&timer->t->enabled))
+		timer->in = gst_util_get_timestamp();
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+decode_out_probe_cb(GstPad * pad, GstPadProbeInfo * info, DecodeTimer * timer)
+{
+	struct _PlayerTelemetryState *t = timer->t;
+	GstClockTime now;
+
+	if (!GST_CLOCK_TIME_IS_VALID(timer->in)
+	    || !g_atomic_int_get(&t->enabled))
+		return GST_PAD_PROBE_OK;
+
+	now = gst_util_get_timestamp();
+	g_mutex_lock(&t->lock);
+	t->counters.decoded++;
+	ROLLING_ADD(t->counters.decode_time, now - timer->in,
+		    t->counters.decoded);
+	g_mutex_unlock(&t->lock);
+	timer->in = GST_CLOCK_TIME_NONE;
+
+	return GST_PAD_PROBE_OK;
+}
+
+static void watch_video_decoder(struct _PlayerTelemetryState *t,
+				GstElement * decoder)
+{
+	GstPad *sink = gst_element_get_static_pad(decoder, "sink");
+	GstPad *src = gst_element_get_static_pad(decoder, "src");
+	DecodeTimer *timer;
+
+	if (sink && src) {
+		timer = g_new0(DecodeTimer, 1);
+		timer->ref = 2;
+		timer->t = t;
+		timer->in = GST_CLOCK_TIME_NONE;
+		gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER,
+				  (GstPadProbeCallback) decode_in_probe_cb,
+				  timer, (GDestroyNotify) decode_timer_unref);
+		gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER,
+				  (GstPadProbeCallback) decode_out_probe_cb,
+				  timer, (GDestroyNotify) decode_timer_unref);
+	}
+	if (sink)
+		gst_object_unref(sink);
+	if (src)
+		gst_object_unref(src);
+}
+
+/* From deep-element-added, in whatever thread built the element */
+void player_telemetry_element_added(PlayerData * data, GstElement * element,
+				    const gchar * klass)
+{
+	struct _PlayerTelemetryState *t = data->telemetry;
+	const gchar *name;
+
+	if (!t || !g_atomic_int_get(&t->enabled) || !klass)
+		return;
+
+	name = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE
+					   (gst_element_get_factory(element)));
+	if (strstr(klass, "Decoder") && strstr(klass, "Video")) {
+		watch_video_decoder(t, element);
+	} else if (!g_strcmp0(name, "queue") || !g_strcmp0(name, "queue2")) {
+		g_mutex_lock(&t->lock);
+		g_ptr_array_add(t->queues, gst_object_ref(element));
+		g_mutex_unlock(&t->lock);
+	}
+}
+
+static gboolean is_video(GstObject * object)
+{
+	const gchar *klass;
+
+	if (!GST_IS_ELEMENT(object))
+		return FALSE;
+	klass = gst_element_class_get_metadata(GST_ELEMENT_GET_CLASS(object),
+					       GST_ELEMENT_METADATA_KLASS);
+	return klass && strstr(klass, "Video");
+}
+
+static void handle_qos(struct _PlayerTelemetryState *t, GstMessage * msg)
+{
+	GstFormat format;
+	guint64 processed, dropped;
+	gint64 jitter;
+	gdouble proportion;
+	gint quality;
+	QosSource *source;
+
+	gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+	gst_message_parse_qos_values(msg, &jitter, &proportion, &quality);
+
+	g_mutex_lock(&t->lock);
+	t->counters.qos_events++;
+	ROLLING_ADD(t->counters.jitter, ABS(jitter), t->counters.qos_events);
+	t->counters.proportion = proportion;
+
+	/* Counters are cumulative per element: keep the last ones. Audio
+	 * drops are not video frames. */
+	if (format == GST_FORMAT_BUFFERS && is_video(GST_MESSAGE_SRC(msg))) {
+		source = g_hash_table_lookup(t->qos, GST_MESSAGE_SRC(msg));
+		if (!source) {
+			source = g_new0(QosSource, 1);
+			source->sink =
+			    GST_OBJECT_FLAG_IS_SET(GST_MESSAGE_SRC(msg),
+						   GST_ELEMENT_FLAG_SINK);
+			g_hash_table_insert(t->qos, GST_MESSAGE_SRC(msg),
+					    source);
+		}
+		source->dropped = dropped;
+	}
+	g_mutex_unlock(&t->lock);
+}
+
+/* Main thread: the bus messages telemetry cares about */
+void player_telemetry_message(PlayerData * data, GstMessage * msg)
+{
+	struct _PlayerTelemetryState *t = data->telemetry;
+	GstClockTime min, max;
+	gboolean live;
+	gint percent;
+
+	if (!t || !g_atomic_int_get(&t->enabled))
+		return;
+
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_QOS:
+		handle_qos(t, msg);
+		break;
+	case GST_MESSAGE_BUFFERING:
+		gst_message_parse_buffering(msg, &percent);
+		g_mutex_lock(&t->lock);
+		t->counters.buffering = percent;
+		g_mutex_unlock(&t->lock);
+		break;
+	case GST_MESSAGE_LATENCY:
+		if (gst_element_query_latency(data->playbin, &live, &min, &max)) {
+			g_mutex_lock(&t->lock);
+			t->counters.latency = min;
+			g_mutex_unlock(&t->lock);
+		}
+		break;
+	case GST_MESSAGE_STREAM_START:
+		g_mutex_lock(&t->lock);
+		t->counters.streams_started++;
+		g_mutex_unlock(&t->lock);
+		break;
+	default:
+		break;
+	}
+}
+
+/* A new item starts: per element counters and averages start over */
+void player_telemetry_reset(PlayerData * data)
+{
+	struct _PlayerTelemetryState *t = data->telemetry;
+	guint64 frames;
+
+	if (!t)
+		return;
+
+	g_mutex_lock(&data->stats_lock);
+	frames = data->render_stats.frames;
+	g_mutex_unlock(&data->stats_lock);
+
+	g_mutex_lock(&t->lock);
+	t->frames_base = frames;
+	g_hash_table_remove_all(t->qos);
+	t->counters.qos_events = 0;
+	t->counters.jitter = 0;
+	t->counters.proportion = 1.0;
+	t->counters.decoded = 0;
+	t->counters.decode_time = 0;
+	t->counters.buffering = -1;
+	g_mutex_unlock(&t->lock);
+}
+
+/* Percentage of the fullest limit, queues removed from the pipeline are
+ * dropped on the way */
+static void sample_queues_locked(struct _PlayerTelemetryState *t,
+				 PlayerTelemetry * out)
+{
+	guint i = 0;
+
+	out->queues = 0;
+	out->queue_level_min = -1;
+	out->queue_level_max = -1;
+
+	while (i < t->queues->len) {
+		GstElement *queue = g_ptr_array_index(t->queues, i);
+		guint64 time, max_time;
+		guint bytes, max_bytes;
+		gint level = 0;
+		GstObject *parent = gst_object_get_parent(GST_OBJECT(queue));
+
+		if (!parent) {
+			g_ptr_array_remove_index_fast(t->queues, i);
+			continue;
+		}
+		gst_object_unref(parent);
+		i++;
+
+		g_object_get(queue, "current-level-time", &time,
+			     "max-size-time", &max_time, "current-level-bytes",
+			     &bytes, "max-size-bytes", &max_bytes, NULL);
+		if (max_time)
+			level = MAX(level, (gint) (100 * time / max_time));
+		if (max_bytes)
+			level =
+			    MAX(level, (gint) (100 * (guint64) bytes / max_bytes));
+		level = MIN(level, 100);
+
+		out->queues++;
+		if (out->queue_level_min < 0 || level < out->queue_level_min)
+			out->queue_level_min = level;
+		out->queue_level_max = MAX(out->queue_level_max, level);
+	}
+}
+
+/* Returns FALSE when telemetry was never enabled */
+gboolean player_get_telemetry(PlayerData * data, PlayerTelemetry * telemetry)
+{
+	struct _PlayerTelemetryState *t;
+	GHashTableIter iter;
+	QosSource *source;
+	guint64 frames, sink_dropped = 0;
+
+	if (!data || !data->telemetry || !telemetry)
+		return FALSE;
+	t = data->telemetry;
+
+	g_mutex_lock(&data->stats_lock);
+	frames = data->render_stats.frames;
+	g_mutex_unlock(&data->stats_lock);
+
+	g_mutex_lock(&t->lock);
+	*telemetry = t->counters;
+	telemetry->dropped = 0;
+	g_hash_table_iter_init(&iter, t->qos);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) & source)) {
+		if (source->sink)
+			sink_dropped += source->dropped;
+		telemetry->dropped += source->dropped;
+	}
+	/* What reached the video sink and was not dropped there */
+	frames -= MIN(frames, t->frames_base);
+	telemetry->rendered = frames - MIN(frames, sink_dropped);
+	sample_queues_locked(t, telemetry);
+	g_mutex_unlock(&t->lock);
+
+	return TRUE;
+}
+
+/* One line of JSON, for dashboards. Free with g_free(). */
+gchar *player_get_telemetry_json(PlayerData * data)
+{
+	PlayerTelemetry tm;
+	GString *json;
+
+	if (!player_get_telemetry(data, &tm))
+		return NULL;
+
+	json = g_string_new("{\"uri\":");
+	player_json_string(json, data->uri ? data->uri : "");
+	g_string_append_printf(json, ",\"rendered\":%" G_GUINT64_FORMAT
+			       ",\"dropped\":%" G_GUINT64_FORMAT
+			       ",\"jitter_ms\":%.3f,\"proportion\":%.3f"
+			       ",\"decode_ms\":%.3f,\"decoded\":%"
+			       G_GUINT64_FORMAT ",\"buffering\":%d"
+			       ",\"latency_ms\":%.3f,\"streams_started\":%u"
+			       ",\"queues\":%u,\"queue_level_min\":%d"
+			       ",\"queue_level_max\":%d}",
+			       tm.rendered, tm.dropped, tm.jitter / 1e6,
+			       tm.proportion, tm.decode_time / 1e6, tm.decoded,
+			       tm.buffering,
+			       GST_CLOCK_TIME_IS_VALID(tm.latency) ?
+			       tm.latency / 1e6 : -1.0, tm.streams_started,
+			       tm.queues, tm.queue_level_min,
+			       tm.queue_level_max);
+
+	return g_string_free(json, FALSE);
+}
+
+static gboolean panel_update_cb(PlayerData * data)
+{
+	PlayerTelemetry tm;
+	gchar *text;
+
+	if (!player_get_telemetry(data, &tm))
+		return G_SOURCE_REMOVE;
+
+	text = g_strdup_printf("rendered: %" G_GUINT64_FORMAT "\n"
+			       "dropped: %" G_GUINT64_FORMAT "\n"
+			       "jitter: %.2f ms\n"
+			       "decode: %.2f ms/frame\n"
+			       "buffering: %d%%\n"
+			       "queues: %d-%d%%",
+			       tm.rendered, tm.dropped, tm.jitter / 1e6,
+			       tm.decode_time / 1e6, MAX(tm.buffering, 0),
+			       MAX(tm.queue_level_min, 0),
+			       MAX(tm.queue_level_max, 0));
+	gtk_label_set_text(GTK_LABEL(data->telemetry_label), text);
+	g_free(text);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Takes effect for the elements created from now on: enable it before
+ * setting the uri to time every decoder */
+void player_set_telemetry(PlayerData * data, gboolean enable)
+{
+	struct _PlayerTelemetryState *t;
+
+	FUNC_ENTER;
+
+	if (!data)
+		return;
+
+	if (!data->telemetry && enable) {
+		t = g_new0(struct _PlayerTelemetryState, 1);
+		g_mutex_init(&t->lock);
+		t->qos = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+		t->queues = g_ptr_array_new_with_free_func(gst_object_unref);
+		t->counters.proportion = 1.0;
+		t->counters.buffering = -1;
+		t->counters.latency = GST_CLOCK_TIME_NONE;
+		data->telemetry = t;
+	}
+	t = data->telemetry;
+	if (!t)
+		return;
+
+	g_atomic_int_set(&t->enabled, enable);
+
+	if (!data->telemetry_label)
+		return;
+	if (enable && !t->panel_id) {
+		t->panel_id =
+		    g_timeout_add_seconds(1, (GSourceFunc) panel_update_cb,
+					  data);
+		gtk_widget_show(data->telemetry_label);
+	} else if (!enable && t->panel_id) {
+		g_source_remove(t->panel_id);
+		t->panel_id = 0;
+		gtk_widget_hide(data->telemetry_label);
+	}
+}
+
+void player_telemetry_free(PlayerData * data)
+{
+	struct _PlayerTelemetryState *t = data->telemetry;
+
+	if (!t)
+		return;
+
+	if (t->panel_id)
+		g_source_remove(t->panel_id);
+	g_hash_table_unref(t->qos);
+	g_ptr_array_unref(t->queues);
+	g_mutex_clear(&t->lock);
+	g_free(t);
+	data->telemetry = NULL;
+}
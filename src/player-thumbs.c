@@ -0,0 +1,453 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <glib/gstdio.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "player-thumbs.h"
+#include "player-private.h"
+
+#define THUMB_WIDTH 160
+#define THUMB_TIMEOUT (5 * GST_SECOND)
+#define THUMB_CACHE_DEFAULT_SIZE (32 * 1024 * 1024)
+
+/******************************************************************************/
+/*                                 LRU cache                                  */
+/******************************************************************************/
+
+typedef struct _ThumbEntry {
+	gchar *key;		/* "uri#timestamp" */
+	GdkPixbuf *pixbuf;
+	gsize size;
+	GList link;		/* Node in the LRU list, data points to the entry */
+} ThumbEntry;
+
+/* The cache is shared by all the players of the process */
+static GMutex cache_lock;
+static GHashTable *cache;	/* key -> ThumbEntry */
+static GQueue lru = G_QUEUE_INIT;	/* Most recently used first */
+static gsize cache_max = THUMB_CACHE_DEFAULT_SIZE;
+static gchar *cache_dir;
+static PlayerThumbStats stats;
+
+static gchar *make_key(const gchar * uri, GstClockTime ts)
+{
+	return g_strdup_printf("%s#%" G_GUINT64_FORMAT, uri, ts);
+}
+
+static void cache_evict_locked(void)
+{
+	ThumbEntry *victim = lru.tail->data;
+
+	g_queue_unlink(&lru, &victim->link);
+	g_hash_table_remove(cache, victim->key);
+	stats.bytes -= victim->size;
+	stats.entries--;
+	g_object_unref(victim->pixbuf);
+	g_free(victim->key);
+	g_free(victim);
+}
+
+static gboolean cache_contains(const gchar * key)
+{
+	gboolean found;
+
+	g_mutex_lock(&cache_lock);
+	found = cache && g_hash_table_contains(cache, key);
+	g_mutex_unlock(&cache_lock);
+
+	return found;
+}
+
+/* Whether size more bytes fit without evicting anything */
+static gboolean cache_has_room(gsize size)
+{
+	gboolean room;
+
+	g_mutex_lock(&cache_lock);
+	room = stats.bytes + size <= cache_max;
+	g_mutex_unlock(&cache_lock);
+
+	return room;
+}
+
+static void cache_insert(const gchar * key, GdkPixbuf * pixbuf)
+{
+	ThumbEntry *entry;
+
+	g_mutex_lock(&cache_lock);
+	if (!cache)
+		cache = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if (!g_hash_table_contains(cache, key)) {
+		entry = g_new0(ThumbEntry, 1);
+		entry->key = g_strdup(key);
+		entry->pixbuf = g_object_ref(pixbuf);
+		entry->size = gdk_pixbuf_get_byte_length(pixbuf);
+		entry->link.data = entry;
+		g_hash_table_insert(cache, entry->key, entry);
+		g_queue_push_head_link(&lru, &entry->link);
+		stats.bytes += entry->size;
+		stats.entries++;
+
+		while (stats.bytes > cache_max && lru.tail != &entry->link)
+			cache_evict_locked();
+	}
+	g_mutex_unlock(&cache_lock);
+}
+
+static GdkPixbuf *cache_lookup(const gchar * key)
+{
+	ThumbEntry *entry;
+	GdkPixbuf *pixbuf = NULL;
+
+	g_mutex_lock(&cache_lock);
+	entry = cache ? g_hash_table_lookup(cache, key) : NULL;
+	if (entry) {
+		g_queue_unlink(&lru, &entry->link);
+		g_queue_push_head_link(&lru, &entry->link);
+		pixbuf = g_object_ref(entry->pixbuf);
+		stats.hits++;
+	} else {
+		stats.misses++;
+	}
+	g_mutex_unlock(&cache_lock);
+
+	return pixbuf;
+}
+
+static gchar *disk_path(const gchar * uri, GstClockTime ts)
+{
+	gchar *hash, *name, *path;
+
+	if (!cache_dir)
+		return NULL;
+
+	hash = g_compute_checksum_for_string(G_CHECKSUM_MD5, uri, -1);
+	name = g_strdup_printf("%s-%" G_GUINT64_FORMAT ".png", hash, ts);
+	path = g_build_filename(cache_dir, name, NULL);
+	g_free(name);
+	g_free(hash);
+
+	return path;
+}
+
+void player_thumbs_configure(gsize max_bytes, const gchar * disk_dir)
+{
+	FUNC_ENTER;
+
+	g_mutex_lock(&cache_lock);
+	if (max_bytes)
+		cache_max = max_bytes;
+	while (cache && stats.bytes > cache_max)
+		cache_evict_locked();
+
+	g_free(cache_dir);
+	cache_dir = g_strdup(disk_dir);
+	if (cache_dir)
+		g_mkdir_with_parents(cache_dir, 0700);
+	g_mutex_unlock(&cache_lock);
+}
+
+void player_thumbs_get_stats(PlayerThumbStats * out)
+{
+	if (!out)
+		return;
+
+	g_mutex_lock(&cache_lock);
+	*out = stats;
+	g_mutex_unlock(&cache_lock);
+}
+
+/******************************************************************************/
+/*                           Background thumbnailer                           */
+/******************************************************************************/
+
+struct _PlayerThumbnailer {
+	gint ref;		/* Held by the owner and by the worker thread */
+	gint cancelled;
+	gchar *uri;
+	GstClockTime interval;
+	/* worker thread only */
+	GstElement *pipeline;
+	GstElement *sink;
+	GstTaskPool *pool;	/* Streaming threads, all lowered */
+	gint64 duration;
+};
+
+static void thumbnailer_unref(PlayerThumbnailer * t)
+{
+	if (!g_atomic_int_dec_and_test(&t->ref))
+		return;
+
+	g_free(t->uri);
+	g_free(t);
+}
+
+/* A nice value only applies to the calling thread on Linux, so each
+ * streaming thread lowers itself as it starts. They come from a pool of our
+ * own: the default pool hands its threads over to the players afterwards,
+ * and an unprivileged thread cannot raise its priority back. */
+static GstBusSyncReply
+thumbnailer_sync_cb(GstBus * bus, GstMessage * msg, PlayerThumbnailer * t)
+{
+	GstStreamStatusType type;
+	GstElement *owner;
+	const GValue *value;
+
+	if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS)
+		return GST_BUS_PASS;
+
+	gst_message_parse_stream_status(msg, &type, &owner);
+	switch (type) {
+	case GST_STREAM_STATUS_TYPE_CREATE:
+		value = gst_message_get_stream_status_object(msg);
+		if (value && G_VALUE_HOLDS(value, GST_TYPE_TASK))
+			gst_task_set_pool(g_value_get_object(value), t->pool);
+		break;
+	case GST_STREAM_STATUS_TYPE_ENTER:
+		if (setpriority(PRIO_PROCESS, 0, 19) < 0)
+			LOG("could not lower thumbnail streaming thread");
+		break;
+	default:
+		break;
+	}
+
+	/* Nobody reads this bus */
+	return GST_BUS_DROP;
+}
+
+/* Decode video only, scaled down right after the decoder */
+static gint thumbnailer_open(PlayerThumbnailer * t)
+{
+	GError *error = NULL;
+	GstElement *src;
+	GstBus *bus;
+
+	t->pipeline =
+	    gst_parse_launch("uridecodebin name=src caps=video/x-raw "
+			     "expose-all-streams=false ! videoconvert ! "
+			     "videoscale ! video/x-raw,format=RGB,width="
+			     G_STRINGIFY(THUMB_WIDTH)
+			     ",pixel-aspect-ratio=1/1 ! "
+			     "appsink name=sink sync=false", &error);
+	if (error) {
+		g_printerr("Thumbnail pipeline: %s\n", error->message);
+		g_clear_error(&error);
+	}
+	if (!t->pipeline)
+		return -1;
+
+	t->pool = gst_task_pool_new();
+	gst_task_pool_prepare(t->pool, NULL);
+	bus = gst_element_get_bus(t->pipeline);
+	gst_bus_set_sync_handler(bus, (GstBusSyncHandler) thumbnailer_sync_cb,
+				 t, NULL);
+	gst_object_unref(bus);
+
+	src = gst_bin_get_by_name(GST_BIN(t->pipeline), "src");
+	g_object_set(src, "uri", t->uri, NULL);
+	gst_object_unref(src);
+	t->sink = gst_bin_get_by_name(GST_BIN(t->pipeline), "sink");
+
+	gst_element_set_state(t->pipeline, GST_STATE_PAUSED);
+	if (gst_element_get_state(t->pipeline, NULL, NULL, THUMB_TIMEOUT) !=
+	    GST_STATE_CHANGE_SUCCESS)
+		return -1;
+
+	if (!gst_element_query_duration
+	    (t->pipeline, GST_FORMAT_TIME, &t->duration))
+		return -1;
+
+	return 0;
+}
+
+static GdkPixbuf *thumbnailer_grab(PlayerThumbnailer * t, GstClockTime ts)
+{
+	GstSample *sample;
+	GstVideoInfo info;
+	GstVideoFrame frame;
+	GdkPixbuf *pixbuf = NULL;
+	gint y;
+
+	/* Nearest keyframe before ts is good enough for a preview */
+	if (!gst_element_seek_simple(t->pipeline, GST_FORMAT_TIME,
+				     GST_SEEK_FLAG_FLUSH |
+				     GST_SEEK_FLAG_KEY_UNIT |
+				     GST_SEEK_FLAG_SNAP_BEFORE |
+				     GST_SEEK_FLAG_TRICKMODE |
+				     GST_SEEK_FLAG_TRICKMODE_KEY_UNITS, ts))
+		return NULL;
+	if (gst_element_get_state(t->pipeline, NULL, NULL, THUMB_TIMEOUT) !=
+	    GST_STATE_CHANGE_SUCCESS)
+		return NULL;
+
+	sample = gst_app_sink_pull_preroll(GST_APP_SINK(t->sink));
+	if (!sample)
+		return NULL;
+
+	if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample))
+	    && gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample),
+				   GST_MAP_READ)) {
+		pixbuf =
+		    gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, info.width,
+				   info.height);
+		for (y = 0; y < info.height; y++)
+			memcpy(gdk_pixbuf_get_pixels(pixbuf) +
+			       y * gdk_pixbuf_get_rowstride(pixbuf),
+			       (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&frame,
+								      0) +
+			       y * GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0),
+			       info.width * 3);
+		gst_video_frame_unmap(&frame);
+	}
+	gst_sample_unref(sample);
+
+	return pixbuf;
+}
+
+static gpointer thumbnailer_thread(PlayerThumbnailer * t)
+{
+	gsize size = 0;
+	guint64 i;
+
+	/* This thread seeks and converts, the streaming threads lower
+	 * themselves as they start */
+	if (setpriority(PRIO_PROCESS, 0, 19) < 0)
+		LOG("could not lower thumbnailer priority");
+
+	for (i = 0; !g_atomic_int_get(&t->cancelled); i++) {
+		GstClockTime ts = i * t->interval;
+		GdkPixbuf *pixbuf = NULL;
+		gchar *key, *path;
+
+		if (t->pipeline && ts >= (GstClockTime) t->duration)
+			break;
+
+		key = make_key(t->uri, ts);
+		if (cache_contains(key)) {
+			g_free(key);
+			continue;
+		}
+
+		/* Once the cache is full, each new thumbnail would only evict
+		 * an earlier one: stop rather than decode for nothing */
+		if (size && !cache_has_room(size)) {
+			DBG("thumbnail cache full at %" GST_TIME_FORMAT,
+			    GST_TIME_ARGS(ts));
+			g_free(key);
+			break;
+		}
+
+		g_mutex_lock(&cache_lock);
+		path = disk_path(t->uri, ts);
+		g_mutex_unlock(&cache_lock);
+
+		if (path && g_file_test(path, G_FILE_TEST_EXISTS))
+			pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+
+		if (pixbuf) {
+			g_mutex_lock(&cache_lock);
+			stats.disk_hits++;
+			g_mutex_unlock(&cache_lock);
+		} else {
+			/* Only open the file once something is missing */
+			if (!t->pipeline && thumbnailer_open(t) < 0) {
+				g_free(path);
+				g_free(key);
+				break;
+			}
+			if (ts < (GstClockTime) t->duration)
+				pixbuf = thumbnailer_grab(t, ts);
+			if (!pixbuf) {
+				g_free(path);
+				g_free(key);
+				break;
+			}
+			if (path)
+				gdk_pixbuf_save(pixbuf, path, "png", NULL, NULL);
+			g_mutex_lock(&cache_lock);
+			stats.decoded++;
+			g_mutex_unlock(&cache_lock);
+		}
+
+		size = gdk_pixbuf_get_byte_length(pixbuf);
+		cache_insert(key, pixbuf);
+		g_object_unref(pixbuf);
+		g_free(path);
+		g_free(key);
+	}
+
+	if (t->pipeline) {
+		gst_element_set_state(t->pipeline, GST_STATE_NULL);
+		if (t->sink)
+			gst_object_unref(t->sink);
+		gst_object_unref(t->pipeline);
+	}
+	/* After the pipeline, whose tasks are joined by now */
+	if (t->pool) {
+		gst_task_pool_cleanup(t->pool);
+		gst_object_unref(t->pool);
+	}
+	thumbnailer_unref(t);
+
+	return NULL;
+}
+
+PlayerThumbnailer *player_thumbnailer_new(const gchar * uri,
+					  GstClockTime interval)
+{
+	PlayerThumbnailer *t;
+	GThread *thread;
+
+	FUNC_ENTER;
+
+	if (!uri || !interval)
+		return NULL;
+
+	t = g_new0(PlayerThumbnailer, 1);
+	t->ref = 2;
+	t->uri = g_strdup(uri);
+	t->interval = interval;
+	t->duration = -1;
+
+	thread =
+	    g_thread_new("thumbnailer", (GThreadFunc) thumbnailer_thread, t);
+	g_thread_unref(thread);
+
+	return t;
+}
+
+/* Constant time: the position is rounded down to the thumbnail interval and
+ * looked up in the hash table */
+GdkPixbuf *player_thumbnailer_lookup(PlayerThumbnailer * t,
+				     GstClockTime position)
+{
+	GdkPixbuf *pixbuf;
+	gchar *key;
+
+	if (!t || !GST_CLOCK_TIME_IS_VALID(position))
+		return NULL;
+
+	key = make_key(t->uri, position - position % t->interval);
+	pixbuf = cache_lookup(key);
+	g_free(key);
+
+	return pixbuf;
+}
+
+/* The worker is not waited for: it stops at the next thumbnail and drops the
+ * last reference itself */
+void player_thumbnailer_free(PlayerThumbnailer * t)
+{
+	FUNC_ENTER;
+
+	if (!t)
+		return;
+
+	g_atomic_int_set(&t->cancelled, 1);
+	thumbnailer_unref(t);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+
+/* Slider preview thumbnails. A low priority background pipeline, separate
+ * from the playbin, grabs keyframes at fixed intervals into a process wide
+ * LRU cache keyed by URI and timestamp. The cache is capped in memory, a
+ * thumbnailer stops once it is full, and can be backed by a directory so a
+ * file is only decoded once. */
+typedef struct _PlayerThumbnailer PlayerThumbnailer;
+
+typedef struct _PlayerThumbStats {
+	guint64 hits;		/* Lookups served from the cache */
+	guint64 misses;		/* Lookups with no thumbnail (yet) */
+	guint64 disk_hits;	/* Thumbnails loaded from disk instead of decoded */
+	guint64 decoded;	/* Thumbnails decoded by the background pipelines */
+	gsize bytes;		/* Pixel memory held by the cache */
+	guint entries;
+} PlayerThumbStats;
+
+/* max_bytes of 0 keeps the default, a NULL disk_dir disables the disk cache */
+void player_thumbs_configure(gsize max_bytes, const gchar * disk_dir);
+void player_thumbs_get_stats(PlayerThumbStats * stats);
+
+PlayerThumbnailer *player_thumbnailer_new(const gchar * uri,
+					  GstClockTime interval);
+GdkPixbuf *player_thumbnailer_lookup(PlayerThumbnailer * thumbnailer,
+				     GstClockTime position);
+void player_thumbnailer_free(PlayerThumbnailer * thumbnailer);
@@ -3,28 +3,41 @@
 #include <stdlib.h>
 
 #include "player.h"
+#include "player-private.h"
+#include "player-thumbs.h"
 
 #include <gst/video/videooverlay.h>
 
 #include <gdk/gdk.h>
+/* X11 and Wayland can both be built in, the backend is picked at runtime */
 #if defined (GDK_WINDOWING_X11)
 #include <gdk/gdkx.h>
-#elif defined (GDK_WINDOWING_WIN32)
+#endif
+#if defined (GDK_WINDOWING_WAYLAND)
+#include <gdk/gdkwayland.h>
+#endif
+#if defined (GDK_WINDOWING_WIN32)
 #include <gdk/gdkwin32.h>
 #elif defined (GDK_WINDOWING_QUARTZ)
 #include <gdk/gdkquartz.h>
-#elif defined (GDK_WINDOWING_WAYLAND)
-#include <gdk/gdkwayland.h>
 #endif
 
 int verbose = 0;
-int debug = 1;
-#define LOG(msg) if (verbose){printf("[%s:%d] %s - %s\n", __FILE__, __LINE__, __func__, msg);}
-#define DBG(msg) if (debug){printf("[%s:%d] %s - %s\n", __FILE__, __LINE__, __func__, msg);}
-#define FUNC_ENTER if (verbose){printf("%s\n", __func__);}
 
 /* Common function */
 
+/* gst_init() only needs to run once per process, whatever the number of
+ * players (standalone or pooled) we create */
+void player_init_once(void)
+{
+	static gsize initialized = 0;
+
+	if (g_once_init_enter(&initialized)) {
+		gst_init(NULL, NULL);
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
 static guintptr get_window_handle(GtkWidget * widget)
 {
 	GdkWindow *window;
@@ -42,19 +55,84 @@ static guintptr get_window_handle(GtkWidget * widget)
 	window_handle = (guintptr) GDK_WINDOW_HWND(window);
 #elif defined (GDK_WINDOWING_QUARTZ)
 	window_handle = gdk_quartz_window_get_nsview(window);
-#elif defined (GDK_WINDOWING_X11)
-	window_handle = GDK_WINDOW_XID(window);
-#elif defined (GDK_WINDOWING_WAYLAND)
-	window_handle = gdk_wayland_window_get_wl_surface(window);
+#elif defined (GDK_WINDOWING_X11) || defined (GDK_WINDOWING_WAYLAND)
+#if defined (GDK_WINDOWING_X11)
+	if (GDK_IS_X11_WINDOW(window))
+		window_handle = GDK_WINDOW_XID(window);
+#endif
+#if defined (GDK_WINDOWING_WAYLAND)
+	if (GDK_IS_WAYLAND_WINDOW(window))
+		window_handle =
+		    (guintptr) gdk_wayland_window_get_wl_surface(window);
+#endif
 #else
 #error "NO GDK_WINDOWING supported"
 #endif
 	return window_handle;
 }
 
+/* Only X11, Win32 and Quartz can reliably embed a sink in a native window */
+static gboolean overlay_supported(void)
+{
+#if defined (GDK_WINDOWING_WIN32) || defined (GDK_WINDOWING_QUARTZ)
+	return TRUE;
+#elif defined (GDK_WINDOWING_X11)
+	return GDK_IS_X11_DISPLAY(gdk_display_get_default());
+#else
+	return FALSE;
+#endif
+}
+
+/* Build the sink for PLAYER_RENDER_GTK_SINK: frames stay in GL memory up to
+ * the texture drawn by the sink widget, which is composited by GTK like any
+ * other widget. Fall back to the (CPU) gtksink without GL support. */
+static gint create_video_sink(PlayerData * data)
+{
+	GstElement *glsink;
+
+	FUNC_ENTER;
+
+	glsink = gst_element_factory_make("gtkglsink", NULL);
+	if (glsink) {
+		data->video_sink = gst_element_factory_make("glsinkbin", NULL);
+		if (data->video_sink) {
+			g_object_set(data->video_sink, "sink", glsink, NULL);
+		} else {
+			gst_object_unref(glsink);
+			glsink = NULL;
+		}
+	}
+	if (!glsink) {
+		DBG("gtkglsink unavailable, using gtksink");
+		data->video_sink = gst_element_factory_make("gtksink", NULL);
+		if (!data->video_sink) {
+			g_printerr("Neither gtkglsink nor gtksink available.\n");
+			return -1;
+		}
+		glsink = data->video_sink;
+	}
+	gst_object_ref_sink(data->video_sink);
+
+	/* The sink owns the widget, we keep a reference until player_free() */
+	g_object_get(glsink, "widget", &data->video_window, NULL);
+	return 0;
+}
+
+static gboolean step_draw_cb(GtkWidget * widget, cairo_t * cr,
+			     PlayerData * data)
+{
+	return player_audio_draw(data, widget, cr) ||
+	    player_step_draw(data, widget, cr);
+}
+
 static gboolean draw_cb(GtkWidget * widget, cairo_t * cr, PlayerData * data)
 {
 	FUNC_ENTER;
+	if (player_audio_draw(data, widget, cr))
+		return TRUE;
+	/* Stepping back through cached frames, the sink doesn't have them */
+	if (player_step_draw(data, widget, cr))
+		return TRUE;
 	if (data->state < GST_STATE_PAUSED) {
 		GtkAllocation allocation;
 
@@ -73,149 +151,1223 @@ static gboolean draw_cb(GtkWidget * widget, cairo_t * cr, PlayerData * data)
 /*                             keyboard management                            */
 /******************************************************************************/
 
-/* this mapping follow the mplayer key-bindings */
-static gboolean
-key_press_event_cb(GtkWidget * widget, GdkEventKey * event, gpointer data)
-{
-	PlayerData *pdata = (PlayerData *) data;
+static void snapshot_done_cb(PlayerData * data, const gchar * path,
+			     gint result, gpointer user_data)
+{
+	if (result == 0)
+		g_print("Saved %s\n", path);
+}
+
+/* Save the frame on screen in the pictures directory, named after its
+ * position */
+static void snapshot(PlayerData * data)
+{
+	const gchar *dir = g_get_user_special_dir(G_USER_DIRECTORY_PICTURES);
+	gint64 position = 0;
+	gchar *name, *path;
+
+	gst_element_query_position(data->playbin, GST_FORMAT_TIME, &position);
+	name = g_strdup_printf("gtkplayer-%" G_GINT64_FORMAT ".png",
+			       position / GST_MSECOND);
+	path = g_build_filename(dir ? dir : g_get_home_dir(), name, NULL);
+	if (player_snapshot(data, path, 0, 0, snapshot_done_cb, NULL) < 0)
+		g_printerr("No frame to save\n");
+	g_free(path);
+	g_free(name);
+}
+
+/* this mapping follow the mplayer key-bindings */
+static gboolean
+key_press_event_cb(GtkWidget * widget, GdkEventKey * event, gpointer data)
+{
+	PlayerData *pdata = (PlayerData *) data;
+
+	if (event->state != 0 &&
+	    ((event->state & GDK_CONTROL_MASK) || (event->state & GDK_MOD1_MASK)
+	     || (event->state & GDK_MOD3_MASK)
+	     || (event->state & GDK_MOD4_MASK)))
+		return FALSE;
+
+	if (event->type != GDK_KEY_PRESS)
+		return FALSE;
+
+	switch (event->keyval) {
+	case GDK_KEY_bracketleft:
+		player_set_rate(pdata, pdata->rate * 0.9);
+		break;
+	case GDK_KEY_bracketright:
+		player_set_rate(pdata, pdata->rate * 1.1);
+		break;
+	case GDK_KEY_braceleft:
+		player_set_rate(pdata, pdata->rate / 2);
+		break;
+	case GDK_KEY_braceright:
+		player_set_rate(pdata, pdata->rate * 2);
+		break;
+	case GDK_KEY_BackSpace:
+		player_set_rate(pdata, 1.0);
+		break;
+	case GDK_KEY_r:
+		/* Not in mplayer: play backward at the same speed */
+		player_set_rate(pdata, -pdata->rate);
+		break;
+	case GDK_KEY_period:
+		/* Frame steps, mpv style */
+		player_step(pdata, 1);
+		break;
+	case GDK_KEY_comma:
+		player_step(pdata, -1);
+		break;
+	case GDK_KEY_s:
+		snapshot(pdata);
+		break;
+	case GDK_KEY_v:
+		player_set_subtitles_visible(pdata,
+					     !player_get_subtitles_visible
+					     (pdata));
+		break;
+	case GDK_KEY_j:{
+			/* Cycle through the embedded text streams */
+			gint current = -1, n = 0;
+
+			g_object_get(pdata->playbin, "current-text", &current,
+				     "n-text", &n, NULL);
+			if (n)
+				player_set_text_stream(pdata, (current + 1) % n);
+			break;
+		}
+	case GDK_KEY_f:{
+			/* Toggle fullscreen */
+			GtkToggleButton *fs =
+			    GTK_TOGGLE_BUTTON(pdata->fullscreen_button);
+			gboolean active = !gtk_toggle_button_get_active(fs);
+			DBG("GDK_KEY_f pressed");
+			gtk_toggle_button_set_active(fs, active);
+			break;
+		}
+	default:
+		return FALSE;
+	}
+
+	/* Handled: not seen twice when the video is in the fullscreen window */
+	return TRUE;
+}
+
+/******************************************************************************/
+/*                           Fullscreen management                            */
+/******************************************************************************/
+
+/* Move the video widget into another container without destroying it */
+static void move_video_window(PlayerData * data, GtkWidget * dest)
+{
+	GtkWidget *parent = gtk_widget_get_parent(data->video_window);
+
+	g_object_ref(data->video_window);
+	gtk_container_remove(GTK_CONTAINER(parent), data->video_window);
+	if (GTK_IS_BOX(dest)) {
+		gtk_box_pack_start(GTK_BOX(dest), data->video_window, TRUE,
+				   TRUE, 0);
+		gtk_box_reorder_child(GTK_BOX(dest), data->video_window, 0);
+	} else {
+		gtk_container_add(GTK_CONTAINER(dest), data->video_window);
+	}
+	g_object_unref(data->video_window);
+}
+
+/* Closing the fullscreen window only leaves fullscreen mode */
+static gboolean
+fullscreen_delete_cb(GtkWidget * widget, GdkEvent * event, PlayerData * data)
+{
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON
+				     (data->fullscreen_button), FALSE);
+	return TRUE;
+}
+
+/* The fullscreen window lives as long as the player and is only shown or
+ * hidden. In overlay mode it owns a second drawing area, realized up front
+ * so that toggling only swaps the overlay handle: the pipeline state is
+ * never touched. */
+static void create_fullscreen_window(PlayerData * data)
+{
+	FUNC_ENTER;
+
+	data->fullscreen_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	g_signal_connect(G_OBJECT(data->fullscreen_window), "key-press-event",
+			 G_CALLBACK(key_press_event_cb), data);
+	g_signal_connect(G_OBJECT(data->fullscreen_window), "delete-event",
+			 G_CALLBACK(fullscreen_delete_cb), data);
+
+	if (data->render_mode == PLAYER_RENDER_OVERLAY) {
+		data->fullscreen_area = gtk_drawing_area_new();
+		g_signal_connect(data->fullscreen_area, "draw",
+				 G_CALLBACK(draw_cb), data);
+		gtk_container_add(GTK_CONTAINER(data->fullscreen_window),
+				  data->fullscreen_area);
+		gtk_widget_show(data->fullscreen_area);
+	}
+}
+
+/* This function is called when the FULLSCREEN button is clicked */
+static void fullscreen_cb(GtkButton * button, PlayerData * data)
+{
+	FUNC_ENTER;
+	if (!data)
+		g_error("No player instantiated");
+
+	/* The next frame reaching the sink closes the measurement */
+	g_mutex_lock(&data->stats_lock);
+	data->toggle_time = gst_util_get_timestamp();
+	g_mutex_unlock(&data->stats_lock);
+
+	if (!data->isfullscreen) {
+		DBG("enter full screen mode");
+		if (data->render_mode == PLAYER_RENDER_GTK_SINK)
+			move_video_window(data, data->fullscreen_window);
+		else if (data->fullscreen_handle)
+			gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY
+							    (data->playbin),
+							    data->fullscreen_handle);
+		gtk_window_fullscreen(GTK_WINDOW(data->fullscreen_window));
+		gtk_widget_show(data->fullscreen_window);
+		data->isfullscreen = TRUE;
+	} else {
+		DBG("quit  full screen mode");
+		if (data->render_mode == PLAYER_RENDER_GTK_SINK)
+			move_video_window(data, data->video_box);
+		else
+			gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY
+							    (data->playbin),
+							    data->window_handle);
+		gtk_widget_hide(data->fullscreen_window);
+		data->isfullscreen = FALSE;
+	}
+
+	/* Redraw the current frame right away, even when paused */
+	if (data->render_mode == PLAYER_RENDER_OVERLAY
+	    && data->state >= GST_STATE_PAUSED)
+		gst_video_overlay_expose(GST_VIDEO_OVERLAY(data->playbin));
+}
+
+/******************************************************************************/
+
+static gboolean video_button_press_cb(GtkWidget * widget,
+				      GdkEventButton * event, gpointer data)
+{
+	gtk_widget_grab_focus(widget);
+	return FALSE;
+}
+
+/* Hand the native windows of the video areas to the sink, once realized */
+void player_attach_window(PlayerData * data)
+{
+	if (data->render_mode != PLAYER_RENDER_OVERLAY || !data->video_window
+	    || !gtk_widget_get_realized(data->video_window))
+		return;
+
+	data->window_handle = get_window_handle(data->video_window);
+	/* Realize the hidden fullscreen area now rather than on toggle */
+	if (data->fullscreen_area && !data->fullscreen_handle) {
+		gtk_widget_realize(data->fullscreen_area);
+		data->fullscreen_handle =
+		    get_window_handle(data->fullscreen_area);
+	}
+	if (data->isfullscreen && data->fullscreen_handle)
+		gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY
+						    (data->playbin),
+						    data->fullscreen_handle);
+	else if (data->window_handle)
+		gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY
+						    (data->playbin),
+						    data->window_handle);
+}
+
+static void realize_cb(GtkWidget * widget, PlayerData * data)
+{
+	FUNC_ENTER;
+	/* In audio only mode there is nothing to render there, don't even
+	 * create native windows: player_set_audio_only() does it when left */
+	if (data && !data->audio_only)
+		player_attach_window(data);
+}
+
+/******************************************************************************/
+/*                               Decoder policy                               */
+/******************************************************************************/
+
+/* Mirrors GstAutoplugSelectResult, which is not in a public header */
+typedef enum {
+	AUTOPLUG_SELECT_TRY,
+	AUTOPLUG_SELECT_EXPOSE,
+	AUTOPLUG_SELECT_SKIP
+} AutoplugSelectResult;
+
+/* Rank of a decoder for this player: the override if any, else the registry
+ * rank. GST_RANK_NONE means the decoder must not be used. */
+static gint decoder_rank(PlayerData * data, GstElementFactory * factory)
+{
+	const gchar *name =
+	    gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory));
+	gpointer rank;
+	gint ret;
+
+	g_mutex_lock(&data->policy_lock);
+	if (data->decoder_allow
+	    && !g_strv_contains((const gchar * const *)data->decoder_allow,
+				name))
+		ret = GST_RANK_NONE;
+	else if (data->decoder_ranks
+		 && g_hash_table_lookup_extended(data->decoder_ranks, name,
+						 NULL, &rank))
+		ret = GPOINTER_TO_INT(rank);
+	else
+		ret = gst_plugin_feature_get_rank(GST_PLUGIN_FEATURE(factory));
+	g_mutex_unlock(&data->policy_lock);
+
+	return ret;
+}
+
+static gboolean is_decoder(GstElementFactory * factory)
+{
+	return gst_element_factory_list_is_type(factory,
+						GST_ELEMENT_FACTORY_TYPE_DECODER);
+}
+
+static gboolean has_decoder_policy(PlayerData * data)
+{
+	gboolean ret;
+
+	g_mutex_lock(&data->policy_lock);
+	ret = data->decoder_allow || data->decoder_ranks;
+	g_mutex_unlock(&data->policy_lock);
+
+	return ret;
+}
+
+static gint
+compare_factories(GstElementFactory * a, GstElementFactory * b,
+		  PlayerData * data)
+{
+	return decoder_rank(data, b) - decoder_rank(data, a);
+}
+
+/* decodebin asks us to order its candidates: decoders are sorted with our
+ * ranks, denied ones removed. Other factories keep their order. */
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+static GValueArray *autoplug_sort_cb(GstElement * decodebin, GstPad * pad,
+				     GstCaps * caps, GValueArray * factories,
+				     PlayerData * data)
+{
+	GList *decoders = NULL, *l;
+	GValueArray *result;
+	GValue value = G_VALUE_INIT;
+	guint i;
+
+	if (!has_decoder_policy(data))
+		return NULL;
+
+	result = g_value_array_new(factories->n_values);
+	for (i = 0; i < factories->n_values; i++) {
+		GstElementFactory *factory =
+		    g_value_get_object(g_value_array_get_nth(factories, i));
+
+		if (!is_decoder(factory))
+			g_value_array_append(result,
+					     g_value_array_get_nth(factories,
+								   i));
+		else if (decoder_rank(data, factory) > GST_RANK_NONE)
+			decoders = g_list_prepend(decoders, factory);
+	}
+	decoders = g_list_sort_with_data(g_list_reverse(decoders),
+					 (GCompareDataFunc) compare_factories,
+					 data);
+
+	g_value_init(&value, GST_TYPE_ELEMENT_FACTORY);
+	for (l = decoders; l; l = l->next) {
+		g_value_set_object(&value, l->data);
+		g_value_array_append(result, &value);
+	}
+	g_value_unset(&value);
+	g_list_free(decoders);
+
+	return result;
+}
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+/* Last line of defence, in case another handler sorted the list */
+static AutoplugSelectResult
+autoplug_select_cb(GstElement * decodebin, GstPad * pad, GstCaps * caps,
+		   GstElementFactory * factory, PlayerData * data)
+{
+	if (is_decoder(factory) && decoder_rank(data, factory) == GST_RANK_NONE) {
+		DBG("decoder denied by policy");
+		return AUTOPLUG_SELECT_SKIP;
+	}
+	return AUTOPLUG_SELECT_TRY;
+}
+
+/* Record which decoder handles which input once it gets its caps */
+static GstPadProbeReturn
+decoder_caps_probe_cb(GstPad * pad, GstPadProbeInfo * info, PlayerData * data)
+{
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+	GstElement *decoder;
+	GstCaps *caps;
+	gchar *entry;
+
+	if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+		return GST_PAD_PROBE_OK;
+
+	gst_event_parse_caps(event, &caps);
+	decoder = gst_pad_get_parent_element(pad);
+	if (decoder) {
+		entry =
+		    g_strdup_printf("%s=%s",
+				    gst_structure_get_name
+				    (gst_caps_get_structure(caps, 0)),
+				    gst_plugin_feature_get_name
+				    (GST_PLUGIN_FEATURE
+				     (gst_element_get_factory(decoder))));
+		g_mutex_lock(&data->policy_lock);
+		g_ptr_array_add(data->next_decoders ? data->next_decoders :
+				data->decoders, entry);
+		g_mutex_unlock(&data->policy_lock);
+		player_streams_set_decoder(data, decoder, caps);
+		gst_object_unref(decoder);
+	}
+
+	return GST_PAD_PROBE_REMOVE;
+}
+
+static void watch_decoder(PlayerData * data, GstElement * decoder)
+{
+	GstPad *pad = gst_element_get_static_pad(decoder, "sink");
+
+	if (pad) {
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+				  (GstPadProbeCallback) decoder_caps_probe_cb,
+				  data, NULL);
+		gst_object_unref(pad);
+	}
+}
+
+static void clear_decoders(PlayerData * data)
+{
+	g_mutex_lock(&data->policy_lock);
+	g_ptr_array_set_size(data->decoders, 0);
+	g_clear_pointer(&data->next_decoders, g_ptr_array_unref);
+	g_mutex_unlock(&data->policy_lock);
+	player_streams_clear(data);
+}
+
+/* about-to-finish: decoders plugged from now on are the queued item's.
+ * They are recorded aside, the current item keeps its own until the
+ * switch. */
+static void queue_decoders(PlayerData * data)
+{
+	g_mutex_lock(&data->policy_lock);
+	g_clear_pointer(&data->next_decoders, g_ptr_array_unref);
+	data->next_decoders = g_ptr_array_new_with_free_func(g_free);
+	g_mutex_unlock(&data->policy_lock);
+	player_streams_queue_next(data);
+}
+
+/* STREAM_START of the queued item */
+static void switch_decoders(PlayerData * data)
+{
+	g_mutex_lock(&data->policy_lock);
+	if (data->next_decoders) {
+		g_ptr_array_unref(data->decoders);
+		data->decoders = data->next_decoders;
+		data->next_decoders = NULL;
+	}
+	g_mutex_unlock(&data->policy_lock);
+	player_streams_switch(data);
+}
+
+/* Override the rank of a decoder for this player only. GST_RANK_NONE (0)
+ * excludes it, a negative rank removes the override. */
+void player_set_decoder_rank(PlayerData * data, const gchar * factory,
+			     gint rank)
+{
+	if (!data || !factory)
+		return;
+
+	g_mutex_lock(&data->policy_lock);
+	if (!data->decoder_ranks)
+		data->decoder_ranks =
+		    g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					  NULL);
+	if (rank < 0)
+		g_hash_table_remove(data->decoder_ranks, factory);
+	else
+		g_hash_table_insert(data->decoder_ranks, g_strdup(factory),
+				    GINT_TO_POINTER(rank));
+	g_mutex_unlock(&data->policy_lock);
+}
+
+/* Only use the listed decoders, NULL allows every decoder again */
+void player_set_decoder_allow_list(PlayerData * data,
+				   const gchar * const *factories)
+{
+	if (!data)
+		return;
+
+	g_mutex_lock(&data->policy_lock);
+	g_strfreev(data->decoder_allow);
+	data->decoder_allow = g_strdupv((gchar **) factories);
+	g_mutex_unlock(&data->policy_lock);
+}
+
+/* Decoders in use, as "input/media-type=factory" strings. Free with
+ * g_strfreev(). */
+gchar **player_get_decoders(PlayerData * data)
+{
+	gchar **decoders;
+	guint i;
+
+	if (!data)
+		return NULL;
+
+	g_mutex_lock(&data->policy_lock);
+	decoders = g_new0(gchar *, data->decoders->len + 1);
+	for (i = 0; i < data->decoders->len; i++)
+		decoders[i] = g_strdup(g_ptr_array_index(data->decoders, i));
+	g_mutex_unlock(&data->policy_lock);
+
+	return decoders;
+}
+
+/******************************************************************************/
+/*                               Preroll timing                               */
+/******************************************************************************/
+
+static void reset_preroll_times(PlayerData * data)
+{
+	data->preroll.typefind = GST_CLOCK_TIME_NONE;
+	data->preroll.demux = GST_CLOCK_TIME_NONE;
+	data->preroll.decoder = GST_CLOCK_TIME_NONE;
+	data->preroll.first_buffer = GST_CLOCK_TIME_NONE;
+	data->preroll.prerolled = GST_CLOCK_TIME_NONE;
+}
+
+/* Called before the pipeline leaves READY: stage times are relative to it.
+ * The cached state lags behind set_state(), a new uri stops the timing so
+ * the next start is never taken for a resume. */
+static void start_preroll_timing(PlayerData * data)
+{
+	if (data->state >= GST_STATE_PAUSED
+	    && GST_CLOCK_TIME_IS_VALID(data->preroll_start))
+		return;
+
+	g_mutex_lock(&data->stats_lock);
+	data->preroll_start = gst_util_get_timestamp();
+	reset_preroll_times(data);
+	g_mutex_unlock(&data->stats_lock);
+}
+
+static void stop_preroll_timing(PlayerData * data)
+{
+	g_mutex_lock(&data->stats_lock);
+	data->preroll_start = GST_CLOCK_TIME_NONE;
+	reset_preroll_times(data);
+	g_mutex_unlock(&data->stats_lock);
+}
+
+/* Only the first occurrence of a stage counts */
+static void mark_preroll_stage(PlayerData * data, GstClockTime * stage)
+{
+	g_mutex_lock(&data->stats_lock);
+	if (GST_CLOCK_TIME_IS_VALID(data->preroll_start)
+	    && !GST_CLOCK_TIME_IS_VALID(*stage))
+		*stage = gst_util_get_timestamp() - data->preroll_start;
+	g_mutex_unlock(&data->stats_lock);
+}
+
+static void
+have_type_cb(GstElement * typefind, guint probability, GstCaps * caps,
+	     PlayerData * data)
+{
+	mark_preroll_stage(data, &data->preroll.typefind);
+}
+
+static void demux_no_more_pads_cb(GstElement * demux, PlayerData * data)
+{
+	mark_preroll_stage(data, &data->preroll.demux);
+}
+
+static GstPadProbeReturn
+decoder_probe_cb(GstPad * pad, GstPadProbeInfo * info, PlayerData * data)
+{
+	mark_preroll_stage(data, &data->preroll.first_buffer);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* Called from whatever thread plugs elements anywhere inside playbin */
+static void
+deep_element_added_cb(GstBin * bin, GstBin * sub_bin, GstElement * element,
+		      PlayerData * data)
+{
+	GstElementFactory *factory = gst_element_get_factory(element);
+	const gchar *klass;
+	GstPad *pad;
+
+	if (!factory)
+		return;
+
+	klass =
+	    gst_element_factory_get_metadata(factory,
+					      GST_ELEMENT_METADATA_KLASS);
+	player_telemetry_element_added(data, element, klass);
+	player_buffering_element_added(data, sub_bin, element);
+	player_memory_element_added(data, element, klass);
+	player_live_element_added(data, element, klass);
+	if (g_strcmp0
+	    (gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)),
+	     "typefind") == 0) {
+		g_signal_connect(element, "have-type",
+				 G_CALLBACK(have_type_cb), data);
+	} else if (g_strcmp0
+		   (gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)),
+		    "decodebin") == 0) {
+		g_signal_connect(element, "autoplug-sort",
+				 G_CALLBACK(autoplug_sort_cb), data);
+		g_signal_connect(element, "autoplug-select",
+				 G_CALLBACK(autoplug_select_cb), data);
+	} else if (klass && strstr(klass, "Demux")) {
+		g_signal_connect(element, "no-more-pads",
+				 G_CALLBACK(demux_no_more_pads_cb), data);
+	} else if (klass && strstr(klass, "Decoder")) {
+		mark_preroll_stage(data, &data->preroll.decoder);
+		watch_decoder(data, element);
+		pad = gst_element_get_static_pad(element, "src");
+		if (pad) {
+			gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+					  (GstPadProbeCallback)
+					  decoder_probe_cb, data, NULL);
+			gst_object_unref(pad);
+		}
+	}
+}
+
+void player_get_preroll_times(PlayerData * data, PlayerPrerollTimes * times)
+{
+	if (!data || !times)
+		return;
+
+	g_mutex_lock(&data->stats_lock);
+	*times = data->preroll;
+	g_mutex_unlock(&data->stats_lock);
+}
+
+/* This function is called when the PLAY button is clicked. The state change
+ * runs on the control thread: the UI never waits for the pipeline. */
+static void play_pause_cb(GtkButton * button, PlayerData * data)
+{
+	FUNC_ENTER;
+
+	start_preroll_timing(data);
+
+	if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(button)))
+		/* If button is active, action is to pause */
+		player_command(data, PLAYER_COMMAND_PAUSE);
+	else
+		player_command(data, PLAYER_COMMAND_PLAY);
+}
+
+/* This function is called when the STOP button is clicked */
+static void stop_cb(GtkButton * button, PlayerData * data)
+{
+	FUNC_ENTER;
+	player_command(data, PLAYER_COMMAND_STOP);
+}
+
+/* Main thread: what stopping changes in PlayerData. Returns the state
+ * player_stop_pipeline() takes the pipeline to. */
+GstState player_stop_prepare(PlayerData * data)
+{
+	player_resume_save(data, FALSE);
+	player_buffering_reset(data, FALSE);
+	/* Stay prerolled at the beginning so the next play is instant */
+	if (data->preroll_mode && data->state >= GST_STATE_PAUSED)
+		return GST_STATE_PAUSED;
+	return GST_STATE_READY;
+}
+
+/* Any thread: only touches the pipeline */
+void player_stop_pipeline(PlayerData * data, GstState state)
+{
+	gst_element_set_state(data->playbin, state);
+	if (state == GST_STATE_PAUSED)
+		gst_element_seek_simple(data->playbin, GST_FORMAT_TIME,
+					GST_SEEK_FLAG_FLUSH, 0);
+}
+
+void player_do_stop(PlayerData * data)
+{
+	player_stop_pipeline(data, player_stop_prepare(data));
+}
+
+/* Show a state change made elsewhere on the play button, without clicking */
+void player_sync_controls(PlayerData * data, gboolean playing)
+{
+	if (!data->play_button)
+		return;
+
+	g_signal_handlers_block_by_func(data->play_button, play_pause_cb,
+					data);
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(data->play_button),
+				     playing);
+	g_signal_handlers_unblock_by_func(data->play_button, play_pause_cb,
+					  data);
+}
+
+/******************************************************************************/
+/*                              Position updates                              */
+/******************************************************************************/
+
+/* Query the stream duration if we don't know it yet. It is only forgotten on
+ * DURATION_CHANGED or when the URI changes. */
+static void refresh_duration(PlayerData * data)
+{
+	FUNC_ENTER;
+	if (data->state < GST_STATE_PAUSED
+	    || GST_CLOCK_TIME_IS_VALID(data->duration))
+		return;
+
+	if (!gst_element_query_duration
+	    (data->playbin, GST_FORMAT_TIME, &data->duration)) {
+		g_printerr("Could not query current duration.\n");
+	} else if (data->slider) {
+		/* Set the range of the slider to the clip duration, in SECONDS */
+		gtk_range_set_range(GTK_RANGE(data->slider), 0,
+				    (gdouble) data->duration / GST_SECOND);
+	}
+}
+
+static void refresh_position(PlayerData * data)
+{
+	gint64 current = -1;
+
+	/* We do not want to update anything unless we are in the PAUSED or PLAYING
+	 * states, and we leave the slider alone while the user drags it */
+	if (data->state < GST_STATE_PAUSED || data->scrubbing || !data->slider)
+		return;
+
+	if (gst_element_query_position
+	    (data->playbin, GST_FORMAT_TIME, &current)) {
+		/* Block the "value-changed" signal, so the slider_cb function is not called
+		 * (which would trigger a seek the user has not requested) */
+		g_signal_handler_block(data->slider,
+				       data->slider_update_signal_id);
+		/* Set the position of the slider to the current pipeline positoin, in SECONDS */
+		gtk_range_set_value(GTK_RANGE(data->slider),
+				    (gdouble) current / GST_SECOND);
+		/* Re-enable the signal */
+		g_signal_handler_unblock(data->slider,
+					 data->slider_update_signal_id);
+	}
+}
+
+/* Runs with the slider's frame clock while playing. Querying more often than
+ * the slider can move by one pixel is useless, so short clips update every
+ * frame and long ones less often. */
+static gboolean
+position_tick_cb(GtkWidget * widget, GdkFrameClock * clock, PlayerData * data)
+{
+	gint64 now = gdk_frame_clock_get_frame_time(clock);
+	gint width = gtk_widget_get_allocated_width(widget);
+	gint64 step = 0;
+
+	if (GST_CLOCK_TIME_IS_VALID(data->duration) && width > 0)
+		step = GST_TIME_AS_USECONDS(data->duration) / width;
+	if (now - data->last_position_update < step)
+		return G_SOURCE_CONTINUE;
+
+	data->last_position_update = now;
+	refresh_position(data);
+	player_resume_tick(data);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Position updates only run while playing: nothing wakes up when paused */
+static void set_position_updates(PlayerData * data, gboolean enable)
+{
+	if (!data->slider)
+		return;
+
+	if (enable && !data->tick_id) {
+		data->last_position_update = 0;
+		data->tick_id =
+		    gtk_widget_add_tick_callback(data->slider,
+						 (GtkTickCallback)
+						 position_tick_cb, data, NULL);
+	} else if (!enable && data->tick_id) {
+		gtk_widget_remove_tick_callback(data->slider, data->tick_id);
+		data->tick_id = 0;
+	}
+}
+
+/******************************************************************************/
+/*                              Seek / scrubbing                              */
+/******************************************************************************/
+
+/* Beyond these speeds the decoders would not keep up: audio is skipped, then
+ * only keyframes are decoded. Backward playback is keyframes only. */
+#define RATE_NO_AUDIO 2.0
+#define RATE_KEY_UNITS 4.0
+#define RATE_MIN 0.25
+#define RATE_MAX 32.0
+
+static GstSeekFlags trick_flags(gdouble rate)
+{
+	if (rate < 0 || rate > RATE_KEY_UNITS)
+		return GST_SEEK_FLAG_TRICKMODE |
+		    GST_SEEK_FLAG_TRICKMODE_KEY_UNITS |
+		    GST_SEEK_FLAG_TRICKMODE_NO_AUDIO;
+	if (rate > RATE_NO_AUDIO)
+		return GST_SEEK_FLAG_TRICKMODE |
+		    GST_SEEK_FLAG_TRICKMODE_NO_AUDIO;
+	return 0;
+}
+
+/* Backward playback runs from position down to the start */
+gboolean player_seek_at_rate(PlayerData * data, gint64 position, gdouble rate,
+			     GstSeekFlags flags)
+{
+	/* Nothing to seek in, and a flush would only add latency */
+	if (player_is_live(data))
+		return FALSE;
+	player_step_reset(data);
+	flags |= trick_flags(rate);
+	if (rate > 0)
+		return gst_element_seek(data->playbin, rate, GST_FORMAT_TIME,
+					flags, GST_SEEK_TYPE_SET, position,
+					GST_SEEK_TYPE_NONE,
+					GST_CLOCK_TIME_NONE);
+
+	return gst_element_seek(data->playbin, rate, GST_FORMAT_TIME, flags,
+				GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET,
+				position);
+}
+
+static void do_seek(PlayerData * data, gdouble seconds, GstSeekFlags flags)
+{
+	/* Measure from the first seek the user is still waiting for */
+	g_mutex_lock(&data->stats_lock);
+	if (!GST_CLOCK_TIME_IS_VALID(data->seek_time))
+		data->seek_time = gst_util_get_timestamp();
+	g_mutex_unlock(&data->stats_lock);
+
+	if (player_seek_at_rate(data, (gint64) (seconds * GST_SECOND),
+				data->rate, flags))
+		data->seek_in_flight = TRUE;
+}
+
+/* Speeds from RATE_MIN to RATE_MAX, negative plays backward. Applied by the
+ * control thread with a seek from the current position. */
+gint player_set_rate(PlayerData * data, gdouble rate)
+{
+	gdouble speed;
+
+	if (!data || rate == 0.0)
+		return -EINVAL;
+
+	speed = CLAMP(ABS(rate), RATE_MIN, RATE_MAX);
+	data->rate = rate < 0 ? -speed : speed;
+	return player_command_rate(data, data->rate);
+}
+
+gdouble player_get_rate(PlayerData * data)
+{
+	return data ? data->rate : 1.0;
+}
+
+/* Issue the pending target, unless a seek is still running: motion events
+ * received meanwhile only move the target, and the next seek goes out on
+ * ASYNC_DONE. While dragging we jump to the nearest keyframe and only decode
+ * keyframes; the final seek on release is accurate. */
+static void scrub_flush(PlayerData * data)
+{
+	GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+	gdouble target = data->seek_target;
+
+	if (data->seek_in_flight || target < 0
+	    || data->state < GST_STATE_PAUSED)
+		return;
+
+	if (data->scrubbing)
+		flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST |
+		    GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS;
+	else
+		flags |= GST_SEEK_FLAG_ACCURATE;
+
+	data->seek_target = -1;
+	do_seek(data, target, flags);
+}
+
+static gboolean
+slider_press_cb(GtkWidget * widget, GdkEventButton * event, PlayerData * data)
+{
+	data->scrubbing = TRUE;
+	return FALSE;
+}
+
+static gboolean
+slider_release_cb(GtkWidget * widget, GdkEventButton * event,
+		  PlayerData * data)
+{
+	data->scrubbing = FALSE;
+	if (data->scrub_mode) {
+		data->seek_target = gtk_range_get_value(GTK_RANGE(data->slider));
+		scrub_flush(data);
+	}
+	return FALSE;
+}
+
+/* Show the cached thumbnail of the hovered position, if we have one */
+static gboolean
+slider_motion_cb(GtkWidget * widget, GdkEventMotion * event,
+		 PlayerData * data)
+{
+	GtkAllocation allocation;
+	GdkRectangle rect;
+	GdkPixbuf *thumb;
+	gdouble ratio;
+
+	if (!data->thumbnailer || !GST_CLOCK_TIME_IS_VALID(data->duration))
+		return FALSE;
+
+	gtk_widget_get_allocation(widget, &allocation);
+	ratio = CLAMP(event->x / allocation.width, 0, 1);
+	thumb = player_thumbnailer_lookup(data->thumbnailer,
+					  ratio * data->duration);
+	if (!thumb) {
+		gtk_widget_hide(data->preview);
+		return FALSE;
+	}
+
+	gtk_image_set_from_pixbuf(GTK_IMAGE(data->preview_image), thumb);
+	g_object_unref(thumb);
+	rect.x = event->x;
+	rect.y = 0;
+	rect.width = rect.height = 1;
+	gtk_popover_set_pointing_to(GTK_POPOVER(data->preview), &rect);
+	gtk_widget_show(data->preview);
+
+	return FALSE;
+}
+
+static gboolean
+slider_leave_cb(GtkWidget * widget, GdkEventCrossing * event,
+		PlayerData * data)
+{
+	gtk_widget_hide(data->preview);
+	return FALSE;
+}
+
+/* This function is called when the slider changes its position. We perform a seek to the
+ * new position here. */
+static void slider_cb(GtkRange * range, PlayerData * data)
+{
+	gdouble value = gtk_range_get_value(GTK_RANGE(data->slider));
+	FUNC_ENTER;
+	if (!data->scrub_mode) {
+		do_seek(data, value,
+			GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT);
+		return;
+	}
+	data->seek_target = value;
+	scrub_flush(data);
+}
+
+/* This function is called when an asynchronous state change (a flushing seek
+ * here) completed */
+static void async_done_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	FUNC_ENTER;
+	if (GST_MESSAGE_SRC(msg) != GST_OBJECT(data->playbin))
+		return;
+
+	data->seek_in_flight = FALSE;
+	scrub_flush(data);
+	player_step_async_done(data);
+
+	/* Show where a seek landed even when paused */
+	refresh_duration(data);
+	refresh_position(data);
+}
+
+/* A frame step is over, the sink posts this one */
+static void step_done_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	FUNC_ENTER;
+	player_step_done(data);
+}
+
+/* This function is called when the stream duration changed, e.g. while a
+ * growing file or a live stream is played */
+static void
+duration_changed_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	FUNC_ENTER;
+	data->duration = GST_CLOCK_TIME_NONE;
+	refresh_duration(data);
+}
+
+/******************************************************************************/
+/*                             Render statistics                              */
+/******************************************************************************/
+
+static GstPadProbeReturn
+render_probe_cb(GstPad * pad, GstPadProbeInfo * info, PlayerData * data)
+{
+	GstClockTime now = gst_util_get_timestamp();
+	PlayerRenderStats *stats = &data->render_stats;
+
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+		GstCaps *caps;
+
+		/* A new item: the next frame closes the gap measurement */
+		if (GST_EVENT_TYPE(event) == GST_EVENT_STREAM_START
+		    && stats->frames) {
+			g_mutex_lock(&data->stats_lock);
+			data->item_switch = TRUE;
+			g_mutex_unlock(&data->stats_lock);
+		}
+
+		if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+			gst_event_parse_caps(event, &caps);
+			g_mutex_lock(&data->stats_lock);
+			stats->copies_per_frame =
+			    gst_caps_features_contains(gst_caps_get_features
+						       (caps, 0),
+						       "memory:GLMemory") ? 0 :
+			    1;
+			g_mutex_unlock(&data->stats_lock);
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	g_mutex_lock(&data->stats_lock);
+	if (GST_CLOCK_TIME_IS_VALID(data->last_frame_time)) {
+		GstClockTime interval = now - data->last_frame_time;
+
+		stats->mean_interval =
+		    (stats->mean_interval * (stats->frames - 1) +
+		     interval) / stats->frames;
+		stats->max_interval = MAX(stats->max_interval, interval);
+	}
+	if (data->item_switch && GST_CLOCK_TIME_IS_VALID(data->last_frame_time)) {
+		GstClockTime delta = now - data->last_frame_time;
+
+		/* Anything beyond one frame interval is a visible gap */
+		stats->item_gap = delta > stats->mean_interval ?
+		    delta - stats->mean_interval : 0;
+		data->item_switch = FALSE;
+		DBG("playlist item switch, gap %.2f ms", stats->item_gap / 1e6);
+	}
+
+	data->last_frame_time = now;
+	if (!stats->frames)
+		stats->first_frame = now;
+	stats->frames++;
+
+	if (GST_CLOCK_TIME_IS_VALID(data->seek_time)) {
+		GstClockTime latency = now - data->seek_time;
+
+		stats->seeks++;
+		stats->last_seek_latency = latency;
+		stats->mean_seek_latency =
+		    (stats->mean_seek_latency * (stats->seeks - 1) +
+		     latency) / stats->seeks;
+		data->seek_time = GST_CLOCK_TIME_NONE;
+	}
 
-	if (event->state != 0 &&
-	    ((event->state & GDK_CONTROL_MASK) || (event->state & GDK_MOD1_MASK)
-	     || (event->state & GDK_MOD3_MASK)
-	     || (event->state & GDK_MOD4_MASK)))
-		return FALSE;
+	if (GST_CLOCK_TIME_IS_VALID(data->step_time)) {
+		GstClockTime latency = now - data->step_time;
 
-	if (event->type != GDK_KEY_PRESS)
-		return FALSE;
+		if (data->step_forward) {
+			stats->steps_forward++;
+			stats->step_forward_latency =
+			    (stats->step_forward_latency *
+			     (stats->steps_forward - 1) +
+			     latency) / stats->steps_forward;
+		} else {
+			stats->steps_backward++;
+			stats->step_backward_latency =
+			    (stats->step_backward_latency *
+			     (stats->steps_backward - 1) +
+			     latency) / stats->steps_backward;
+		}
+		data->step_time = GST_CLOCK_TIME_NONE;
+	}
 
-	switch (event->keyval) {
-	case GDK_KEY_f:{
-			/* Toggle fullscreen */
-			GtkToggleButton *fs =
-			    GTK_TOGGLE_BUTTON(pdata->fullscreen_button);
-			gboolean active = !gtk_toggle_button_get_active(fs);
-			DBG("GDK_KEY_f pressed");
-			gtk_toggle_button_set_active(fs, active);
-			break;
+	if (GST_CLOCK_TIME_IS_VALID(data->toggle_time)) {
+		stats->toggle_latency = now - data->toggle_time;
+		data->toggle_time = GST_CLOCK_TIME_NONE;
+	}
+
+	/* How late the frame reaches the sink compared to its due time */
+	if (GST_BUFFER_PTS_IS_VALID(GST_PAD_PROBE_INFO_BUFFER(info))) {
+		GstEvent *event =
+		    gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+		GstElement *sink = GST_ELEMENT(gst_pad_get_parent(pad));
+		GstClock *clock = sink ? gst_element_get_clock(sink) : NULL;
+
+		if (event && clock) {
+			const GstSegment *segment;
+			GstClockTime running;
+
+			gst_event_parse_segment(event, &segment);
+			running =
+			    gst_segment_to_running_time(segment,
+							GST_FORMAT_TIME,
+							GST_BUFFER_PTS
+							(GST_PAD_PROBE_INFO_BUFFER
+							 (info)));
+			if (GST_CLOCK_TIME_IS_VALID(running)) {
+				GstClockTimeDiff lateness =
+				    GST_CLOCK_DIFF(gst_element_get_base_time
+						   (sink) + running,
+						   gst_clock_get_time(clock));
+
+				data->lateness_sum += lateness;
+				stats->max_lateness =
+				    MAX(stats->max_lateness, lateness);
+				stats->mean_lateness =
+				    data->lateness_sum /
+				    (GstClockTimeDiff) stats->frames;
+			}
 		}
-	default:
-		break;
+		if (clock)
+			gst_object_unref(clock);
+		if (sink)
+			gst_object_unref(sink);
+		if (event)
+			gst_event_unref(event);
 	}
+	g_mutex_unlock(&data->stats_lock);
 
-	return FALSE;
+	player_step_record(data, pad, GST_PAD_PROBE_INFO_BUFFER(info));
+
+	return GST_PAD_PROBE_OK;
 }
 
-/******************************************************************************/
-/*                           Fullscreen management                            */
-/******************************************************************************/
+/* Watch the input of the video sink, whichever sink playbin ended up with */
+static void install_render_probe(PlayerData * data)
+{
+	GstElement *sink = NULL;
+	GstPad *pad;
+
+	g_object_get(data->playbin, "video-sink", &sink, NULL);
+	if (!sink)
+		return;
+
+	pad = gst_element_get_static_pad(sink, "sink");
+	if (pad) {
+		data->last_frame_time = GST_CLOCK_TIME_NONE;
+		data->render_probe_id =
+		    gst_pad_add_probe(pad,
+				      GST_PAD_PROBE_TYPE_BUFFER |
+				      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+				      (GstPadProbeCallback) render_probe_cb,
+				      data, NULL);
+		gst_object_unref(pad);
+	}
+	gst_object_unref(sink);
+}
 
-static void full_realize_cb(GtkWidget * widget, PlayerData * data)
+/* In preroll mode a new URI is prerolled (PAUSED) right away */
+void player_set_preroll(PlayerData * data, gboolean enable)
 {
-	FUNC_ENTER;
-	gst_element_set_state(data->playbin, GST_STATE_PAUSED);
-	gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(data->playbin),
-					    get_window_handle(widget));
-	gst_element_set_state(data->playbin, GST_STATE_PLAYING);
+	if (data)
+		data->preroll_mode = enable;
 }
 
-/* This function is called when the STOP button is clicked */
-static void fullscreen_cb(GtkButton * button, PlayerData * data)
+void player_set_preview_interval(PlayerData * data, GstClockTime interval)
 {
-	FUNC_ENTER;
 	if (!data)
-		g_error("No player instantiated");
+		return;
 
-	if (!data->isfullscreen) {
-		GtkWidget *newda;
-		DBG("create full screen window");
-		data->fullscreen_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-		newda = gtk_drawing_area_new();
-		g_signal_connect(newda, "realize", G_CALLBACK(full_realize_cb),
-				 data);
-		g_signal_connect(newda, "draw", G_CALLBACK(draw_cb), data);
-		gtk_container_add(GTK_CONTAINER(data->fullscreen_window),
-				  newda);
-		gtk_window_fullscreen(GTK_WINDOW(data->fullscreen_window));
-		g_signal_connect(G_OBJECT(data->fullscreen_window),
-				 "key-press-event",
-				 G_CALLBACK(key_press_event_cb), data);
-		gtk_widget_show_all(data->fullscreen_window);
-		data->isfullscreen = TRUE;
-	} else {
-		DBG("quit  full screen mode");
-		gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY
-						    (data->playbin),
-						    data->window_handle);
-		gtk_widget_destroy(data->fullscreen_window);
-		data->isfullscreen = FALSE;
-	}
+	data->preview_interval = interval;
+	player_thumbnailer_free(data->thumbnailer);
+	data->thumbnailer = NULL;
+	if (interval && data->uri)
+		data->thumbnailer = player_thumbnailer_new(data->uri, interval);
 }
 
-/******************************************************************************/
-
-static void realize_cb(GtkWidget * widget, PlayerData * data)
+void player_set_scrub_mode(PlayerData * data, gboolean enable)
 {
-	FUNC_ENTER;
 	if (data)
-    {
-		data->window_handle = get_window_handle(widget);
-        if (data->window_handle)
-	    	gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(data->playbin),
-                    						    data->window_handle);
-    }
+		data->scrub_mode = enable;
 }
 
-/* This function is called when the PLAY button is clicked */
-static void play_pause_cb(GtkButton * button, PlayerData * data)
+void player_get_render_stats(PlayerData * data, PlayerRenderStats * stats)
 {
-    gint ret;
-	FUNC_ENTER;
+	if (!data || !stats)
+		return;
 
-	if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(button))) {
-		/* If button is active, action is to pause */
-		ret = gst_element_set_state(data->playbin, GST_STATE_PAUSED);
-	} else {
-		ret = gst_element_set_state(data->playbin, GST_STATE_PLAYING);
-        if (ret == GST_STATE_CHANGE_FAILURE) {
-			g_printerr ("Unable to set the pipeline to the playing state.\n");
-			gst_object_unref(data->playbin);
-		}
-	}
+	g_mutex_lock(&data->stats_lock);
+	*stats = data->render_stats;
+	g_mutex_unlock(&data->stats_lock);
 }
 
-/* This function is called when the STOP button is clicked */
-static void stop_cb(GtkButton * button, PlayerData * data)
+/* Sinks of PLAYER_RENDER_HEADLESS. They sync on the clock like real sinks,
+ * benchmarks turn "sync" off to decode as fast as possible. */
+static gint create_fake_sinks(PlayerData * data)
 {
 	FUNC_ENTER;
-	gst_element_set_state(data->playbin, GST_STATE_READY);
-}
 
-/* This function is called when the slider changes its position. We perform a seek to the
- * new position here. */
-static void slider_cb(GtkRange * range, PlayerData * data)
-{
-	gdouble value = gtk_range_get_value(GTK_RANGE(data->slider));
-	FUNC_ENTER;
-	gst_element_seek_simple(data->playbin, GST_FORMAT_TIME,
-				GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
-				(gint64) (value * GST_SECOND));
+	data->video_sink = gst_element_factory_make("fakesink", "video-sink");
+	data->audio_sink = gst_element_factory_make("fakesink", "audio-sink");
+	if (!data->video_sink || !data->audio_sink) {
+		g_printerr("Could not create fakesink.\n");
+		return -1;
+	}
+	gst_object_ref_sink(data->video_sink);
+	gst_object_ref_sink(data->audio_sink);
+
+	return 0;
 }
 
 /* This creates all the GTK+ widgets that compose our application, and registers the callbacks */
 static void create_ui(PlayerData * data)
 {
 	GtkWidget *main_hbox;	/* HBox to hold the video_window and the stream info text widget */
+	GtkWidget *side_box;	/* Stream info above the telemetry panel */
 	GtkWidget *controls, *sliderbox;	/* HBox to hold the buttons and the slider */
 	GtkWidget *stop_button;	/* Buttons */
 	GtkWidget *fs_img, *play_img, *stop_img;
 
 	FUNC_ENTER;
 
-	LOG("create drawing area");
-	data->video_window = gtk_drawing_area_new();
-	g_signal_connect(data->video_window, "realize", G_CALLBACK(realize_cb),
-			 data);
-	g_signal_connect(data->video_window, "draw", G_CALLBACK(draw_cb), data);
+	if (data->render_mode == PLAYER_RENDER_OVERLAY) {
+		LOG("create drawing area");
+		data->video_window = gtk_drawing_area_new();
+		g_signal_connect(data->video_window, "realize",
+				 G_CALLBACK(realize_cb), data);
+		g_signal_connect(data->video_window, "draw", G_CALLBACK(draw_cb),
+				 data);
+	} else if (data->render_mode == PLAYER_RENDER_GTK_SINK) {
+		/* Over the frame the sink widget just drew */
+		g_signal_connect_after(data->video_window, "draw",
+				       G_CALLBACK(step_draw_cb), data);
+	}
+
+	/* Key bindings only while the video has the focus: a click gives it,
+	 * the keys of the window we are embedded in stay the host's */
+	if (data->video_window) {
+		gtk_widget_set_can_focus(data->video_window, TRUE);
+		gtk_widget_add_events(data->video_window,
+				      GDK_KEY_PRESS_MASK |
+				      GDK_BUTTON_PRESS_MASK);
+		g_signal_connect(data->video_window, "key-press-event",
+				 G_CALLBACK(key_press_event_cb), data);
+		g_signal_connect(data->video_window, "button-press-event",
+				 G_CALLBACK(video_button_press_cb), NULL);
+	}
 
 	LOG("create button play");
 	data->play_button = gtk_toggle_button_new();
@@ -232,6 +1384,8 @@ static void create_ui(PlayerData * data)
 	g_signal_connect(G_OBJECT(stop_button), "clicked", G_CALLBACK(stop_cb),
 			 data);
 
+	create_fullscreen_window(data);
+
 	LOG("create fullscreen button");
 	data->fullscreen_button = gtk_toggle_button_new();
 	fs_img =
@@ -248,11 +1402,38 @@ static void create_ui(PlayerData * data)
 	data->slider_update_signal_id =
 	    g_signal_connect(G_OBJECT(data->slider), "value-changed",
 			     G_CALLBACK(slider_cb), data);
+	g_signal_connect(G_OBJECT(data->slider), "button-press-event",
+			 G_CALLBACK(slider_press_cb), data);
+	g_signal_connect(G_OBJECT(data->slider), "button-release-event",
+			 G_CALLBACK(slider_release_cb), data);
+
+	LOG("create slider preview");
+	data->preview_image = gtk_image_new();
+	gtk_widget_show(data->preview_image);
+	data->preview = gtk_popover_new(data->slider);
+	gtk_popover_set_modal(GTK_POPOVER(data->preview), FALSE);
+	gtk_popover_set_position(GTK_POPOVER(data->preview), GTK_POS_TOP);
+	gtk_container_add(GTK_CONTAINER(data->preview), data->preview_image);
+	gtk_widget_add_events(data->slider,
+			      GDK_POINTER_MOTION_MASK | GDK_LEAVE_NOTIFY_MASK);
+	g_signal_connect(G_OBJECT(data->slider), "motion-notify-event",
+			 G_CALLBACK(slider_motion_cb), data);
+	g_signal_connect(G_OBJECT(data->slider), "leave-notify-event",
+			 G_CALLBACK(slider_leave_cb), data);
 
 	LOG("create stream list");
 	data->streams_list = gtk_text_view_new();
 	gtk_text_view_set_editable(GTK_TEXT_VIEW(data->streams_list), FALSE);
 
+	LOG("create telemetry panel");
+	data->telemetry_label = gtk_label_new(NULL);
+	gtk_label_set_xalign(GTK_LABEL(data->telemetry_label), 0);
+	gtk_widget_set_no_show_all(data->telemetry_label, TRUE);
+	side_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+	gtk_box_pack_start(GTK_BOX(side_box), data->streams_list, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(side_box), data->telemetry_label, FALSE,
+			   FALSE, 2);
+
 	LOG("Add controls");
 	controls = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
 	gtk_box_pack_start(GTK_BOX(controls), data->play_button, FALSE, FALSE, 2);
@@ -266,10 +1447,10 @@ static void create_ui(PlayerData * data)
 
 	LOG("Add to main_hbox");
 	main_hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+	data->video_box = main_hbox;
 	gtk_box_pack_start(GTK_BOX(main_hbox), data->video_window, TRUE, TRUE,
 			   0);
-	gtk_box_pack_start(GTK_BOX(main_hbox), data->streams_list, FALSE, FALSE,
-			   2);
+	gtk_box_pack_start(GTK_BOX(main_hbox), side_box, FALSE, FALSE, 2);
 
 	LOG("Add to main_box");
 	data->main_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
@@ -278,55 +1459,22 @@ static void create_ui(PlayerData * data)
 	gtk_box_pack_start(GTK_BOX(data->main_box), sliderbox, FALSE, FALSE, 0);
 }
 
-/* This function is called periodically to refresh the GUI */
-static gboolean refresh_ui(PlayerData * data)
+/* These functions are called when new metadata is discovered in a stream.
+ * We are possibly in a GStreamer working thread: the stream model is updated
+ * right here and the GUI is notified from the main thread. */
+static void video_tags_cb(GstElement * playbin, gint stream, PlayerData * data)
 {
-	gint64 current = -1;
-	FUNC_ENTER;
-	/* We do not want to update anything unless we are in the PAUSED or PLAYING states */
-	if (data->state < GST_STATE_PAUSED)
-		return TRUE;
-
-	/* If we didn't know it yet, query the stream duration */
-	if (!GST_CLOCK_TIME_IS_VALID(data->duration)) {
-		if (!gst_element_query_duration
-		    (data->playbin, GST_FORMAT_TIME, &data->duration)) {
-			g_printerr("Could not query current duration.\n");
-		} else {
-			/* Set the range of the slider to the clip duration, in SECONDS */
-			gtk_range_set_range(GTK_RANGE(data->slider), 0,
-					    (gdouble) data->duration /
-					    GST_SECOND);
-		}
-	}
+	player_streams_update(data, PLAYER_STREAM_VIDEO, stream);
+}
 
-	if (gst_element_query_position
-	    (data->playbin, GST_FORMAT_TIME, &current)) {
-		/* Block the "value-changed" signal, so the slider_cb function is not called
-		 * (which would trigger a seek the user has not requested) */
-		g_signal_handler_block(data->slider,
-				       data->slider_update_signal_id);
-		/* Set the position of the slider to the current pipeline positoin, in SECONDS */
-		gtk_range_set_value(GTK_RANGE(data->slider),
-				    (gdouble) current / GST_SECOND);
-		/* Re-enable the signal */
-		g_signal_handler_unblock(data->slider,
-					 data->slider_update_signal_id);
-	}
-	return TRUE;
+static void audio_tags_cb(GstElement * playbin, gint stream, PlayerData * data)
+{
+	player_streams_update(data, PLAYER_STREAM_AUDIO, stream);
 }
 
-/* This function is called when new metadata is discovered in the stream */
-static void tags_cb(GstElement * playbin, gint stream, PlayerData * data)
+static void text_tags_cb(GstElement * playbin, gint stream, PlayerData * data)
 {
-	FUNC_ENTER;
-	/* We are possibly in a GStreamer working thread, so we notify the main
-	 * thread of this event through a message in the bus */
-	gst_element_post_message(playbin,
-				 gst_message_new_application(GST_OBJECT
-							     (playbin),
-							     gst_structure_new_empty
-							     ("tags-changed")));
+	player_streams_update(data, PLAYER_STREAM_TEXT, stream);
 }
 
 /* This function is called when an error message is posted on the bus */
@@ -349,12 +1497,134 @@ static void error_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
 	gst_element_set_state(data->playbin, GST_STATE_READY);
 }
 
+/******************************************************************************/
+/*                                  Playlist                                  */
+/******************************************************************************/
+
+/* Everything that depends on the current item. The pipeline is not touched:
+ * decoders and streams are reset by the caller, the queued item has its own
+ * already. */
+static void set_current_uri(PlayerData * data, const char *uri)
+{
+	data->duration = GST_CLOCK_TIME_NONE;
+	player_telemetry_reset(data);
+	player_buffering_reset(data, TRUE);
+	player_memory_reset(data);
+	player_live_reset(data);
+	/* External subtitles belong to the item they were loaded for */
+	player_set_subtitle_file(data, NULL);
+	if (data->uri)
+		free(data->uri);
+	data->uri = strdup(uri);
+
+	player_thumbnailer_free(data->thumbnailer);
+	data->thumbnailer = NULL;
+	if (data->preview_interval)
+		data->thumbnailer =
+		    player_thumbnailer_new(data->uri, data->preview_interval);
+}
+
+/* Called from a streaming thread when the current item is almost fully
+ * consumed. Setting the next uri here is what makes the switch gapless. */
+static void about_to_finish_cb(GstElement * playbin, PlayerData * data)
+{
+	gchar *uri;
+
+	FUNC_ENTER;
+
+	g_mutex_lock(&data->queue_lock);
+	uri = g_queue_pop_head(&data->playlist);
+	if (uri) {
+		g_free(data->next_uri);
+		data->next_uri = g_strdup(uri);
+	}
+	g_mutex_unlock(&data->queue_lock);
+
+	if (uri) {
+		gchar *local = player_buffering_resolve_uri(uri);
+
+		queue_decoders(data);
+		g_object_set(playbin, "uri", local, NULL);
+		g_free(local);
+		g_free(uri);
+	}
+}
+
+/* This function is called when a new stream starts. After a gapless switch
+ * it is the first message of the next item. */
+static void stream_start_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	gchar *uri;
+
+	FUNC_ENTER;
+
+	player_telemetry_message(data, msg);
+
+	g_mutex_lock(&data->queue_lock);
+	uri = data->next_uri;
+	data->next_uri = NULL;
+	g_mutex_unlock(&data->queue_lock);
+
+	if (uri) {
+		DBG("playlist moved to next item");
+		player_resume_save(data, TRUE);
+		switch_decoders(data);
+		set_current_uri(data, uri);
+		player_resume_load(data, FALSE);
+		g_free(uri);
+		refresh_duration(data);
+	}
+}
+
+/* This function is called when a demuxer describes the streams it found */
+static void stream_collection_cb(GstBus * bus, GstMessage * msg,
+				 PlayerData * data)
+{
+	GstStreamCollection *collection = NULL;
+
+	FUNC_ENTER;
+
+	gst_message_parse_stream_collection(msg, &collection);
+	if (collection) {
+		player_streams_set_collection(data, collection);
+		gst_object_unref(collection);
+	}
+}
+
+/* Some element changed its latency: redistribute it over the pipeline */
+static void latency_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	FUNC_ENTER;
+	gst_bin_recalculate_latency(GST_BIN(data->playbin));
+	player_telemetry_message(data, msg);
+}
+
+/* QoS messages only feed the telemetry */
+static void telemetry_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	player_telemetry_message(data, msg);
+}
+
+/* Pause while the network can't keep up, resume once it can */
+static void buffering_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	player_buffering_message(data, msg);
+	player_telemetry_message(data, msg);
+}
+
+static void element_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+{
+	player_buffering_element_message(data, msg);
+	player_audio_element_message(data, msg);
+}
+
 /* This function is called when an End-Of-Stream message is posted on the bus.
  * We just set the pipeline to READY (which stops playback) */
 static void eos_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
 {
 	FUNC_ENTER;
 	g_print("End-Of-Stream reached.\n");
+	player_resume_save(data, TRUE);
 	gst_element_set_state(data->playbin, GST_STATE_READY);
 }
 
@@ -373,131 +1643,38 @@ static void state_changed_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
 			gst_element_state_get_name(new_state));
 		if (old_state == GST_STATE_READY
 		    && new_state == GST_STATE_PAUSED) {
+			mark_preroll_stage(data, &data->preroll.prerolled);
 			/* For extra responsiveness, we refresh the GUI as soon as we reach the PAUSED state */
-			refresh_ui(data);
-		}
-	}
-}
-
-/* Extract metadata from all the streams and write it to the text widget in the GUI */
-static void analyze_streams(PlayerData * data)
-{
-	gint i;
-	GstTagList *tags;
-	gchar *str, *total_str;
-	guint rate;
-	gint n_video, n_audio, n_text;
-	GtkTextBuffer *text;
-
-	FUNC_ENTER;
-
-	/* Clean current contents of the widget */
-	text = gtk_text_view_get_buffer(GTK_TEXT_VIEW(data->streams_list));
-	gtk_text_buffer_set_text(text, "", -1);
-
-	/* Read some properties */
-	g_object_get(data->playbin, "n-video", &n_video, NULL);
-	g_object_get(data->playbin, "n-audio", &n_audio, NULL);
-	g_object_get(data->playbin, "n-text", &n_text, NULL);
-
-	for (i = 0; i < n_video; i++) {
-		tags = NULL;
-		/* Retrieve the stream's video tags */
-		g_signal_emit_by_name(data->playbin, "get-video-tags", i,
-				      &tags);
-		if (tags) {
-			total_str = g_strdup_printf("video stream %d:\n", i);
-			gtk_text_buffer_insert_at_cursor(text, total_str, -1);
-			g_free(total_str);
-			gst_tag_list_get_string(tags, GST_TAG_VIDEO_CODEC,
-						&str);
-			total_str =
-			    g_strdup_printf("  codec: %s\n",
-					    str ? str : "unknown");
-			gtk_text_buffer_insert_at_cursor(text, total_str, -1);
-			g_free(total_str);
-			g_free(str);
-			gst_tag_list_free(tags);
-		}
-	}
-
-	for (i = 0; i < n_audio; i++) {
-		tags = NULL;
-		/* Retrieve the stream's audio tags */
-		g_signal_emit_by_name(data->playbin, "get-audio-tags", i,
-				      &tags);
-		if (tags) {
-			total_str = g_strdup_printf("\naudio stream %d:\n", i);
-			gtk_text_buffer_insert_at_cursor(text, total_str, -1);
-			g_free(total_str);
-			if (gst_tag_list_get_string
-			    (tags, GST_TAG_AUDIO_CODEC, &str)) {
-				total_str =
-				    g_strdup_printf("  codec: %s\n", str);
-				gtk_text_buffer_insert_at_cursor(text,
-								 total_str, -1);
-				g_free(total_str);
-				g_free(str);
-			}
-			if (gst_tag_list_get_string
-			    (tags, GST_TAG_LANGUAGE_CODE, &str)) {
-				total_str =
-				    g_strdup_printf("  language: %s\n", str);
-				gtk_text_buffer_insert_at_cursor(text,
-								 total_str, -1);
-				g_free(total_str);
-				g_free(str);
-			}
-			if (gst_tag_list_get_uint(tags, GST_TAG_BITRATE, &rate)) {
-				total_str =
-				    g_strdup_printf("  bitrate: %d\n", rate);
-				gtk_text_buffer_insert_at_cursor(text,
-								 total_str, -1);
-				g_free(total_str);
-			}
-			gst_tag_list_free(tags);
-		}
-	}
-
-	for (i = 0; i < n_text; i++) {
-		tags = NULL;
-		/* Retrieve the stream's subtitle tags */
-		g_signal_emit_by_name(data->playbin, "get-text-tags", i, &tags);
-		if (tags) {
-			total_str =
-			    g_strdup_printf("\nsubtitle stream %d:\n", i);
-			gtk_text_buffer_insert_at_cursor(text, total_str, -1);
-			g_free(total_str);
-			if (gst_tag_list_get_string
-			    (tags, GST_TAG_LANGUAGE_CODE, &str)) {
-				total_str =
-				    g_strdup_printf("  language: %s\n", str);
-				gtk_text_buffer_insert_at_cursor(text,
-								 total_str, -1);
-				g_free(total_str);
-				g_free(str);
-			}
-			gst_tag_list_free(tags);
+			refresh_duration(data);
+			refresh_position(data);
+			player_resume_apply(data);
 		}
+		/* Paused, stopped or finished: remember where */
+		if (old_state == GST_STATE_PLAYING)
+			player_resume_save(data, FALSE);
+		player_live_state_changed(data, new_state);
+		set_position_updates(data, new_state == GST_STATE_PLAYING);
+		if (old_state == GST_STATE_PLAYING)
+			refresh_position(data);
+		if (new_state < GST_STATE_PAUSED)
+			data->seek_in_flight = FALSE;
+		if (new_state == GST_STATE_PAUSED && !data->render_probe_id)
+			install_render_probe(data);
 	}
 }
 
-/* This function is called when an "application" message is posted on the bus.
- * Here we retrieve the message posted by the tags_cb callback */
-static void application_cb(GstBus * bus, GstMessage * msg, PlayerData * data)
+/* Called from a streaming thread once playbin created the source */
+static void source_setup_cb(GstElement * playbin, GstElement * source,
+			    PlayerData * data)
 {
-	FUNC_ENTER;
-	if (g_strcmp0
-	    (gst_structure_get_name(gst_message_get_structure(msg)),
-	     "tags-changed") == 0) {
-		/* If the message is the "tags-changed" (only one we are currently issuing), update
-		 * the stream info GUI */
-		analyze_streams(data);
-	}
+	player_live_source_setup(data, source);
 }
 
 static gint create_playbin(PlayerData * data)
 {
+	GstElement *scaletempo;
+	guint flags;
+
 	FUNC_ENTER;
 
 	/* Create the elements */
@@ -508,13 +1685,43 @@ static gint create_playbin(PlayerData * data)
 		return -1;
 	}
 
+	if (data->video_sink)
+		g_object_set(data->playbin, "video-sink", data->video_sink,
+			     NULL);
+	if (data->audio_sink)
+		g_object_set(data->playbin, "audio-sink", data->audio_sink,
+			     NULL);
+
+	/* Progressive network streams go to a file we can seek in, and report
+	 * buffering levels. Local files are not affected. */
+	g_object_get(data->playbin, "flags", &flags, NULL);
+	g_object_set(data->playbin, "flags",
+		     flags | PLAY_FLAG_DOWNLOAD | PLAY_FLAG_BUFFERING, NULL);
+
+	/* Keep the pitch when the rate changes, passthrough at 1x */
+	scaletempo = gst_element_factory_make("scaletempo", NULL);
+	if (scaletempo)
+		g_object_set(data->playbin, "audio-filter", scaletempo, NULL);
+
+	player_subtitles_init(data);
+
+	/* With our own sink we can watch it before the first (preroll) frame */
+	if (data->video_sink)
+		install_render_probe(data);
+
 	/* Connect to interesting signals in playbin */
 	g_signal_connect(G_OBJECT(data->playbin), "video-tags-changed",
-			 (GCallback) tags_cb, &data);
+			 (GCallback) video_tags_cb, data);
 	g_signal_connect(G_OBJECT(data->playbin), "audio-tags-changed",
-			 (GCallback) tags_cb, &data);
+			 (GCallback) audio_tags_cb, data);
 	g_signal_connect(G_OBJECT(data->playbin), "text-tags-changed",
-			 (GCallback) tags_cb, &data);
+			 (GCallback) text_tags_cb, data);
+	g_signal_connect(G_OBJECT(data->playbin), "about-to-finish",
+			 (GCallback) about_to_finish_cb, data);
+	g_signal_connect(G_OBJECT(data->playbin), "deep-element-added",
+			 (GCallback) deep_element_added_cb, data);
+	g_signal_connect(G_OBJECT(data->playbin), "source-setup",
+			 (GCallback) source_setup_cb, data);
 	return 0;
 }
 
@@ -534,32 +1741,137 @@ static void init_bus(PlayerData * data)
 				 (GCallback) eos_cb, data);
 		g_signal_connect(G_OBJECT(bus), "message::state-changed",
 				 (GCallback) state_changed_cb, data);
-		g_signal_connect(G_OBJECT(bus), "message::application",
-				 (GCallback) application_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::async-done",
+				 (GCallback) async_done_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::step-done",
+				 (GCallback) step_done_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::duration-changed",
+				 (GCallback) duration_changed_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::stream-start",
+				 (GCallback) stream_start_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::stream-collection",
+				 (GCallback) stream_collection_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::latency",
+				 (GCallback) latency_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::qos",
+				 (GCallback) telemetry_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::buffering",
+				 (GCallback) buffering_cb, data);
+		g_signal_connect(G_OBJECT(bus), "message::element",
+				 (GCallback) element_cb, data);
 		gst_object_unref(bus);
 	}
 }
 
-gint player_new(PlayerData * data)
+gint player_setup(PlayerData * data, PlayerRenderMode mode)
 {
 	FUNC_ENTER;
 	if (!data)
 		return -1;
 
 	/* Initialize GStreamer */
-	gst_init(NULL, NULL);
+	player_init_once();
 
 	/* Initialize our data structure */
 	memset(data, 0, sizeof(PlayerData));
 	data->duration = GST_CLOCK_TIME_NONE;
+	g_mutex_init(&data->stats_lock);
+	g_mutex_init(&data->queue_lock);
+	g_mutex_init(&data->policy_lock);
+	data->decoders = g_ptr_array_new_with_free_func(g_free);
+	player_streams_init(data);
+	g_queue_init(&data->playlist);
+	data->toggle_time = GST_CLOCK_TIME_NONE;
+	data->seek_time = GST_CLOCK_TIME_NONE;
+	data->step_time = GST_CLOCK_TIME_NONE;
+	data->resume_position = GST_CLOCK_TIME_NONE;
+	data->resume_audio = data->resume_text = -1;
+	data->preroll_start = GST_CLOCK_TIME_NONE;
+	reset_preroll_times(data);
+	data->seek_target = -1;
+	data->scrub_mode = TRUE;
+	data->buffer_high = 100;
+	data->rate = 1.0;
+
+	if (mode == PLAYER_RENDER_AUTO)
+		mode = overlay_supported()? PLAYER_RENDER_OVERLAY :
+		    PLAYER_RENDER_GTK_SINK;
+	data->render_mode = mode;
+
+	if (mode == PLAYER_RENDER_HEADLESS) {
+		/* No widget at all: GTK is never touched, no display needed */
+		if (create_fake_sinks(data) < 0)
+			return -1;
+		return create_playbin(data);
+	}
+
+	/* The sink widget must exist before the UI packs it */
+	if (mode == PLAYER_RENDER_GTK_SINK && create_video_sink(data) < 0)
+		return -1;
 
 	create_ui(data);
 
-	create_playbin(data);
+	return create_playbin(data);
+}
+
+/* Route a bus message to the matching handler. This is what the signal watch
+ * does for standalone players, pools call it from their shared dispatcher */
+void player_handle_message(PlayerData * data, GstMessage * msg)
+{
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_ERROR:
+		error_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_EOS:
+		eos_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_STATE_CHANGED:
+		state_changed_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_ASYNC_DONE:
+		async_done_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_STEP_DONE:
+		step_done_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_DURATION_CHANGED:
+		duration_changed_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_STREAM_START:
+		stream_start_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_STREAM_COLLECTION:
+		stream_collection_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_LATENCY:
+		latency_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_QOS:
+		telemetry_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_BUFFERING:
+		buffering_cb(NULL, msg, data);
+		break;
+	case GST_MESSAGE_ELEMENT:
+		element_cb(NULL, msg, data);
+		break;
+	default:
+		break;
+	}
+}
+
+gint player_new(PlayerData * data)
+{
+	return player_new_full(data, PLAYER_RENDER_AUTO);
+}
 
-    init_bus(data);
+gint player_new_full(PlayerData * data, PlayerRenderMode mode)
+{
+	FUNC_ENTER;
+	if (player_setup(data, mode) < 0)
+		return -1;
 
-	g_timeout_add_seconds(1, (GSourceFunc) refresh_ui, data);
+	init_bus(data);
 
 	return 0;
 }
@@ -572,6 +1884,21 @@ gint player_start(PlayerData * data)
     if (!data || !data->uri)
         return -EINVAL;
 
+	if (!data->play_button) {
+		/* Headless: no button to keep in sync */
+		start_preroll_timing(data);
+		if (data->state == GST_STATE_PLAYING || data->buffering_paused) {
+			player_buffering_reset(data, FALSE);
+			player_live_set_state(data, GST_STATE_PAUSED);
+		} else {
+			player_live_set_state(data,
+					      player_buffering_play(data) ?
+					      GST_STATE_PLAYING :
+					      GST_STATE_PAUSED);
+		}
+		return 0;
+	}
+
     active = !gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(data->play_button));
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(data->play_button), active);
 
@@ -580,32 +1907,146 @@ gint player_start(PlayerData * data)
 
 gint player_set_uri(PlayerData * data, const char *uri)
 {
+	gchar *local;
+
 	FUNC_ENTER;
 
     if (!data || !uri)
             return -EINVAL;
 
+	player_resume_save(data, FALSE);
 	gst_element_set_state(data->playbin, GST_STATE_READY);
-	data->duration = GST_CLOCK_TIME_NONE;
-	if (data->uri)
-		free(data->uri);
-	data->uri = strdup(uri);
-	g_object_set(data->playbin, "uri", data->uri, NULL);
+	stop_preroll_timing(data);
+	g_mutex_lock(&data->queue_lock);
+	g_clear_pointer(&data->next_uri, g_free);
+	g_mutex_unlock(&data->queue_lock);
+	clear_decoders(data);
+	set_current_uri(data, uri);
+	player_resume_load(data, TRUE);
+	local = player_buffering_resolve_uri(data->uri);
+	g_object_set(data->playbin, "uri", local, NULL);
+	g_free(local);
+
+	if (data->preroll_mode) {
+		/* Typefind, demux and decoder setup happen now, in the
+		 * background: play only has to start the clock */
+		start_preroll_timing(data);
+		player_live_set_state(data, GST_STATE_PAUSED);
+	}
     return 0;
 }
 
+/* Append uri to the playlist. It starts without a gap when the current item
+ * ends: playbin keeps its sinks and only switches the source. */
+gint player_queue_uri(PlayerData * data, const char *uri)
+{
+	FUNC_ENTER;
+
+	if (!data || !uri)
+		return -EINVAL;
+
+	g_mutex_lock(&data->queue_lock);
+	g_queue_push_tail(&data->playlist, g_strdup(uri));
+	g_mutex_unlock(&data->queue_lock);
+	return 0;
+}
+
+/* Skip to the next queued item right away. Unlike the end of an item this
+ * can't be gapless: the current item is interrupted. */
+gint player_next(PlayerData * data)
+{
+	gboolean playing;
+	gchar *uri;
+
+	FUNC_ENTER;
+
+	if (!data)
+		return -EINVAL;
+
+	g_mutex_lock(&data->queue_lock);
+	uri = g_queue_pop_head(&data->playlist);
+	g_mutex_unlock(&data->queue_lock);
+	if (!uri)
+		return -ENOENT;
+
+	playing = data->state == GST_STATE_PLAYING;
+	player_set_uri(data, uri);
+	g_free(uri);
+	if (playing)
+		player_live_set_state(data, GST_STATE_PLAYING);
+	return 0;
+}
+
+guint player_get_queue_length(PlayerData * data)
+{
+	guint length;
+
+	if (!data)
+		return 0;
+
+	g_mutex_lock(&data->queue_lock);
+	length = g_queue_get_length(&data->playlist);
+	g_mutex_unlock(&data->queue_lock);
+	return length;
+}
+
+void player_clear_queue(PlayerData * data)
+{
+	FUNC_ENTER;
+
+	if (!data)
+		return;
+
+	g_mutex_lock(&data->queue_lock);
+	g_queue_free_full(&data->playlist, g_free);
+	g_queue_init(&data->playlist);
+	g_mutex_unlock(&data->queue_lock);
+}
+
 void player_stop(PlayerData * data)
 {
 	FUNC_ENTER;
-	stop_cb(NULL, data);
+	player_do_stop(data);
 }
 
 void player_free(PlayerData * data)
 {
 	FUNC_ENTER;
 	/* Free resources */
+	player_control_free(data);
+	player_snapshot_free(data);
+	player_resume_save(data, FALSE);
+	set_position_updates(data, FALSE);
 	gst_element_set_state(data->playbin, GST_STATE_NULL);
 	gst_object_unref(data->playbin);
+	if (data->video_sink) {
+		if (data->video_window)
+			g_object_unref(data->video_window);
+		gst_object_unref(data->video_sink);
+	}
+	if (data->audio_sink)
+		gst_object_unref(data->audio_sink);
     if (data->uri)
 		free(data->uri);
+	if (data->fullscreen_window)
+		gtk_widget_destroy(data->fullscreen_window);
+	player_thumbnailer_free(data->thumbnailer);
+	player_clear_queue(data);
+	g_free(data->next_uri);
+	g_mutex_clear(&data->queue_lock);
+	if (data->decoder_ranks)
+		g_hash_table_unref(data->decoder_ranks);
+	g_strfreev(data->decoder_allow);
+	player_streams_free(data);
+	player_telemetry_free(data);
+	player_step_free(data);
+	player_subtitles_free(data);
+	player_memory_free(data);
+	player_audio_free(data);
+	player_live_free(data);
+	g_ptr_array_unref(data->decoders);
+	if (data->next_decoders)
+		g_ptr_array_unref(data->next_decoders);
+	g_mutex_clear(&data->policy_lock);
+	g_mutex_clear(&data->stats_lock);
 }
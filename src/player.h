@@ -3,28 +3,318 @@
 #include <gtk/gtk.h>
 #include <gst/gst.h>
 
-/* Structure to contain all our information, so we can pass it around */
+#include "player-thumbs.h"
+
+struct _PlayerPool;
+struct _PlayerTelemetryState;
+struct _PlayerStepCache;
+struct _PlayerSnapshots;
+struct _PlayerSubtitles;
+struct _PlayerMemory;
+struct _PlayerAudio;
+struct _PlayerControl;
+struct _PlayerData;
+
+/* Commands run asynchronously by the control thread */
+typedef enum {
+	PLAYER_COMMAND_PLAY,
+	PLAYER_COMMAND_PAUSE,
+	PLAYER_COMMAND_STOP,
+	PLAYER_COMMAND_SEEK,
+	PLAYER_COMMAND_SET_URI,
+	PLAYER_COMMAND_RATE,
+} PlayerCommandType;
+
+typedef void (*PlayerCommandDone) (struct _PlayerData * data,
+				   PlayerCommandType type, gint result,
+				   gpointer user_data);
+
+/* result is 0 once path is written, -1 if the frame could not be saved */
+typedef void (*PlayerSnapshotDone) (struct _PlayerData * data,
+				    const gchar * path, gint result,
+				    gpointer user_data);
+
+/* How decoded frames reach the screen, chosen at player_new_full() time */
+typedef enum {
+	PLAYER_RENDER_AUTO,	/* Overlay where supported, GTK sink otherwise */
+	PLAYER_RENDER_OVERLAY,	/* Sink draws in a native window (XID, HWND...) */
+	PLAYER_RENDER_GTK_SINK,	/* gtkglsink/gtksink widget composited by GTK */
+	PLAYER_RENDER_HEADLESS,	/* No UI, fakesinks: runs without a display */
+} PlayerRenderMode;
+
+/* Frame timing measured at the video sink input */
+typedef struct _PlayerRenderStats {
+	guint64 frames;		/* Frames that reached the video sink */
+	GstClockTime first_frame;	/* gst_util_get_timestamp() of the first one */
+	GstClockTime mean_interval;	/* Average time between two frames */
+	GstClockTime max_interval;	/* Worst time between two frames */
+	GstClockTimeDiff mean_lateness;	/* Average arrival time vs clock time */
+	GstClockTimeDiff max_lateness;
+	guint copies_per_frame;	/* 0 for GL memory, 1 when a CPU copy/upload is needed */
+	GstClockTime toggle_latency;	/* Last fullscreen toggle to next frame */
+	guint64 seeks;		/* Seeks answered by a frame */
+	GstClockTime last_seek_latency;	/* Seek request to next frame */
+	GstClockTime mean_seek_latency;
+	GstClockTime item_gap;	/* Last playlist switch, beyond one frame interval */
+	guint64 steps_forward;	/* Frame steps answered by a frame */
+	GstClockTime step_forward_latency;	/* Average step request to frame */
+	guint64 steps_backward;
+	GstClockTime step_backward_latency;
+	guint64 steps_cached;	/* Backward steps served without decoding */
+	guint64 snapshots;	/* Frames grabbed and saved */
+	GstClockTime snapshot_latency;	/* Average request to file written */
+} PlayerRenderStats;
+
+/* Time spent to reach each preroll stage, from the moment the pipeline left
+ * READY. GST_CLOCK_TIME_NONE for stages not reached (yet). */
+typedef struct _PlayerPrerollTimes {
+	GstClockTime typefind;	/* Container type found */
+	GstClockTime demux;	/* Demuxer exposed all its streams */
+	GstClockTime decoder;	/* First decoder created */
+	GstClockTime first_buffer;	/* First decoded buffer */
+	GstClockTime prerolled;	/* Pipeline reached PAUSED */
+} PlayerPrerollTimes;
+
+/* Live playback, from the source timestamp to the screen */
+typedef struct _PlayerLiveStats {
+	gboolean live;		/* The source doesn't preroll */
+	GstClockTime latency;	/* What the pipeline delays every frame by */
+	GstClockTimeDiff mean_age;	/* Frame age at the video sink input */
+	GstClockTimeDiff max_age;
+	GstClockTime end_to_end;	/* MAX(latency, mean_age) */
+} PlayerLiveStats;
+
+/* What the resume store keeps of a uri */
+typedef struct _PlayerResumeInfo {
+	GstClockTime position;	/* Where playback stopped, 0 once finished */
+	GstClockTime duration;
+	gint audio;		/* current-audio, -1 for playbin's choice */
+	gint text;		/* current-text, -1 for none shown */
+	gchar *summary;		/* Stream info panel text */
+} PlayerResumeInfo;
+
+typedef struct _PlayerResumeStats {
+	guint entries;		/* Distinct uris on disk */
+	guint64 log_bytes;
+	guint64 records_written;
+	guint64 batches;	/* One write each */
+	guint64 lookups;
+} PlayerResumeStats;
+
+/* Memory held by the pipeline of the current item, in bytes */
+typedef struct _PlayerMemoryStats {
+	gsize budget;		/* 0 when the element defaults apply */
+	gsize queued;		/* Compressed data in queue2/multiqueue now */
+	gsize queued_peak;
+	guint pool_buffers;	/* Video decoder pool size, in frames */
+	gsize pool_bytes;
+	gsize peak;		/* queued_peak + pool_bytes */
+	gsize frame_bytes;	/* Peak of decoded frames alive at once */
+	gsize measured_peak;	/* Peak of queued + decoded frames */
+	guint rebuffers;	/* Pauses because the buffer ran dry */
+} PlayerMemoryStats;
+
+/* Rolling playback counters, see player_set_telemetry(). Frame counters and
+ * averages restart with each item. */
+typedef struct _PlayerTelemetry {
+	guint64 rendered;	/* Frames that reached the video sink, less its drops */
+	guint64 dropped;	/* Video frames dropped by sinks and decoders */
+	guint64 qos_events;
+	GstClockTimeDiff jitter;	/* Rolling average of |QoS jitter| */
+	gdouble proportion;	/* Last QoS proportion, above 1.0 is too slow */
+	guint64 decoded;	/* Video frames timed at the decoders */
+	GstClockTime decode_time;	/* Rolling average per video frame */
+	gint buffering;		/* Last buffering percentage, -1 if none */
+	GstClockTime latency;	/* Pipeline latency, NONE if unknown */
+	guint streams_started;
+	guint queues;		/* queue/queue2 elements sampled */
+	gint queue_level_min;	/* Fill of the emptiest queue in %, -1 if none */
+	gint queue_level_max;	/* Fill of the fullest queue in % */
+} PlayerTelemetry;
+
+typedef enum {
+	PLAYER_STREAM_VIDEO,
+	PLAYER_STREAM_AUDIO,
+	PLAYER_STREAM_TEXT,
+} PlayerStreamType;
+
+#define PLAYER_STREAM_STRING_SIZE 64
+
+/* Cached description of one stream, filled from the stream collection, the
+ * tags and the caps as they are known. Plain data, so that it can be copied
+ * out without allocating. Strings are empty and numbers 0 when unknown. */
+typedef struct _PlayerStream {
+	PlayerStreamType type;
+	gint index;		/* Index among the streams of the same type */
+	gchar codec[PLAYER_STREAM_STRING_SIZE];
+	gchar media_type[PLAYER_STREAM_STRING_SIZE];	/* Encoded caps name */
+	gchar decoder[PLAYER_STREAM_STRING_SIZE];	/* Factory decoding it */
+	gchar language[16];
+	guint bitrate;
+	/* video */
+	gint width;
+	gint height;
+	gint fps_n;
+	gint fps_d;
+	/* audio */
+	gint rate;
+	gint channels;
+} PlayerStream;
+
+/* Structure to contain all our information, so we can pass it around.
+ * In headless mode every widget is NULL and only the player data is used. */
 typedef struct _PlayerData {
 	/* main container data */
 	GtkWidget *main_box;
 	guintptr window_handle;
 	GtkWidget *video_window;	/* The drawing area where the video will be shown */
+	GtkWidget *video_box;	/* Container of video_window in main_box */
+	PlayerRenderMode render_mode;
+	GstElement *video_sink;	/* Our own sink, NULL when playbin picks one */
+	GstElement *audio_sink;	/* Only set in headless mode */
 	GtkWidget *slider;	/* Slider widget to keep track of current position */
 	GtkWidget *streams_list;	/* Text widget to display info about the streams */
+	GtkWidget *telemetry_label;	/* Shown while telemetry is enabled */
 	gulong slider_update_signal_id;	/* Signal ID for the slider update signal */
 	gboolean isfullscreen;
-	GtkWidget *fullscreen_window;
+	GtkWidget *fullscreen_window;	/* Persistent, only shown/hidden */
+	GtkWidget *fullscreen_area;	/* Pre-realized overlay target */
+	guintptr fullscreen_handle;
 	GtkWidget *play_button;
 	GtkWidget *fullscreen_button;
+	GtkWidget *preview;	/* Thumbnail popover over the slider */
+	GtkWidget *preview_image;
+	/* seek data */
+	gboolean scrub_mode;	/* Coalesce slider seeks (default) */
+	gboolean scrubbing;	/* The user is dragging the slider */
+	gboolean seek_in_flight;	/* Waiting for ASYNC_DONE */
+	gdouble seek_target;	/* Next position to seek to in seconds, -1 if none */
+	gdouble rate;		/* Playback rate of every seek, negative is backward */
 	/* player data */
 	gint64 duration;	/* Duration of the clip, in nanoseconds */
 	char *uri;
+	/* playlist, also read from the about-to-finish streaming thread */
+	GMutex queue_lock;
+	GQueue playlist;	/* Queued uris (gchar *) */
+	gchar *next_uri;	/* Set by about-to-finish until the item starts */
+	gboolean preroll_mode;	/* Preroll as soon as a URI is set */
+	/* network buffering */
+	gboolean buffering;	/* Buffer too low to play */
+	gboolean buffering_paused;	/* We paused, resume once buffered */
+	gint buffer_high;	/* Resume level in %, adapted to bandwidth */
+	gint64 bandwidth;	/* Rolling download rate, bytes per second */
+	guint rebuffers;	/* Pauses on an empty buffer, this item */
+	/* decoder policy, read from streaming threads */
+	GMutex policy_lock;
+	GHashTable *decoder_ranks;	/* Factory name -> rank override */
+	gchar **decoder_allow;	/* Only these decoders when set */
+	GPtrArray *decoders;	/* "media/type=factory" of the decoders in use */
+	GPtrArray *next_decoders;	/* Same for the queued item, until it starts */
+	/* stream info, updated from streaming threads */
+	GMutex streams_lock;
+	GArray *streams[PLAYER_STREAM_TEXT + 1];	/* StreamEntry per type */
+	GArray *next_streams[PLAYER_STREAM_TEXT + 1];	/* Queued item, or NULL */
+	gchar *streams_text;	/* Panel text built from streams */
+	gint streams_pending;	/* A panel update is scheduled */
+	guint streams_idle_id;	/* Under streams_lock */
+	guint streams_tick_id;
 	GstElement *playbin;	/* Our one and only pipeline */
 	GstState state;		/* Current state of the pipeline */
+	guint tick_id;		/* Position update tick callback, 0 unless playing */
+	gint64 last_position_update;	/* Frame time of the last update, in us */
+	GstClockTime preview_interval;	/* 0 when previews are disabled */
+	PlayerThumbnailer *thumbnailer;
+	struct _PlayerPool *pool;	/* Owning pool, NULL for standalone players */
+	struct _PlayerTelemetryState *telemetry;	/* NULL until enabled */
+	struct _PlayerStepCache *step;	/* Frames kept for backward steps */
+	struct _PlayerSnapshots *snapshots;	/* NULL until the first grab */
+	struct _PlayerSubtitles *subtitles;	/* External cues and overlay */
+	struct _PlayerMemory *memory;	/* NULL unless a budget was set */
+	/* resume store */
+	GstClockTime resume_position;	/* Seek there once prerolled */
+	gint resume_audio;
+	gint resume_text;
+	gint64 resume_saved;	/* Monotonic time of the last save */
+	/* live streams */
+	guint live_latency;	/* Requested latency in ms, 0 for files */
+	gchar *live_caps;	/* What raw network sources receive */
+	gboolean live;		/* NO_PREROLL source, atomic */
+	gboolean audio_only;	/* No video branch, no native window */
+	struct _PlayerAudio *audio;	/* Spectrum bands, NULL unless shown */
+	/* asynchronous control */
+	struct _PlayerControl *control;	/* NULL until the first command */
+	PlayerCommandDone command_done;
+	gpointer command_data;
+	/* render statistics, updated from the streaming thread */
+	GMutex stats_lock;
+	gulong render_probe_id;
+	GstClockTime last_frame_time;
+	GstClockTimeDiff lateness_sum;
+	GstClockTime toggle_time;	/* Pending fullscreen toggle measurement */
+	GstClockTime seek_time;	/* Pending seek latency measurement */
+	GstClockTime step_time;	/* Pending frame step measurement */
+	gboolean step_forward;
+	gboolean item_switch;	/* Pending playlist gap measurement */
+	GstClockTime preroll_start;
+	PlayerPrerollTimes preroll;
+	PlayerRenderStats render_stats;
 } PlayerData;
 
 gint player_new(PlayerData * data);
+gint player_new_full(PlayerData * data, PlayerRenderMode mode);
 gint player_set_uri(PlayerData * data, const char *uri);
 gint player_start(PlayerData * data);
+gint player_queue_uri(PlayerData * data, const char *uri);
+gint player_next(PlayerData * data);
+guint player_get_queue_length(PlayerData * data);
+void player_clear_queue(PlayerData * data);
 void player_stop(PlayerData * data);
+void player_set_command_callback(PlayerData * data, PlayerCommandDone done,
+				 gpointer user_data);
+gint player_command(PlayerData * data, PlayerCommandType type);
+gint player_command_seek(PlayerData * data, GstClockTime position);
+gint player_command_rate(PlayerData * data, gdouble rate);
+gint player_command_set_uri(PlayerData * data, const gchar * uri);
 void player_free(PlayerData * data);
+void player_set_decoder_rank(PlayerData * data, const gchar * factory,
+			     gint rank);
+void player_set_decoder_allow_list(PlayerData * data,
+				   const gchar * const *factories);
+gchar **player_get_decoders(PlayerData * data);
+guint player_get_streams(PlayerData * data, PlayerStream * streams,
+			 guint max);
+void player_set_preroll(PlayerData * data, gboolean enable);
+void player_download_cache_configure(const gchar * dir, guint64 max_bytes);
+void player_get_preroll_times(PlayerData * data, PlayerPrerollTimes * times);
+void player_set_preview_interval(PlayerData * data, GstClockTime interval);
+void player_set_scrub_mode(PlayerData * data, gboolean enable);
+gint player_set_rate(PlayerData * data, gdouble rate);
+gdouble player_get_rate(PlayerData * data);
+gint player_step(PlayerData * data, gint frames);
+gint player_seek_frame(PlayerData * data, guint64 frame);
+void player_set_step_cache(PlayerData * data, gsize max_bytes);
+gint player_snapshot(PlayerData * data, const gchar * path, gint width,
+		     gint height, PlayerSnapshotDone done, gpointer user_data);
+gint player_set_subtitle_file(PlayerData * data, const gchar * path);
+gchar *player_get_subtitle_at(PlayerData * data, GstClockTime position);
+gint player_set_text_stream(PlayerData * data, gint index);
+void player_set_subtitles_visible(PlayerData * data, gboolean visible);
+gboolean player_get_subtitles_visible(PlayerData * data);
+gint player_set_audio_only(PlayerData * data, gboolean enable, guint bands);
+gboolean player_get_audio_only(PlayerData * data);
+guint64 player_get_audio_updates(PlayerData * data);
+void player_set_live_mode(PlayerData * data, guint latency_ms,
+			  const gchar * caps);
+gboolean player_is_live(PlayerData * data);
+gboolean player_get_live_stats(PlayerData * data, PlayerLiveStats * stats);
+gint player_resume_configure(const gchar * path);
+gboolean player_resume_lookup(const gchar * uri, PlayerResumeInfo * info);
+void player_resume_store(const gchar * uri, const PlayerResumeInfo * info);
+void player_resume_info_clear(PlayerResumeInfo * info);
+void player_resume_get_stats(PlayerResumeStats * stats);
+void player_set_memory_budget(PlayerData * data, gsize bytes);
+gboolean player_get_memory_stats(PlayerData * data, PlayerMemoryStats * stats);
+void player_get_render_stats(PlayerData * data, PlayerRenderStats * stats);
+void player_set_telemetry(PlayerData * data, gboolean enable);
+gboolean player_get_telemetry(PlayerData * data, PlayerTelemetry * telemetry);
+gchar *player_get_telemetry_json(PlayerData * data);